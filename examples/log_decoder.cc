@@ -0,0 +1,84 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 03:10:44
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 03:10:44
+ * @FilePath     : /examples/log_decoder.cc
+ * @Description  : 把BinaryLogAppender写的二进制日志还原成文本
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 03:10:44
+ */
+#include "sylar/log.h"
+#include "sylar/log_binary.h"
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static void usage(const char *name) {
+  std::cerr << "usage: " << name << " [-p pattern] [-o output] file..."
+            << std::endl
+            << "  -p  use this LogFormatter pattern instead of the one "
+               "recorded in the file"
+            << std::endl
+            << "  -o  write to a file instead of stdout" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  std::string pattern;
+  std::string output;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:o:h")) != -1) {
+    switch (opt) {
+    case 'p':
+      pattern = optarg;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  sylar::LogFormatter::ptr fmt;
+  if (!pattern.empty()) {
+    fmt.reset(new sylar::LogFormatter(pattern));
+    if (fmt->isError()) {
+      std::cerr << "invalid pattern: " << pattern << std::endl;
+      return 1;
+    }
+  }
+
+  std::ofstream ofs;
+  if (!output.empty()) {
+    ofs.open(output, std::ios::trunc);
+    if (!ofs) {
+      std::cerr << "cannot open " << output << std::endl;
+      return 1;
+    }
+  }
+  std::ostream &os = output.empty() ? std::cout : ofs;
+
+  int rt = 0;
+  std::string line;
+  for (int i = optind; i < argc; ++i) {
+    sylar::BinaryLogReader reader;
+    if (!reader.open(argv[i])) {
+      std::cerr << argv[i] << ": not a binary log" << std::endl;
+      rt = 1;
+      continue;
+    }
+    while (reader.next(line, fmt)) {
+      os.write(line.data(), line.size());
+      line.clear();
+    }
+  }
+  return rt;
+}
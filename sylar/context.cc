@@ -0,0 +1,198 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-17 11:03:25
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-17 11:03:25
+ * @FilePath     : /sylar/context.cc
+ * @Description  : 
+ * Copyright 2024 OBKoro1, All Rights Reserved. 
+ * 2026-10-17 11:03:25
+ */
+#include "context.h"
+#include <cstdint>
+
+#if SYLAR_ASM_CONTEXT
+
+extern "C" void sylar_context_entry();
+
+#if defined(__x86_64__)
+// 切换时压栈保存 rbp rbx r15 r14 r13 r12 以及 mxcsr 和 x87控制字
+// 新协程第一次切换进来时ret到sylar_context_entry，由它调用保存在r12中的入口函数
+asm(R"(
+.text
+.globl sylar_swap_context
+.type sylar_swap_context,@function
+.align 16
+sylar_swap_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    leaq -8(%rsp), %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    leaq 8(%rsp), %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+.size sylar_swap_context,.-sylar_swap_context
+
+.globl sylar_context_entry
+.type sylar_context_entry,@function
+.align 16
+sylar_context_entry:
+    andq $-16, %rsp
+    callq *%r12
+    ud2
+.size sylar_context_entry,.-sylar_context_entry
+)");
+
+namespace sylar {
+
+// 栈上的布局需要和sylar_swap_context恢复的顺序一致
+struct InitialFrame {
+  uint32_t mxcsr;
+  uint16_t fpucw;
+  uint16_t padding;
+  uint64_t r12;
+  uint64_t r13;
+  uint64_t r14;
+  uint64_t r15;
+  uint64_t rbx;
+  uint64_t rbp;
+  uint64_t rip;
+};
+
+bool MakeContext(Context *ctx, void *stack, std::size_t size, void (*fn)()) {
+  uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+  // 留出8字节，保持sylar_context_entry入口处的对齐和普通函数调用一致
+  InitialFrame *frame = (InitialFrame *)(top - 8 - sizeof(InitialFrame));
+  frame->mxcsr = 0x1F80;
+  frame->fpucw = 0x037F;
+  frame->padding = 0;
+  frame->r12 = (uint64_t)fn;
+  frame->r13 = frame->r14 = frame->r15 = frame->rbx = 0;
+  frame->rbp = 0;
+  frame->rip = (uint64_t)&sylar_context_entry;
+  ctx->sp = frame;
+  return true;
+}
+
+}
+
+#elif defined(__aarch64__)
+// 保存 d8-d15 x19-x30，新协程第一次切换进来时ret到sylar_context_entry，由它调用保存在x19中的入口函数
+asm(R"(
+.text
+.globl sylar_swap_context
+.type sylar_swap_context,%function
+.align 4
+sylar_swap_context:
+    sub sp, sp, #176
+    stp d8, d9, [sp, #0]
+    stp d10, d11, [sp, #16]
+    stp d12, d13, [sp, #32]
+    stp d14, d15, [sp, #48]
+    stp x19, x20, [sp, #64]
+    stp x21, x22, [sp, #80]
+    stp x23, x24, [sp, #96]
+    stp x25, x26, [sp, #112]
+    stp x27, x28, [sp, #128]
+    stp x29, x30, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0]
+    ldp d10, d11, [sp, #16]
+    ldp d12, d13, [sp, #32]
+    ldp d14, d15, [sp, #48]
+    ldp x19, x20, [sp, #64]
+    ldp x21, x22, [sp, #80]
+    ldp x23, x24, [sp, #96]
+    ldp x25, x26, [sp, #112]
+    ldp x27, x28, [sp, #128]
+    ldp x29, x30, [sp, #144]
+    add sp, sp, #176
+    ret
+.size sylar_swap_context,.-sylar_swap_context
+
+.globl sylar_context_entry
+.type sylar_context_entry,%function
+.align 4
+sylar_context_entry:
+    blr x19
+    brk #0
+.size sylar_context_entry,.-sylar_context_entry
+)");
+
+namespace sylar {
+
+struct InitialFrame {
+  uint64_t d[8];
+  uint64_t x19_x28[10];
+  uint64_t x29;
+  uint64_t x30;
+  uint64_t padding[2];
+};
+
+bool MakeContext(Context *ctx, void *stack, std::size_t size, void (*fn)()) {
+  uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+  InitialFrame *frame = (InitialFrame *)(top - sizeof(InitialFrame));
+  for (auto &i : frame->d) {
+    i = 0;
+  }
+  for (auto &i : frame->x19_x28) {
+    i = 0;
+  }
+  frame->x19_x28[0] = (uint64_t)fn;
+  frame->x29 = 0;
+  frame->x30 = (uint64_t)&sylar_context_entry;
+  ctx->sp = frame;
+  return true;
+}
+
+}
+
+#endif
+
+namespace sylar {
+
+bool InitContext(Context *ctx) {
+  ctx->sp = nullptr;
+  return true;
+}
+
+}
+
+#else
+
+namespace sylar {
+
+bool InitContext(Context *ctx) {
+  return getcontext(&ctx->uc) == 0;
+}
+
+bool MakeContext(Context *ctx, void *stack, std::size_t size, void (*fn)()) {
+  if (getcontext(&ctx->uc)) {
+    return false;
+  }
+  ctx->uc.uc_link = nullptr;
+  ctx->uc.uc_stack.ss_sp = stack;
+  ctx->uc.uc_stack.ss_size = size;
+  makecontext(&ctx->uc, fn, 0);
+  return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-17 11:03:18
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-17 11:03:18
+ * @FilePath     : /sylar/context.h
+ * @Description  : 协程上下文切换
+ * Copyright 2024 OBKoro1, All Rights Reserved. 
+ * 2026-10-17 11:03:18
+ */
+#ifndef __SYLAR_CONTEXT_H__
+#define __SYLAR_CONTEXT_H__
+
+#include <cstddef>
+
+// 编译时定义SYLAR_FIBER_ASM(cmake选项SYLAR_FIBER_ASM)，并且是x86-64或aarch64时使用汇编切换，
+// 只保存callee-saved寄存器和栈指针，不像swapcontext那样每次调用rt_sigprocmask
+// 其他情况使用ucontext
+#if defined(SYLAR_FIBER_ASM) && (defined(__x86_64__) || defined(__aarch64__))
+#define SYLAR_ASM_CONTEXT 1
+#else
+#define SYLAR_ASM_CONTEXT 0
+#include <ucontext.h>
+#endif
+
+#if SYLAR_ASM_CONTEXT
+extern "C" void sylar_swap_context(void **from_sp, void *to_sp);
+#endif
+
+namespace sylar {
+
+#if SYLAR_ASM_CONTEXT
+// 寄存器都保存在协程自己的栈上，上下文只需要记录栈指针
+struct Context {
+  void *sp = nullptr;
+};
+#else
+struct Context {
+  ucontext_t uc;
+};
+#endif
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 初始化线程主协程的上下文，主协程使用线程自己的栈
+ */
+bool InitContext(Context *ctx);
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 初始化上下文，切换进去后在stack上运行fn，fn不能返回
+ */
+bool MakeContext(Context *ctx, void *stack, std::size_t size, void (*fn)());
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 保存当前上下文到from，切换到to
+ */
+inline bool SwapContext(Context *from, Context *to) {
+#if SYLAR_ASM_CONTEXT
+  sylar_swap_context(&from->sp, to->sp);
+  return true;
+#else
+  return swapcontext(&from->uc, &to->uc) == 0;
+#endif
+}
+
+}
+
+#endif
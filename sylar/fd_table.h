@@ -0,0 +1,172 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 00:10:12
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 00:10:12
+ * @FilePath     : /sylar/fd_table.h
+ * @Description  : 按fd下标的无锁表，分段分配，已分配的段不会移动
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 00:10:12
+ */
+#ifndef __SYLAR_FD_TABLE_H__
+#define __SYLAR_FD_TABLE_H__
+
+#include <atomic>
+#include <cstddef>
+
+namespace sylar {
+
+// 两级数组：固定长度的段目录 + 每段SegmentSize个槽位
+// 读取只需要两次acquire load，不加锁；扩容只是CAS装入新的段，不影响正在读的线程
+// 段和目录在表析构前都不会释放，槽位中对象的生命周期由使用者管理
+template <class T, std::size_t SegmentBits = 10, std::size_t MaxSegments = 1024>
+class FdTable {
+public:
+  static const std::size_t SegmentSize = (std::size_t)1 << SegmentBits;
+  static const std::size_t Capacity = SegmentSize * MaxSegments;
+
+  FdTable() {
+    for (std::size_t i = 0; i < MaxSegments; ++i) {
+      m_segments[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~FdTable() {
+    for (std::size_t i = 0; i < MaxSegments; ++i) {
+      delete m_segments[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  FdTable(const FdTable &) = delete;
+  FdTable &operator=(const FdTable &) = delete;
+
+  /**
+   * @func:
+   * @param {int} fd
+   * @return {*} 段或槽位不存在时返回nullptr
+   * @description: 无锁读取
+   */
+  T *get(int fd) const {
+    if (fd < 0 || (std::size_t)fd >= Capacity) {
+      return nullptr;
+    }
+    Segment *seg = m_segments[fd >> SegmentBits].load(std::memory_order_acquire);
+    if (!seg) {
+      return nullptr;
+    }
+    return seg->slots[fd & (SegmentSize - 1)].load(std::memory_order_acquire);
+  }
+
+  /**
+   * @func:
+   * @param {int} fd
+   * @param {T} *expected 槽位中应有的值，失败时写回当前值
+   * @param {T} *desired
+   * @return {*} fd超出容量或者槽位不是expected时返回false
+   * @description: 比较并设置槽位，段不存在时先装入
+   */
+  bool compareExchange(int fd, T *&expected, T *desired) {
+    std::atomic<T *> *slot = getSlot(fd);
+    if (!slot) {
+      return false;
+    }
+    return slot->compare_exchange_strong(expected, desired,
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_acquire);
+  }
+
+  /**
+   * @func:
+   * @return {*} 原来的值，fd超出容量时返回nullptr并且不设置
+   * @description: 设置槽位
+   */
+  T *exchange(int fd, T *desired) {
+    std::atomic<T *> *slot = getSlot(fd);
+    if (!slot) {
+      return nullptr;
+    }
+    return slot->exchange(desired, std::memory_order_acq_rel);
+  }
+
+  /**
+   * @func:
+   * @param {Fn} create 槽位为空时创建对象，返回T*
+   * @return {*} fd超出容量时返回nullptr
+   * @description: 取得槽位中的对象，没有时创建；并发创建时只保留一个，多余的delete
+   */
+  template <class Fn> T *getOrCreate(int fd, Fn create) {
+    T *cur = get(fd);
+    if (cur) {
+      return cur;
+    }
+    std::atomic<T *> *slot = getSlot(fd);
+    if (!slot) {
+      return nullptr;
+    }
+    T *obj = create();
+    T *expected = nullptr;
+    if (slot->compare_exchange_strong(expected, obj,
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_acquire)) {
+      return obj;
+    }
+    delete obj;
+    return expected;
+  }
+
+  /**
+   * @func:
+   * @return {*}
+   * @description: 对所有非空槽位调用fn(fd, T*)，用于析构时释放对象
+   */
+  template <class Fn> void foreach(Fn fn) const {
+    for (std::size_t i = 0; i < MaxSegments; ++i) {
+      Segment *seg = m_segments[i].load(std::memory_order_acquire);
+      if (!seg) {
+        continue;
+      }
+      for (std::size_t j = 0; j < SegmentSize; ++j) {
+        T *obj = seg->slots[j].load(std::memory_order_acquire);
+        if (obj) {
+          fn((int)(i * SegmentSize + j), obj);
+        }
+      }
+    }
+  }
+
+private:
+  struct Segment {
+    Segment() {
+      for (std::size_t i = 0; i < SegmentSize; ++i) {
+        slots[i].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+    std::atomic<T *> slots[SegmentSize];
+  };
+
+  // 段不存在时分配并装入，并发装入时只保留一个
+  std::atomic<T *> *getSlot(int fd) {
+    if (fd < 0 || (std::size_t)fd >= Capacity) {
+      return nullptr;
+    }
+    std::atomic<Segment *> &entry = m_segments[fd >> SegmentBits];
+    Segment *seg = entry.load(std::memory_order_acquire);
+    if (!seg) {
+      Segment *fresh = new Segment;
+      if (entry.compare_exchange_strong(seg, fresh, std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+        seg = fresh;
+      } else {
+        delete fresh;
+      }
+    }
+    return &seg->slots[fd & (SegmentSize - 1)];
+  }
+
+private:
+  std::atomic<Segment *> m_segments[MaxSegments];
+};
+
+} // namespace sylar
+
+#endif
@@ -12,24 +12,127 @@
 #include "sylar/hook.h"
 #include "sylar/log.h"
 #include "sylar/util.h"
+#include <algorithm>
 #include <asm-generic/socket.h>
 #include <cstdint>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <vector>
 
 namespace sylar {
 static Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
 FdCtx::FdCtx(int fd)
     : m_isInit(false), m_isSocket(false), m_sysNonblock(false),
-      m_userNonblock(false), m_isClosed(false), m_fd(fd),
+      m_userNonblock(false), m_fd(fd),
       m_recvTimeout(-1), m_sendTimeout(-1){
   init();
 }
 
 FdCtx::~FdCtx() {}
+
+// 最高位表示已经被close从表中摘下
+static const uint32_t DETACHED = 0x80000000u;
+// 次高位表示已经交给Retire，之后数量再变化也不会重复释放
+static const uint32_t RETIRED = 0x40000000u;
+
+void FdCtx::unpin() {
+  uint32_t v = m_pins.fetch_sub(1, std::memory_order_acq_rel) - 1;
+  if (v == DETACHED &&
+      m_pins.compare_exchange_strong(v, DETACHED | RETIRED,
+                                     std::memory_order_acq_rel)) {
+    FdManager::Retire(this);
+  }
+}
+
+// 每个线程一个hazard记录，线程退出后留给其他线程复用，不释放
+struct FdHazard {
+  std::atomic<FdCtx *> ptr = {nullptr};
+  std::atomic<bool> active = {false};
+  FdHazard *next = nullptr;
+};
+
+static std::atomic<FdHazard *> s_hazards = {nullptr};
+
+static FdHazard *AcquireHazard() {
+  for (FdHazard *h = s_hazards.load(std::memory_order_acquire); h;
+       h = h->next) {
+    bool expected = false;
+    if (!h->active.load(std::memory_order_relaxed) &&
+        h->active.compare_exchange_strong(expected, true,
+                                          std::memory_order_acq_rel)) {
+      return h;
+    }
+  }
+  FdHazard *h = new FdHazard;
+  h->active.store(true, std::memory_order_relaxed);
+  FdHazard *head = s_hazards.load(std::memory_order_relaxed);
+  do {
+    h->next = head;
+  } while (!s_hazards.compare_exchange_weak(head, h, std::memory_order_acq_rel,
+                                            std::memory_order_relaxed));
+  return h;
+}
+
+static void ReleaseHazard(FdHazard *h) {
+  h->ptr.store(nullptr, std::memory_order_release);
+  h->active.store(false, std::memory_order_release);
+}
+
+struct FdHazardHolder {
+  FdHazard *hazard = nullptr;
+  ~FdHazardHolder();
+};
+
+// 线程局部变量析构之后(其他线程局部变量的析构函数中close)每次临时取一个
+static thread_local bool t_fd_hazard_dead = false;
+static thread_local FdHazardHolder t_fd_hazard;
+
+FdHazardHolder::~FdHazardHolder() {
+  if (hazard) {
+    ReleaseHazard(hazard);
+    hazard = nullptr;
+  }
+  t_fd_hazard_dead = true;
+}
+
+// 等待释放的FdCtx，只在close时还有其他持有者的少数情况下出现
+static Mutex s_retired_mutex;
+static std::vector<FdCtx *> s_retired;
+
+void FdManager::Retire(FdCtx *ctx) {
+  std::vector<FdCtx *> frees;
+  {
+    Mutex::Lock lock(s_retired_mutex);
+    if (ctx) {
+      s_retired.push_back(ctx);
+    }
+    // 和acquire中设置hazard之后的重新读取配对
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::vector<FdCtx *> hazards;
+    for (FdHazard *h = s_hazards.load(std::memory_order_acquire); h;
+         h = h->next) {
+      FdCtx *p = h->ptr.load(std::memory_order_seq_cst);
+      if (p) {
+        hazards.push_back(p);
+      }
+    }
+    for (auto it = s_retired.begin(); it != s_retired.end();) {
+      if (std::find(hazards.begin(), hazards.end(), *it) == hazards.end()) {
+        frees.push_back(*it);
+        it = s_retired.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  for (auto i : frees) {
+    delete i;
+  }
+}
+
 /**
  * @func: 
  * @return {*}
@@ -62,7 +165,7 @@ bool FdCtx::init() {
   }
 
   m_userNonblock = false;
-  m_isClosed = false;
+  m_isClosed.store(false, std::memory_order_release);
   
   return m_isInit;
 }
@@ -82,36 +185,97 @@ uint64_t FdCtx::getTimeout(int type) {
   return m_sendTimeout;
 }
 
-FdManager::FdManager() { m_datas.resize(64); }
+FdManager::FdManager() {}
+
+FdManager::~FdManager() {
+  m_datas.foreach([](int fd, FdCtx *ctx) { delete ctx; });
+  Mutex::Lock lock(s_retired_mutex);
+  for (auto i : s_retired) {
+    delete i;
+  }
+  s_retired.clear();
+}
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_datas.size() <= fd) {
-    if (!auto_create) {
-      return nullptr;
+FdCtx *FdManager::acquire(int fd) {
+  FdHazard *hazard = t_fd_hazard.hazard;
+  bool temp = false;
+  if (!hazard) {
+    hazard = AcquireHazard();
+    if (t_fd_hazard_dead) {
+      temp = true;
+    } else {
+      t_fd_hazard.hazard = hazard;
     }
-    m_datas.resize(m_datas.size() * 1.5);
   }
-  else {
-    if (m_datas[fd] || !auto_create) {
-        return m_datas[fd];
+  FdCtx *ctx;
+  while (true) {
+    ctx = m_datas.get(fd);
+    if (!ctx) {
+      break;
     }
+    // 先公布要访问的指针，再确认它还在表中；之后摘下它的线程一定能看到hazard
+    hazard->ptr.store(ctx, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_datas.get(fd) != ctx) {
+      continue;
+    }
+    uint32_t pins = ctx->m_pins.fetch_add(1, std::memory_order_acq_rel);
+    if (!(pins & DETACHED)) {
+      break;
+    }
+    // 确认之后被摘下了，撤销pin后重新读取槽位；hazard还在，撤销时即使释放也是推迟的
+    ctx->unpin();
+  }
+  hazard->ptr.store(nullptr, std::memory_order_release);
+  if (temp) {
+    ReleaseHazard(hazard);
   }
-
-  lock.unlock();
-
-  RWMutexType::WriteLock lock2(m_mutex);
-  FdCtx::ptr ctx(new FdCtx(fd));
-  m_datas[fd] = ctx;
   return ctx;
 }
 
+/**
+ * @func: 
+ * @return {*}
+ * @description: 无锁查找并pin住；同一个fd同时只会被内核分配给一个socket，所以复用时不会竞争
+ */
+FdCtxRef FdManager::get(int fd, bool auto_create) {
+  FdCtxRef ctx(acquire(fd));
+  if (ctx && !ctx->isClose()) {
+    return ctx;
+  }
+  if (!auto_create) {
+    return FdCtxRef();
+  }
+  // close时没有其他持有者，原地重新初始化
+  if (ctx) {
+    ctx->m_isInit = false;
+    ctx->init();
+    return ctx;
+  }
+  m_datas.getOrCreate(fd, [fd]() { return new FdCtx(fd); });
+  return FdCtxRef(acquire(fd));
+}
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 标记关闭；还有其他持有者时从表中摘下，由最后一个持有者释放
+ */
 void FdManager::del(int fd) {
-  RWMutexType::WriteLock lock(m_mutex);
-  SYLAR_LOG_ERROR(g_logger) << "delete fd";
-  if ((int)m_datas.size() <= fd) {
+  FdCtx *ctx = acquire(fd);
+  if (!ctx) {
     return;
   }
-  m_datas[fd].reset();
+  ctx->m_isClosed.store(true, std::memory_order_release);
+  // 除了自己之外没有持有者，留在表中给下一个socket复用
+  if ((ctx->m_pins.load(std::memory_order_acquire) & ~(DETACHED | RETIRED)) >
+      1) {
+    // 先摘下，之后acquire不会再拿到它
+    FdCtx *expected = ctx;
+    if (m_datas.compareExchange(fd, expected, nullptr)) {
+      ctx->m_pins.fetch_or(DETACHED, std::memory_order_acq_rel);
+    }
+  }
+  ctx->unpin();
+}
 }
-}
\ No newline at end of file
@@ -11,25 +11,44 @@
 #ifndef __SYLAR_FDMANAGER_H__
 #define __SYLAR_FDMANAGER_H__
 
-#include "sylar/mutex.h"
+#include "sylar/fd_table.h"
 #include "sylar/singleton.h"
+#include "sylar/timer.h"
+#include <atomic>
 #include <boost/type.hpp>
 #include <cstdint>
 #include <memory>
 #include <vector>
 namespace sylar {
 
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class IOManager;
+
+// hook中阻塞io的超时，同一个fd的同一个方向同时只有一个协程等待，所以放在FdCtx中
+// 不放在协程栈上：共享栈协程挂起后栈会被其他协程覆盖
+struct IoTimeout : public IntrusiveTimer {
+  IOManager *iom = nullptr;
+  int fd = -1;
+  uint32_t event = 0;
+  // 超时后为ETIMEDOUT
+  std::atomic<int> cancelled = {0};
+};
+
+// FdManager::get返回pin住的句柄，close之后槽位中的FdCtx原地复用给同一个fd
+// close时还有其他持有者的FdCtx从表中摘下，由最后一个持有者交给FdManager延迟释放
+class FdCtx {
+  friend class FdManager;
+
 public:
-  typedef std::shared_ptr<FdCtx> ptr;
   FdCtx(int fd);
   ~FdCtx();
 
   bool init();
   bool isInit() const { return m_isInit; }
   bool isSocket() const { return m_isSocket; }
-  bool isClose() const { return m_isClosed; }
-  bool close();
+  bool isClose() const { return m_isClosed.load(std::memory_order_acquire); }
+
+  // 释放句柄，已经被close摘下并且是最后一个持有者时交给FdManager释放
+  void unpin();
 
   void setUserNonblock(bool v) { m_sysNonblock = v; }
   bool getUserNonblock() const { return m_userNonblock; }
@@ -40,6 +59,9 @@ public:
   void setTimeout(int type, uint64_t v);
   uint64_t getTimeout(int type);
 
+  IoTimeout &getReadTimer() { return m_readTimer; }
+  IoTimeout &getWriteTimer() { return m_writeTimer; }
+
 private:
   // 是否初始化
   bool m_isInit : 1;
@@ -50,29 +72,84 @@ private:
   // 是否用户主动设置非阻塞
   bool m_userNonblock : 1;
   // 是否关闭
-  bool m_isClosed : 1;
+  std::atomic<bool> m_isClosed = {false};
+  // 持有句柄的数量，最高位表示已经从表中摘下，次高位表示已经交给FdManager释放
+  std::atomic<uint32_t> m_pins = {0};
   // 文件句柄
   int m_fd;
   // 读超时时间
   uint64_t m_recvTimeout;
   // 写超时时间
   uint64_t m_sendTimeout;
+  // 读写等待的超时定时器
+  IoTimeout m_readTimer;
+  IoTimeout m_writeTimer;
 };
 
-class FdManager {
+// pin住的FdCtx，持有期间即使fd被close也不会释放，析构时unpin
+class FdCtxRef {
 public:
-  typedef RWMutex RWMutexType;
+  FdCtxRef() {}
+  explicit FdCtxRef(FdCtx *ctx) : m_ctx(ctx) {}
+  FdCtxRef(FdCtxRef &&oth) : m_ctx(oth.m_ctx) { oth.m_ctx = nullptr; }
+  FdCtxRef &operator=(FdCtxRef &&oth) {
+    if (this != &oth) {
+      reset();
+      m_ctx = oth.m_ctx;
+      oth.m_ctx = nullptr;
+    }
+    return *this;
+  }
+  ~FdCtxRef() { reset(); }
+
+  FdCtxRef(const FdCtxRef &) = delete;
+  FdCtxRef &operator=(const FdCtxRef &) = delete;
+
+  void reset() {
+    if (m_ctx) {
+      m_ctx->unpin();
+      m_ctx = nullptr;
+    }
+  }
+  FdCtx *get() const { return m_ctx; }
+  FdCtx *operator->() const { return m_ctx; }
+  explicit operator bool() const { return m_ctx != nullptr; }
 
+private:
+  FdCtx *m_ctx = nullptr;
+};
+
+class FdManager {
+  friend class FdCtx;
+
+public:
   FdManager();
+  ~FdManager();
 
-  FdCtx::ptr get(int fd, bool auto_create = false);
+  /**
+   * @func:
+   * @param {int} fd
+   * @param {bool} auto_create 不存在或者已经close时创建(复用)
+   * @return {*} pin住的句柄，不加锁；fd已经close或者超出容量时为空
+   * @description: 获取fd的上下文
+   */
+  FdCtxRef get(int fd, bool auto_create = false);
+  // close时调用，标记关闭；还有其他持有者时从表中摘下
   void del(int fd);
 
 private:
-  // 读写锁
-  RWMutexType m_mutex;
+  /**
+   * @func:
+   * @return {*} 槽位为空时返回nullptr
+   * @description: 用hazard指针保护读取槽位和pin之间的窗口，返回时已经pin住并且没有被摘下
+   */
+  FdCtx *acquire(int fd);
+  // 最后一个持有者释放摘下的FdCtx，还有线程正在acquire它时推迟到下一次
+  static void Retire(FdCtx *ctx);
+
+private:
   // 文件句柄合集
-  std::vector<FdCtx::ptr> m_datas;
+  FdTable<FdCtx> m_datas;
 };
 
 // 文件句柄管理单例模式
@@ -13,14 +13,15 @@
 #include "sylar/log.h"
 #include "sylar/marco.h"
 #include "sylar/scheduler.h"
+#include "sylar/stack_allocator.h"
 #include "sylar/thread.h"
 #include "sylar/util.h"
 #include <atomic>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <functional>
-#include <ucontext.h>
 
 namespace sylar {
 
@@ -35,18 +36,48 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
-class MallocStackAllocator {
-public:
-  static void* Alloc(size_t size) {
-    return malloc(size);
+// getValue需要加锁，创建协程时读取缓存的值
+static std::atomic<uint32_t> s_fiber_stack_size = {128 * 1024};
+
+struct _FiberIniter {
+  _FiberIniter() {
+    s_fiber_stack_size = g_fiber_stack_size->getValue();
+    g_fiber_stack_size->addListener(
+        [](const uint32_t &old_value, const uint32_t &new_value) {
+          s_fiber_stack_size = new_value;
+        });
   }
+};
+
+static _FiberIniter s_fiber_init;
+
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024 * 1024,
+                             "fiber shared stack size");
+
+// 每个线程一个共享栈，同一时刻只有occupant的栈内容在上面
+struct SharedStack {
+  char *base = nullptr;
+  std::size_t size = 0;
+  Fiber *occupant = nullptr;
 
-  static void Dealloc(void* vp, size_t size) {
-    return free(vp);
+  ~SharedStack() {
+    if (base) {
+      PooledStackAllocator::UnmapStack(base, size);
+    }
   }
 };
 
-using StackAllocator = MallocStackAllocator;
+static thread_local SharedStack t_shared_stack;
+
+static SharedStack *GetSharedStack() {
+  if (!t_shared_stack.base) {
+    t_shared_stack.size = g_fiber_shared_stack_size->getValue();
+    t_shared_stack.base = (char *)PooledStackAllocator::MapStack(t_shared_stack.size);
+    SYLAR_ASSERT2(t_shared_stack.base, "mmap shared stack");
+  }
+  return &t_shared_stack;
+}
 
 uint64_t Fiber::GetFiberId() {
   if(t_fiber) {
@@ -59,7 +90,7 @@ Fiber::Fiber() {
   m_state = EXEC;
   SetThis(this);
 
-  if(getcontext(&m_ctx)) {
+  if(!InitContext(&m_ctx)) {
     SYLAR_ASSERT2(false, "getcontext");
   }
 
@@ -68,23 +99,26 @@ Fiber::Fiber() {
   SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber main";
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller,
+             bool shared_stack)
     : m_id(++s_fiber_id), m_cb(cb) {
   ++s_fiber_count;
-  m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-
-  m_stack = StackAllocator::Alloc(m_stacksize);
-  if(getcontext(&m_ctx)) {
-    SYLAR_ASSERT2(false, "getcontext");
+#if SYLAR_ASM_CONTEXT
+  // 共享栈要在切换时知道栈顶位置，只在汇编切换下支持
+  if (shared_stack && !use_caller) {
+    // 第一次swapIn时才绑定线程的共享栈并初始化上下文
+    m_useSharedStack = true;
+    SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id << " shared stack";
+    return;
   }
-  m_ctx.uc_link = nullptr;
-  m_ctx.uc_stack.ss_sp = m_stack;
-  m_ctx.uc_stack.ss_size = m_stacksize;
-
-  if(!use_caller) {
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-  } else {
-    makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+#endif
+  m_stacksize = stacksize ? stacksize : s_fiber_stack_size.load();
+
+  m_allocator = StackAllocator::GetDefault();
+  m_stack = m_allocator->alloc(m_stacksize);
+  if(!MakeContext(&m_ctx, m_stack, m_stacksize,
+                  use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc)) {
+    SYLAR_ASSERT2(false, "makecontext");
   }
 
   SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id;
@@ -94,7 +128,14 @@ Fiber::~Fiber() {
   --s_fiber_count;
   if(m_stack) {
     SYLAR_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
-    StackAllocator::Dealloc(m_stack, m_stacksize);
+    m_allocator->dealloc(m_stack, m_stacksize);
+  } else if(m_useSharedStack) {
+    SYLAR_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
+    // 结束时已经离开了共享栈，这里只处理在所属线程上被释放的情况
+    if(m_stackThread == sylar::getThreadId()) {
+      leaveSharedStack();
+    }
+    free(m_saveBuffer);
   } else {
     SYLAR_ASSERT(!m_cb);
     SYLAR_ASSERT(m_state == EXEC);
@@ -111,32 +152,35 @@ Fiber::~Fiber() {
 //重置协程函数，并重置状态
 //INIT，TERM, EXCEPT
 void Fiber::reset(std::function<void()> cb) {
-  SYLAR_ASSERT(m_stack);
+  SYLAR_ASSERT(m_stack || m_useSharedStack);
   SYLAR_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
   m_cb = cb;
-  if(getcontext(&m_ctx)) {
-    SYLAR_ASSERT2(false, "getcontext");
+  if(m_useSharedStack) {
+    // 重新绑定下一次运行所在线程的共享栈
+    leaveSharedStack();
+    m_sharedStack = nullptr;
+    m_stackThread = -1;
+    m_saveSize = 0;
+    m_state = INIT;
+    return;
+  }
+  if(!MakeContext(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc)) {
+    SYLAR_ASSERT2(false, "makecontext");
   }
-
-  m_ctx.uc_link = nullptr;
-  m_ctx.uc_stack.ss_sp = m_stack;
-  m_ctx.uc_stack.ss_size = m_stacksize;
-
-  makecontext(&m_ctx, &Fiber::MainFunc, 0);
   m_state = INIT;
 }
 
 void Fiber::call() {
   SetThis(this);
   m_state = EXEC;
-  if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
+  if(!SwapContext(&t_threadFiber->m_ctx, &m_ctx)) {
     SYLAR_ASSERT2(false, "swapcontext");
   }
 }
 
 void Fiber::back() {
   SetThis(t_threadFiber.get());
-  if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
+  if(!SwapContext(&m_ctx, &t_threadFiber->m_ctx)) {
     SYLAR_ASSERT2(false, "swapcontext");
   }
 }
@@ -145,20 +189,77 @@ void Fiber::back() {
 void Fiber::swapIn() {
   SetThis(this);
   SYLAR_ASSERT(m_state != EXEC);
+  if(m_useSharedStack) {
+    enterSharedStack();
+  }
   m_state = EXEC;
-  if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
+  if(!SwapContext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
     SYLAR_ASSERT2(false, "swapcontext");
   }
+  if(m_useSharedStack && (m_state == TERM || m_state == EXCEPT)) {
+    leaveSharedStack();
+  }
 }
 
 //切换到后台执行
 void Fiber::swapOut() {
   SetThis(Scheduler::GetMainFiber());
-  if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
+  if(!SwapContext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
     SYLAR_ASSERT2(false, "swapcontext");
   }
 }
 
+// 在调度协程的栈上执行，此时共享栈上没有正在运行的协程
+void Fiber::enterSharedStack() {
+#if SYLAR_ASM_CONTEXT
+  if(!m_sharedStack) {
+    m_sharedStack = GetSharedStack();
+    m_stackThread = sylar::getThreadId();
+  }
+  SYLAR_ASSERT2(m_stackThread == sylar::getThreadId(),
+                "shared stack fiber resumed on another thread");
+  SharedStack* stack = m_sharedStack;
+  if(stack->occupant == this) {
+    return;
+  }
+  if(stack->occupant) {
+    stack->occupant->saveStack();
+  }
+  stack->occupant = this;
+
+  if(m_state == INIT) {
+    MakeContext(&m_ctx, stack->base, stack->size, &Fiber::MainFunc);
+  } else {
+    memcpy(stack->base + stack->size - m_saveSize, m_saveBuffer, m_saveSize);
+  }
+#endif
+}
+
+void Fiber::leaveSharedStack() {
+  if(m_sharedStack && m_sharedStack->occupant == this) {
+    m_sharedStack->occupant = nullptr;
+  }
+}
+
+// 只拷贝栈指针到栈顶之间使用的部分
+void Fiber::saveStack() {
+#if SYLAR_ASM_CONTEXT
+  char* top = m_sharedStack->base + m_sharedStack->size;
+  char* sp = (char*)m_ctx.sp;
+  SYLAR_ASSERT(sp >= m_sharedStack->base && sp < top);
+  uint32_t used = top - sp;
+  if(used > m_saveCapacity) {
+    free(m_saveBuffer);
+    // 按512字节取整，避免栈深度小幅变化时反复分配
+    m_saveCapacity = (used + 511) & ~511u;
+    m_saveBuffer = (char*)malloc(m_saveCapacity);
+    SYLAR_ASSERT2(m_saveBuffer, "malloc shared stack buffer");
+  }
+  memcpy(m_saveBuffer, sp, used);
+  m_saveSize = used;
+#endif
+}
+
 //设置当前协程
 void Fiber::SetThis(Fiber* f) {
   t_fiber = f;
@@ -196,6 +297,10 @@ uint64_t Fiber::TotalFibers() {
   return s_fiber_count;
 }
 
+uint32_t Fiber::GetDefaultStackSize() {
+  return s_fiber_stack_size;
+}
+
 void Fiber::MainFunc() {
   Fiber::ptr cur = GetThis();
   SYLAR_ASSERT(cur);
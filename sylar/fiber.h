@@ -15,10 +15,13 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
-#include <ucontext.h>
+#include "context.h"
 
 namespace sylar {
 
+class StackAllocator;
+struct SharedStack;
+
 // 将协程作为调度的主体
 // 每个线程拥有一个主协程负责调度子协程，主协程不进行任何工作，只是创建或销毁子协程，不需要任何栈空间，不能够主动创建
 // 子协程可以由线程主动创建，创建后当前线程获得运行的子协程指针，当子协程运行结束后将子协程返回到主协程处
@@ -58,8 +61,12 @@ public:
      * @param[in] cb 协程执行的函数
      * @param[in] stacksize 协程栈大小
      * @param[in] use_caller 是否在MainFiber上调度
+     * @param[in] shared_stack 是否运行在线程的共享栈上
+     * @attention 共享栈协程切出后栈内容可能被拷走，不能把栈上变量的地址交给其他协程使用；
+     *            第一次运行后只能在同一个线程上恢复，只支持汇编切换且use_caller为false，否则使用独立栈
      */
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false,
+          bool shared_stack = false);
 
     /**
      * @brief 析构函数
@@ -107,6 +114,22 @@ public:
      * @brief 返回协程状态
      */
     State getState() const { return m_state;}
+
+    /**
+     * @brief 返回协程只能在哪个线程上恢复
+     * @return 共享栈协程返回其共享栈所在线程id，否则返回-1
+     */
+    int getStackThread() const { return m_stackThread;}
+
+    /**
+     * @brief 是否运行在共享栈上
+     */
+    bool isSharedStack() const { return m_useSharedStack;}
+
+    /**
+     * @brief 返回独立栈的大小，共享栈协程返回0
+     */
+    uint32_t getStackSize() const { return m_stacksize;}
 public:
 
     /**
@@ -137,6 +160,11 @@ public:
      */
     static uint64_t TotalFibers();
 
+    /**
+     * @brief 返回不指定栈大小时使用的大小，即fiber.stack_size的当前值
+     */
+    static uint32_t GetDefaultStackSize();
+
     /**
      * @brief 协程执行函数
      * @post 执行完成返回到线程主协程
@@ -153,6 +181,21 @@ public:
      * @brief 获取当前协程的id
      */
     static uint64_t GetFiberId();
+private:
+    /**
+     * @brief 切换到共享栈协程前，保存占用共享栈的协程，恢复自己的栈内容
+     */
+    void enterSharedStack();
+
+    /**
+     * @brief 协程结束后不再占用共享栈
+     */
+    void leaveSharedStack();
+
+    /**
+     * @brief 把共享栈上已使用的部分拷贝出来
+     */
+    void saveStack();
 private:
   /// 协程id
   uint64_t m_id = 0;
@@ -161,11 +204,23 @@ private:
   /// 协程状态
   State m_state = INIT;
   /// 协程上下文
-  ucontext_t m_ctx;
+  Context m_ctx;
   /// 协程运行栈指针
   void* m_stack = nullptr;
+  /// 分配协程栈的分配器
+  StackAllocator* m_allocator = nullptr;
   /// 协程运行函数
   std::function<void()> m_cb;
+  /// 是否使用共享栈
+  bool m_useSharedStack = false;
+  /// 运行所在的共享栈
+  SharedStack* m_sharedStack = nullptr;
+  /// 共享栈所在线程id
+  int m_stackThread = -1;
+  /// 切出共享栈时保存的栈内容
+  char* m_saveBuffer = nullptr;
+  uint32_t m_saveSize = 0;
+  uint32_t m_saveCapacity = 0;
 };
 
 }
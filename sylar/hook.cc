@@ -12,6 +12,7 @@
 #include "sylar/config.h"
 #include "sylar/fdmanager.h"
 #include "sylar/fiber.h"
+#include "sylar/io_uring.h"
 #include "sylar/iomanager.h"
 #include "sylar/log.h"
 #include "sylar/mutex.h"
@@ -23,6 +24,7 @@
 #include <cerrno>
 #include <cstdarg>
 #include <cstdint>
+#include <cstring>
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
@@ -103,22 +105,44 @@ void set_hook_enable(bool flag) { t_hook_enable = flag; }
 
 } // namespace sylar
 
-// 条件定时器的条件
-struct timer_info {
-  int cancelled = 0;
-};
+// 阻塞io超时：记录超时并取消fd上的事件，唤醒等待的协程
+// 在定时器的锁内执行，返回之后等待的协程cancel定时器才会返回
+static void OnIoTimeout(sylar::IntrusiveTimer *timer) {
+  sylar::IoTimeout *t = static_cast<sylar::IoTimeout *>(timer);
+  t->cancelled = ETIMEDOUT;
+  t->iom->cancelEvent(t->fd, (sylar::IOManager::Event)t->event);
+}
+
+// 事件加入之后再启动超时，定时器不会在addEvent之前触发
+static sylar::IoTimeout *StartIoTimeout(sylar::IOManager *iom,
+                                        sylar::FdCtx *ctx, int fd,
+                                        uint32_t event, uint64_t timeout_ms) {
+  if (timeout_ms == (uint64_t)-1) {
+    return nullptr;
+  }
+  sylar::IoTimeout &t = event == sylar::IOManager::READ ? ctx->getReadTimer()
+                                                         : ctx->getWriteTimer();
+  t.iom = iom;
+  t.fd = fd;
+  t.event = event;
+  t.cancelled = 0;
+  iom->addIntrusiveTimer(&t, timeout_ms, &OnIoTimeout);
+  return &t;
+}
 
 // io操作的hook
+// uring_op为使用io_uring时等价的操作，不支持时opcode为IORING_OP_NOP
 template <typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name,
-                     uint32_t event, int timeout_so, Args &&...args) {
+                     uint32_t event, int timeout_so,
+                     const sylar::IoUringOp &uring_op, Args &&...args) {
   // 如果没有进行hook，则直接返回
   if (!sylar::t_hook_enable) {
     return fun(fd, std::forward<Args&&>(args)...);
   }
 
-  // 获取相应的fd
-  sylar::FdCtx::ptr ctx = sylar::FdMgr::getInstance()->get(fd);
+  // 获取相应的fd，pin住直到返回，期间被close也不会释放
+  sylar::FdCtxRef ctx = sylar::FdMgr::getInstance()->get(fd);
   if (!ctx) {
     return fun(fd, std::forward<Args&&>(args)...);
   }
@@ -135,7 +159,6 @@ static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name,
 
   // 获得超时时间
   uint64_t to = ctx->getTimeout(timeout_so);
-  std::shared_ptr<timer_info> tinfo(new timer_info);
 
 retry:
   // 执行，因为是非阻塞模式，会立刻返回
@@ -148,46 +171,50 @@ retry:
   // 如果不可行则进行调度 
   if (n == -1 && errno == EAGAIN) {
     sylar::IOManager *iom = sylar::IOManager::GetThis();
-    sylar::Timer::ptr timer;
-    std::weak_ptr<timer_info> winfo(tinfo);
-
-    // 如果设置了超时时间
-    if (to != (uint64_t)-1) {
-      // 设置条件定时器
-      timer = iom->addConditionTimer(to, [winfo, fd, iom, event] {
-        auto t = winfo.lock();
-        // 如果已经执行过了，直接返回
-        if (!t || t->cancelled) {
-          return;
+    // 使用io_uring时直接提交操作，完成后恢复协程，不用先等可读写再重试
+    // 共享栈协程切出后栈会被换走，内核不能直接读写栈上的缓冲区
+    if (iom->isIoUring() && uring_op.opcode != IORING_OP_NOP &&
+        !sylar::Fiber::GetThis()->isSharedStack()) {
+      int rt = iom->submitIo(uring_op, to);
+      // 内核没有等待就返回了EAGAIN，退回epoll等待
+      if (rt != -EAGAIN) {
+        if (rt >= 0) {
+          return rt;
         }
-        // 取消事件
-        t->cancelled = ETIMEDOUT;
-        iom->cancelEvent(fd, (sylar::IOManager::Event)event);
-      }, winfo);
+        // 被close取消
+        if (rt == -ECANCELED && ctx->isClose()) {
+          rt = -EBADF;
+        }
+        errno = -rt;
+        return -1;
+      }
     }
 
     // 加入事件
-    SYLAR_LOG_INFO(sylar::g_logger) << hook_fun_name << " addEvent";
+    SYLAR_LOG_DEBUG(sylar::g_logger) << hook_fun_name << " addEvent";
     int rt = iom->addEvent(fd, (sylar::IOManager::Event)event);
     if (rt) {
       SYLAR_LOG_ERROR(sylar::g_logger)
           << hook_fun_name << " addEvent(" << fd << ", " << event << ")";
-      if(timer) {
-          timer->cancel();
-      }
       return -1;
     } else {
-      SYLAR_LOG_INFO(sylar::g_logger) << hook_fun_name << " hook success";
+      SYLAR_LOG_DEBUG(sylar::g_logger) << hook_fun_name << " hook success";
+      // 超时定时器放在FdCtx中，不需要分配内存
+      sylar::IoTimeout *timer = StartIoTimeout(iom, ctx.get(), fd, event, to);
       // 重中之重 yield出去
       sylar::Fiber::YieldToHold();
-      SYLAR_LOG_INFO(sylar::g_logger) << hook_fun_name << " hook finish success";
+      SYLAR_LOG_DEBUG(sylar::g_logger) << hook_fun_name << " hook finish success";
       // 返回
       if (timer) {
         timer->cancel();
+        if (timer->cancelled) {
+          errno = timer->cancelled;
+          return -1;
+        }
       }
-
-      if (tinfo->cancelled) {
-        errno = tinfo->cancelled;
+      // 被close唤醒，fd号可能已经分配给了新的socket，不能再重试
+      if (ctx->isClose()) {
+        errno = EBADF;
         return -1;
       }
 
@@ -211,8 +238,8 @@ unsigned int sleep(unsigned int seconds) {
 
   sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
   sylar::IOManager *iom = sylar::IOManager::GetThis();
-  iom->addTimer(
-      seconds * 1000,
+  iom->addTimerUS(
+      seconds * 1000000ull,
       std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread)) &
                     sylar::IOManager::schedule,
                 iom, fiber, -1));
@@ -227,8 +254,8 @@ int usleep(useconds_t usec) {
   
   sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
   sylar::IOManager *iom = sylar::IOManager::GetThis();
-  iom->addTimer(
-      usec / 1000,
+  iom->addTimerUS(
+      usec,
       std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread)) &
                     sylar::IOManager::schedule,
                 iom, fiber, -1));
@@ -240,11 +267,12 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
   if (!sylar::t_hook_enable) {
     return nanosleep_f(req, rem);
   }
-  int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 /1000;
+  // 定时器精确到微秒，不足1us的部分向上取整，不会比要求的睡得短
+  uint64_t timeout_us = req->tv_sec * 1000000ull + (req->tv_nsec + 999) / 1000;
   sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
   sylar::IOManager *iom = sylar::IOManager::GetThis();
-  iom->addTimer(
-      timeout_ms / 1000,
+  iom->addTimerUS(
+      timeout_us,
       std::bind((void(sylar::Scheduler::*)(sylar::Fiber::ptr, int thread)) &
                     sylar::IOManager::schedule,
                 iom, fiber, -1));
@@ -271,7 +299,7 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
   if (!sylar::t_hook_enable) {
     return connect_f(sockfd, addr, addrlen);
   }
-  sylar::FdCtx::ptr ctx = sylar::FdMgr::getInstance()->get(sockfd);
+  sylar::FdCtxRef ctx = sylar::FdMgr::getInstance()->get(sockfd);
   if (!ctx || ctx->isClose()) {
     errno = EBADF;
     return -1;
@@ -281,6 +309,19 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
     return connect_f(sockfd, addr, addrlen);
   }
 
+  sylar::IOManager *iom = sylar::IOManager::GetThis();
+  // 使用io_uring时直接提交connect，不能先调用connect_f，否则再次connect会返回EALREADY
+  if (iom->isIoUring() && !ctx->getUserNonblock() &&
+      !sylar::Fiber::GetThis()->isSharedStack()) {
+    int rt = iom->submitIo(sylar::IoUringOp::Connect(sockfd, addr, addrlen),
+                           timeout_ms);
+    if (rt == 0) {
+      return 0;
+    }
+    errno = -rt;
+    return -1;
+  }
+
   int n = connect_f(sockfd, addr, addrlen);
   if (n == 0) {
     return 0;
@@ -288,37 +329,24 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
     return n;
   }
 
-  sylar::IOManager *iom = sylar::IOManager::GetThis();
-  sylar::Timer::ptr timer;
-  std::shared_ptr<timer_info> tinfo(new timer_info);
-  std::weak_ptr<timer_info> winfo(tinfo);
-
-  if (timeout_ms != (uint64_t)-1) {
-    timer = iom->addConditionTimer(timeout_ms, [winfo, sockfd, iom] {
-      auto t = winfo.lock();
-      if (!t || t->cancelled) {
-        return;
-      }
-      iom->cancelEvent(sockfd, sylar::IOManager::WRITE);
-      t->cancelled = ETIMEDOUT;
-    }, winfo);
-  }
-
   int rt = iom->addEvent(sockfd, sylar::IOManager::WRITE);
   if (rt == 0) {
     SYLAR_LOG_ERROR(sylar::g_logger) << "connect trigger";
+    sylar::IoTimeout *timer = StartIoTimeout(
+        iom, ctx.get(), sockfd, sylar::IOManager::WRITE, timeout_ms);
     sylar::Fiber::YieldToHold();
     if (timer) {
       timer->cancel();
+      if (timer->cancelled) {
+        errno = timer->cancelled;
+        return -1;
+      }
     }
-    if (tinfo->cancelled) {
-      errno = tinfo->cancelled;
+    if (ctx->isClose()) {
+      errno = EBADF;
       return -1;
     }
   } else {
-    if (timer) {
-      timer->cancel();
-    }
     SYLAR_LOG_ERROR(sylar::g_logger)
         << "connect addEvent(" << sockfd << ", WRITE) ERROR";
   }
@@ -344,9 +372,9 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
-  SYLAR_LOG_INFO(sylar::g_logger) << "start to do io accept";
+  SYLAR_LOG_DEBUG(sylar::g_logger) << "start to do io accept";
   int fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO,
-                 addr, addrlen);
+                 sylar::IoUringOp::Accept(s, addr, addrlen), addr, addrlen);
   if (fd >= 0) {
     sylar::FdMgr::getInstance()->get(fd, true);
   }
@@ -356,57 +384,67 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
-  return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf,
-               count);
+  // do_io只对套接字生效，套接字上read等价于recv
+  return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO,
+               sylar::IoUringOp::Recv(fd, buf, count, 0), buf, count);
   
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-  return do_io(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO, iov,
-               iovcnt);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
+  return do_io(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO,
+               sylar::IoUringOp::RecvMsg(fd, &msg, 0), iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-  SYLAR_LOG_INFO(sylar::g_logger) << "begin to recv hook";
-  return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf,
-               len, flags);
+  SYLAR_LOG_DEBUG(sylar::g_logger) << "begin to recv hook";
+  return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO,
+               sylar::IoUringOp::Recv(sockfd, buf, len, flags), buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                  struct sockaddr *src_addr, socklen_t *addrlen) {
   return do_io(sockfd, recvfrom_f, "recvfrom", sylar::IOManager::READ,
-               SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+               SO_RCVTIMEO, sylar::IoUringOp(), buf, len, flags, src_addr,
+               addrlen);
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-  return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg,
-               flags);
+  return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO,
+               sylar::IoUringOp::RecvMsg(sockfd, msg, flags), msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
-  return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf,
-               count);
+  return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO,
+               sylar::IoUringOp::Send(fd, buf, count, 0), buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
   return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO,
-               iov, iovcnt);
+               sylar::IoUringOp::SendMsg(fd, &msg, 0), iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
-  return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len,
-               flags);
+  return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO,
+               sylar::IoUringOp::Send(s, msg, len, flags), msg, len, flags);
 } 
 
 ssize_t sendto(int s, const void *msg, size_t len, int flags,
                const struct sockaddr *to, socklen_t tolen) {
-  return do_io(s, sendto_f, "sendto", sylar::IOManager::WRITE, SO_SNDTIMEO, msg,
-               len, flags, to, tolen);
+  return do_io(s, sendto_f, "sendto", sylar::IOManager::WRITE, SO_SNDTIMEO,
+               sylar::IoUringOp(), msg, len, flags, to, tolen);
 }
 
 ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
   return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO,
-               msg, flags);
+               sylar::IoUringOp::SendMsg(s, msg, flags), msg, flags);
 }
 
 // 还要取消fd
@@ -415,13 +453,15 @@ int close(int fd) {
       return close_f(fd);
   }
 
-  sylar::FdCtx::ptr ctx = sylar::FdMgr::getInstance()->get(fd);
-  if(ctx) {
+  // 不持有句柄调用del，否则自己也算一个持有者，每次close都要从表中摘下
+  if(sylar::FdMgr::getInstance()->get(fd)) {
+      // 先标记关闭再唤醒等待的协程，否则在别的线程上被唤醒的协程
+      // 看到未关闭会重试并重新挂到这个fd上，之后再也等不到事件
+      sylar::FdMgr::getInstance()->del(fd);
       auto iom = sylar::IOManager::GetThis();
       if(iom) {
           iom->cancelAll(fd);
       }
-      sylar::FdMgr::getInstance()->del(fd);
   }
   return close_f(fd);
 }
@@ -435,7 +475,7 @@ int fcntl(int fd, int cmd, ... /* arg */) {
   case F_SETFL: {
     int arg = va_arg(va, int);
     va_end(va);
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::getInstance()->get(fd);
+    sylar::FdCtxRef ctx = sylar::FdMgr::getInstance()->get(fd);
     if (!ctx || ctx->isClose() || !ctx->isSocket()) {
       return fcntl_f(fd, cmd, arg);
     }
@@ -451,7 +491,7 @@ int fcntl(int fd, int cmd, ... /* arg */) {
   case F_GETFL: {
     va_end(va);
     int arg = fcntl_f(fd, cmd);
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::getInstance()->get(fd);
+    sylar::FdCtxRef ctx = sylar::FdMgr::getInstance()->get(fd);
     if (!ctx || ctx->isClose() || !ctx->isSocket()) {
       return arg;
     }
@@ -522,7 +562,7 @@ int ioctl(int d, unsigned long int request, ...) {
 
   if (FIONBIO == request) {
     bool user_noblock = !!*(int *)arg;
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::getInstance()->get(d);
+    sylar::FdCtxRef ctx = sylar::FdMgr::getInstance()->get(d);
     if (!ctx || ctx->isClose() || !ctx->isSocket()) {
       return ioctl_f(d, request, arg);
     }
@@ -545,7 +585,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval,
   }
   if (level == SOL_SOCKET) {
     if (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-      sylar::FdCtx::ptr ctx = sylar::FdMgr::getInstance()->get(sockfd);
+      sylar::FdCtxRef ctx = sylar::FdMgr::getInstance()->get(sockfd);
       if (ctx) {
         const timeval *v = (const timeval *)optval;
         ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
@@ -37,7 +37,7 @@ std::string HttpResult::toString() const {
 }
 
 HttpConnection::HttpConnection(Socket::ptr sock, bool owner)
-    : SocketStream(sock, owner) {}
+    : SocketStream(sock, owner), m_createTime(sylar::GetCoarseMonotonicMS()) {}
 
 HttpResponse::ptr HttpConnection::recvResponse() {
   HttpResponseParser::ptr parser(new HttpResponseParser);
@@ -321,7 +321,7 @@ HttpConnectionPool::HttpConnectionPool(const std::string &host,
       m_maxAliveTime(max_alive_time), m_maxRequest(max_request) {}
 
 HttpConnection::ptr HttpConnectionPool::getConnection() {
-  uint64_t now_ms = sylar::GetCurrentMS();
+  uint64_t now_ms = sylar::GetCoarseMonotonicMS();
   std::vector<HttpConnection*> invalid_conns;
   HttpConnection* ptr = nullptr;
   MutexType::Lock lock(m_mutex);
@@ -333,7 +333,7 @@ HttpConnection::ptr HttpConnectionPool::getConnection() {
       continue;
     }
     
-    if((conn->m_createTime + m_maxAliveTime) > now_ms) {
+    if((conn->m_createTime + m_maxAliveTime) <= now_ms) {
       invalid_conns.push_back(conn);
       continue;
     }
@@ -499,7 +499,7 @@ void HttpConnectionPool::ReleasePtr(HttpConnection *ptr,
                                     HttpConnectionPool *pool) {
   ++ptr->m_request;
   if (!ptr->isConnected()
-      || ((ptr->m_createTime + pool->m_maxAliveTime) >= sylar::GetCurrentMS())
+      || ((ptr->m_createTime + pool->m_maxAliveTime) <= sylar::GetCoarseMonotonicMS())
       || (ptr->m_request >= pool->m_maxRequest)) {
     delete ptr;
     --pool->m_total;
@@ -96,6 +96,7 @@ public:
   int sendRequest(HttpRequest::ptr req);
 
 private:
+  // 创建时间，粗粒度单调时钟
   uint64_t m_createTime = 0;
   uint64_t m_request = 0;
 };
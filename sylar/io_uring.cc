@@ -0,0 +1,351 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-17 15:20:31
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-17 15:20:31
+ * @FilePath     : /sylar/io_uring.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-17 15:20:31
+ */
+#include "io_uring.h"
+#include "sylar/log.h"
+#include "sylar/marco.h"
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 nullptr, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg,
+                                 unsigned nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IoUringOp IoUringOp::Recv(int fd, void *buf, std::size_t len, int flags) {
+  IoUringOp op;
+  op.opcode = IORING_OP_RECV;
+  op.fd = fd;
+  op.addr = (uint64_t)buf;
+  op.len = len;
+  op.opFlags = flags;
+  return op;
+}
+
+IoUringOp IoUringOp::Send(int fd, const void *buf, std::size_t len,
+                          int flags) {
+  IoUringOp op;
+  op.opcode = IORING_OP_SEND;
+  op.fd = fd;
+  op.addr = (uint64_t)buf;
+  op.len = len;
+  op.opFlags = flags;
+  return op;
+}
+
+IoUringOp IoUringOp::RecvMsg(int fd, struct msghdr *msg, int flags) {
+  IoUringOp op;
+  op.opcode = IORING_OP_RECVMSG;
+  op.fd = fd;
+  op.addr = (uint64_t)msg;
+  op.len = 1;
+  op.opFlags = flags;
+  return op;
+}
+
+IoUringOp IoUringOp::SendMsg(int fd, const struct msghdr *msg, int flags) {
+  IoUringOp op;
+  op.opcode = IORING_OP_SENDMSG;
+  op.fd = fd;
+  op.addr = (uint64_t)msg;
+  op.len = 1;
+  op.opFlags = flags;
+  return op;
+}
+
+IoUringOp IoUringOp::Accept(int fd, struct sockaddr *addr,
+                            socklen_t *addrlen) {
+  IoUringOp op;
+  op.opcode = IORING_OP_ACCEPT;
+  op.fd = fd;
+  op.addr = (uint64_t)addr;
+  op.off = (uint64_t)addrlen;
+  return op;
+}
+
+IoUringOp IoUringOp::Connect(int fd, const struct sockaddr *addr,
+                             socklen_t addrlen) {
+  IoUringOp op;
+  op.opcode = IORING_OP_CONNECT;
+  op.fd = fd;
+  op.addr = (uint64_t)addr;
+  op.off = addrlen;
+  return op;
+}
+
+IoUring::IoUring() {}
+
+IoUring::~IoUring() {
+  if (m_sqes) {
+    munmap(m_sqes, m_sqEntries * sizeof(struct io_uring_sqe));
+  }
+  if (m_cqRing && m_cqRing != m_sqRing) {
+    munmap(m_cqRing, m_cqRingSize);
+  }
+  if (m_sqRing) {
+    munmap(m_sqRing, m_sqRingSize);
+  }
+  if (m_ringFd >= 0) {
+    close(m_ringFd);
+  }
+  if (m_eventfd >= 0) {
+    close(m_eventfd);
+  }
+}
+
+bool IoUring::init(unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CLAMP;
+  m_ringFd = sys_io_uring_setup(entries, &p);
+  if (m_ringFd < 0) {
+    SYLAR_LOG_ERROR(g_logger) << "io_uring_setup(" << entries << ") errno="
+                              << errno << " " << strerror(errno);
+    return false;
+  }
+  // cq满时不丢弃完成事件
+  if (!(p.features & IORING_FEAT_NODROP)) {
+    SYLAR_LOG_ERROR(g_logger) << "io_uring without IORING_FEAT_NODROP";
+    return false;
+  }
+
+  m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && m_cqRingSize > m_sqRingSize) {
+    m_sqRingSize = m_cqRingSize;
+  }
+
+  m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+  if (m_sqRing == MAP_FAILED) {
+    m_sqRing = nullptr;
+    SYLAR_LOG_ERROR(g_logger) << "io_uring mmap sq ring errno=" << errno;
+    return false;
+  }
+  if (single_mmap) {
+    m_cqRing = m_sqRing;
+  } else {
+    m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+    if (m_cqRing == MAP_FAILED) {
+      m_cqRing = nullptr;
+      SYLAR_LOG_ERROR(g_logger) << "io_uring mmap cq ring errno=" << errno;
+      return false;
+    }
+  }
+
+  void *sqes = mmap(nullptr, p.sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_ringFd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    SYLAR_LOG_ERROR(g_logger) << "io_uring mmap sqes errno=" << errno;
+    return false;
+  }
+  m_sqes = (struct io_uring_sqe *)sqes;
+
+  char *sq = (char *)m_sqRing;
+  m_sqHead = (unsigned *)(sq + p.sq_off.head);
+  m_sqTail = (unsigned *)(sq + p.sq_off.tail);
+  m_sqFlags = (unsigned *)(sq + p.sq_off.flags);
+  m_sqArray = (unsigned *)(sq + p.sq_off.array);
+  m_sqMask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  m_sqEntries = p.sq_entries;
+  m_sqLocalTail = *m_sqTail;
+
+  char *cq = (char *)m_cqRing;
+  m_cqHead = (unsigned *)(cq + p.cq_off.head);
+  m_cqTail = (unsigned *)(cq + p.cq_off.tail);
+  m_cqMask = *(unsigned *)(cq + p.cq_off.ring_mask);
+  m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  if (!probeOps()) {
+    return false;
+  }
+  m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_eventfd < 0) {
+    return false;
+  }
+  // 在注册eventfd之前试，试用的cqe不会唤醒收割线程
+  if (!probeCancelFd()) {
+    return false;
+  }
+  if (sys_io_uring_register(m_ringFd, IORING_REGISTER_EVENTFD, &m_eventfd,
+                            1)) {
+    SYLAR_LOG_ERROR(g_logger) << "io_uring register eventfd errno=" << errno;
+    return false;
+  }
+  return true;
+}
+
+bool IoUring::probeOps() {
+  std::vector<char> buf(sizeof(struct io_uring_probe) +
+                        IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+  struct io_uring_probe *probe = (struct io_uring_probe *)&buf[0];
+  // 5.6之前没有IORING_REGISTER_PROBE，这些内核也缺少下面的大部分操作
+  if (sys_io_uring_register(m_ringFd, IORING_REGISTER_PROBE, probe,
+                            IORING_OP_LAST)) {
+    SYLAR_LOG_ERROR(g_logger) << "io_uring register probe errno=" << errno
+                              << " " << strerror(errno);
+    return false;
+  }
+  static const uint8_t s_ops[] = {
+      IORING_OP_RECV,    IORING_OP_SEND,         IORING_OP_RECVMSG,
+      IORING_OP_SENDMSG, IORING_OP_ACCEPT,       IORING_OP_CONNECT,
+      IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL};
+  for (uint8_t op : s_ops) {
+    if (op > probe->last_op ||
+        !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      SYLAR_LOG_ERROR(g_logger) << "io_uring opcode " << (int)op
+                                << " not supported";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool IoUring::probeCancelFd() {
+  {
+    MutexType::Lock lock(m_sqMutex);
+    struct io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = m_eventfd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = 0;
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+  }
+  int rt;
+  do {
+    rt = sys_io_uring_enter(m_ringFd, 1, 1, IORING_ENTER_GETEVENTS);
+  } while (rt < 0 && errno == EINTR);
+  if (rt < 0) {
+    SYLAR_LOG_ERROR(g_logger) << "io_uring_enter errno=" << errno << " "
+                              << strerror(errno);
+    return false;
+  }
+  int res = -ENOENT;
+  std::size_t count = reap([&res](uint64_t, int r) { res = r; });
+  // 不认识cancel_flags的内核返回-EINVAL；支持时返回取消的个数，这里是0
+  if (!count || res < 0) {
+    SYLAR_LOG_ERROR(g_logger) << "io_uring without IORING_ASYNC_CANCEL_FD res="
+                              << res;
+    return false;
+  }
+  return true;
+}
+
+int IoUring::enter(unsigned to_submit, unsigned flags) {
+  while (true) {
+    int rt = sys_io_uring_enter(m_ringFd, to_submit, 0, flags);
+    if (rt >= 0) {
+      return rt;
+    }
+    // 资源暂时不足时sqe还在sq里，重试直到内核取走，否则使用者会以为没有提交
+    if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+      sched_yield();
+      continue;
+    }
+    return -errno;
+  }
+}
+
+void IoUring::waitSqSpace(MutexType::Lock &lock, unsigned count) {
+  while (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) + count >
+         m_sqEntries) {
+    lock.unlock();
+    enter(m_sqEntries, 0);
+    lock.lock();
+  }
+}
+
+struct io_uring_sqe *IoUring::nextSqe() {
+  unsigned index = m_sqLocalTail & m_sqMask;
+  struct io_uring_sqe *sqe = &m_sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  m_sqArray[index] = index;
+  ++m_sqLocalTail;
+  return sqe;
+}
+
+int IoUring::publish(MutexType::Lock &lock) {
+  __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+  lock.unlock();
+  // 提交sq中所有已发布的sqe：只提交自己的个数可能从别的线程的链接中间截断，
+  // 其他线程的enter也可能已经把这几个sqe一起提交了，这里提交0个也没有关系
+  // sqe已经在sq里，失败时也不能让调用者释放操作使用的内存，下一次enter会再提交
+  int rt = enter(m_sqEntries, 0);
+  if (rt < 0) {
+    SYLAR_LOG_ERROR(g_logger) << "io_uring_enter " << rt
+                              << " " << strerror(-rt);
+  }
+  return 0;
+}
+
+int IoUring::submit(const IoUringOp &op, uint64_t data,
+                    const struct __kernel_timespec *timeout,
+                    uint64_t timeout_data) {
+  unsigned count = timeout ? 2 : 1;
+  MutexType::Lock lock(m_sqMutex);
+  waitSqSpace(lock, count);
+
+  struct io_uring_sqe *sqe = nextSqe();
+  sqe->opcode = op.opcode;
+  sqe->fd = op.fd;
+  sqe->addr = op.addr;
+  sqe->len = op.len;
+  sqe->off = op.off;
+  sqe->rw_flags = op.opFlags;
+  sqe->user_data = data;
+
+  // 链接的超时必须紧跟在操作后面，在同一次加锁中填写
+  if (timeout) {
+    sqe->flags |= IOSQE_IO_LINK;
+    struct io_uring_sqe *tsqe = nextSqe();
+    tsqe->opcode = IORING_OP_LINK_TIMEOUT;
+    tsqe->fd = -1;
+    tsqe->addr = (uint64_t)timeout;
+    tsqe->len = 1;
+    tsqe->user_data = timeout_data;
+  }
+  return publish(lock);
+}
+
+int IoUring::cancelFd(int fd) {
+  MutexType::Lock lock(m_sqMutex);
+  waitSqSpace(lock, 1);
+  struct io_uring_sqe *sqe = nextSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = 0;
+  return publish(lock);
+}
+
+} // namespace sylar
@@ -0,0 +1,151 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-17 15:20:08
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-17 15:20:08
+ * @FilePath     : /sylar/io_uring.h
+ * @Description  : io_uring的简单封装，直接使用系统调用，不依赖liburing
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-17 15:20:08
+ */
+#ifndef __SYLAR_IO_URING_H__
+#define __SYLAR_IO_URING_H__
+
+#include "sylar/mutex.h"
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/socket.h>
+
+namespace sylar {
+
+// 一次完成式的io操作，对应一个sqe
+// opcode为IORING_OP_NOP表示该操作不支持io_uring
+struct IoUringOp {
+  uint8_t opcode = IORING_OP_NOP;
+  int fd = -1;
+  uint64_t addr = 0;
+  uint32_t len = 0;
+  // off/addr2
+  uint64_t off = 0;
+  // msg_flags/accept_flags等
+  uint32_t opFlags = 0;
+
+  static IoUringOp Recv(int fd, void *buf, std::size_t len, int flags);
+  static IoUringOp Send(int fd, const void *buf, std::size_t len, int flags);
+  static IoUringOp RecvMsg(int fd, struct msghdr *msg, int flags);
+  static IoUringOp SendMsg(int fd, const struct msghdr *msg, int flags);
+  static IoUringOp Accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+  static IoUringOp Connect(int fd, const struct sockaddr *addr,
+                           socklen_t addrlen);
+};
+
+// 多个线程可以同时提交，sq由锁保护；完成通过注册的eventfd通知，由一个线程收割
+class IoUring {
+public:
+  typedef Spinlock MutexType;
+
+  IoUring();
+  ~IoUring();
+
+  /**
+   * @func:
+   * @param {unsigned} entries sq大小
+   * @return {*} 内核不支持或者创建失败时返回false
+   * @description: 创建ring，检查内核支持用到的操作，并注册eventfd用于完成通知
+   */
+  bool init(unsigned entries);
+
+  int getEventFd() const { return m_eventfd; }
+
+  /**
+   * @func:
+   * @return {*} 返回0，提交后一定会有对应的cqe
+   * @description: 提交op，完成时cqe的user_data为data；
+   * timeout不为空时链接一个超时，超时的cqe的user_data为timeout_data
+   * timeout指向的内容要保持到操作完成
+   */
+  int submit(const IoUringOp &op, uint64_t data,
+             const struct __kernel_timespec *timeout = nullptr,
+             uint64_t timeout_data = 0);
+
+  /**
+   * @func:
+   * @return {*}
+   * @description: 取消fd上所有未完成的操作，取消操作本身的cqe的user_data为0
+   */
+  int cancelFd(int fd);
+
+  /**
+   * @func:
+   * @return {*} 收割的数量
+   * @description: 取出所有完成的cqe，对每个调用fn(user_data, res)
+   */
+  template <class Fn> std::size_t reap(Fn fn) {
+    MutexType::Lock lock(m_cqMutex);
+    std::size_t count = 0;
+    while (true) {
+      unsigned head = *m_cqHead;
+      unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+      while (head != tail) {
+        struct io_uring_cqe *cqe = &m_cqes[head & m_cqMask];
+        fn(cqe->user_data, cqe->res);
+        ++head;
+        ++count;
+      }
+      __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+      // cq满时内核暂存的cqe要主动刷回cq
+      if (!(__atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) &
+            IORING_SQ_CQ_OVERFLOW)) {
+        break;
+      }
+      enter(0, IORING_ENTER_GETEVENTS);
+    }
+    return count;
+  }
+
+private:
+  // 等待sq中有count个空闲位置，sq满时先解锁让内核取走已提交的sqe
+  void waitSqSpace(MutexType::Lock &lock, unsigned count);
+  // 填写下一个sqe，需要持有m_sqMutex
+  struct io_uring_sqe *nextSqe();
+  // 把本地tail发布给内核并通知内核处理，会释放锁
+  int publish(MutexType::Lock &lock);
+  int enter(unsigned to_submit, unsigned flags);
+  // 检查用到的操作内核是否都支持
+  bool probeOps();
+  // 按fd取消全部操作(IORING_ASYNC_CANCEL_FD|ALL)需要5.19，提交一次试试
+  bool probeCancelFd();
+
+private:
+  int m_ringFd = -1;
+  int m_eventfd = -1;
+
+  void *m_sqRing = nullptr;
+  std::size_t m_sqRingSize = 0;
+  void *m_cqRing = nullptr;
+  std::size_t m_cqRingSize = 0;
+
+  unsigned *m_sqHead = nullptr;
+  unsigned *m_sqTail = nullptr;
+  unsigned *m_sqFlags = nullptr;
+  unsigned *m_sqArray = nullptr;
+  unsigned m_sqMask = 0;
+  unsigned m_sqEntries = 0;
+  // 本地的tail，填写完成后再发布给内核
+  unsigned m_sqLocalTail = 0;
+  struct io_uring_sqe *m_sqes = nullptr;
+
+  unsigned *m_cqHead = nullptr;
+  unsigned *m_cqTail = nullptr;
+  unsigned m_cqMask = 0;
+  struct io_uring_cqe *m_cqes = nullptr;
+
+  MutexType m_sqMutex;
+  MutexType m_cqMutex;
+};
+
+} // namespace sylar
+
+#endif
@@ -9,17 +9,25 @@
  * 2024-04-01 16:42:01
  */
 #include "iomanager.h"
+#include "sylar/config.h"
 #include "sylar/fiber.h"
+#include "sylar/hook.h"
 #include "sylar/log.h"
 #include "sylar/marco.h"
 #include "sylar/scheduler.h"
 #include "sylar/util.h"
+#include <algorithm>
 #include <cerrno>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <vector>
@@ -27,6 +35,63 @@
 namespace sylar {
 static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static ConfigVar<bool>::ptr g_iomanager_epoll_per_thread =
+    Config::Lookup<bool>("iomanager.epoll_per_thread", false,
+                         "iomanager each worker thread owns an epoll");
+
+static ConfigVar<bool>::ptr g_iomanager_epoll_persistent =
+    Config::Lookup<bool>("iomanager.epoll_persistent", false,
+                         "iomanager keeps fds registered in epoll until close");
+
+static ConfigVar<bool>::ptr g_iomanager_thread_timers =
+    Config::Lookup<bool>("iomanager.thread_timers", false,
+                         "iomanager each worker thread owns its timers");
+
+static ConfigVar<uint32_t>::ptr g_iomanager_epoll_batch =
+    Config::Lookup<uint32_t>("iomanager.epoll_batch", 64,
+                             "iomanager initial epoll_wait batch size");
+
+static ConfigVar<uint32_t>::ptr g_iomanager_epoll_batch_max =
+    Config::Lookup<uint32_t>("iomanager.epoll_batch_max", 1024,
+                             "iomanager max epoll_wait batch size");
+
+static ConfigVar<uint32_t>::ptr g_iomanager_busy_poll_us =
+    Config::Lookup<uint32_t>("iomanager.busy_poll_us", 0,
+                             "iomanager spin on epoll_wait before sleeping, 0 disables");
+
+static ConfigVar<uint32_t>::ptr g_iomanager_timer_slack_ns =
+    Config::Lookup<uint32_t>("iomanager.timer_slack_ns", 0,
+                             "iomanager worker thread timer slack, 0 keeps kernel default");
+
+static ConfigVar<bool>::ptr g_iomanager_io_uring =
+    Config::Lookup<bool>("iomanager.io_uring", false,
+                         "iomanager complete hooked socket io with io_uring");
+
+static ConfigVar<uint32_t>::ptr g_iomanager_io_uring_entries =
+    Config::Lookup<uint32_t>("iomanager.io_uring.entries", 256,
+                             "iomanager io_uring submission queue size");
+
+// 内核不支持epoll_pwait2(5.11之前)时退回毫秒精度的epoll_wait
+static std::atomic<bool> s_epoll_pwait2 = {true};
+
+// 等待timeout_us微秒，不是整毫秒时用epoll_pwait2，否则亚毫秒的定时器会被取整成1ms
+static int EpollWaitUS(int epfd, epoll_event *events, int maxevents,
+                       uint64_t timeout_us) {
+#ifdef __NR_epoll_pwait2
+  if (timeout_us % 1000 != 0 && s_epoll_pwait2.load(std::memory_order_relaxed)) {
+    struct timespec ts;
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+    int rt = syscall(__NR_epoll_pwait2, epfd, events, maxevents, &ts, nullptr, 0);
+    if (rt >= 0 || errno != ENOSYS) {
+      return rt;
+    }
+    s_epoll_pwait2 = false;
+  }
+#endif
+  return epoll_wait(epfd, events, maxevents, (int)((timeout_us + 999) / 1000));
+}
+
 /**
  * @func: 
  * @return {*}
@@ -34,7 +99,7 @@ static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
  */
 IOManager::FdContext::EventContext &
 IOManager::FdContext::getContext(Event event) {
-  SYLAR_LOG_INFO(g_logger) << "IOManager::FdContext::getContext";
+  SYLAR_LOG_DEBUG(g_logger) << "IOManager::FdContext::getContext";
   switch (event) {
   case IOManager::READ:
     return read;
@@ -53,7 +118,7 @@ IOManager::FdContext::getContext(Event event) {
  * @description: 重置事件上下文
  */
 void IOManager::FdContext::resetContext(EventContext &ctx) {
-  SYLAR_LOG_INFO(g_logger) << "IOManager::FdContext::resetContext";
+  SYLAR_LOG_DEBUG(g_logger) << "IOManager::FdContext::resetContext";
   ctx.scheduler = nullptr;
   ctx.fiber.reset();
   ctx.cb = nullptr;
@@ -65,19 +130,32 @@ void IOManager::FdContext::resetContext(EventContext &ctx) {
  * @return {*}
  * @description: 将读写事件的cb或fiber放入全局任务队列中
  */
-void IOManager::FdContext::triggerEvent(Event event) {
+void IOManager::FdContext::triggerEvent(Event event,
+                                       Scheduler::TaskBatch *batch,
+                                       int thread) {
   SYLAR_ASSERT(events & event);
   events = (Event)(events & ~event);
 
   // 获得相应事件的上下文
   EventContext &ctx = getContext(event);
+  if (batch && batch->getScheduler() != ctx.scheduler) {
+    batch = nullptr;
+  }
   // 将事件的回调函数放入全局任务队列中
   if (ctx.cb) {
-    SYLAR_LOG_INFO(g_logger) << "IOManager::FdContext::triggerEvent cb";
-    ctx.scheduler->schedule(&ctx.cb);
+    SYLAR_LOG_DEBUG(g_logger) << "IOManager::FdContext::triggerEvent cb";
+    if (batch) {
+      batch->add(&ctx.cb, thread);
+    } else {
+      ctx.scheduler->schedule(&ctx.cb);
+    }
   } else {
-    SYLAR_LOG_INFO(g_logger) << "IOManager::FdContext::triggerEvent fiber = " << ctx.fiber->getId();
-    ctx.scheduler->schedule(&ctx.fiber);
+    SYLAR_LOG_DEBUG(g_logger) << "IOManager::FdContext::triggerEvent fiber = " << ctx.fiber->getId();
+    if (batch) {
+      batch->add(&ctx.fiber, thread);
+    } else {
+      ctx.scheduler->schedule(&ctx.fiber);
+    }
   }
   ctx.scheduler = nullptr;
   return;
@@ -87,34 +165,80 @@ void IOManager::FdContext::triggerEvent(Event event) {
  * @func:
  * @return {*}
  * @description:
-构造函数，初始化epoll；同时使用pipe沟通epoll和io调度器，将tickfd加入到epoll中；
+构造函数，初始化epoll；leader通过注册在epoll中的eventfd唤醒，每个工作线程另有自己的eventfd用于follower睡眠；
+使用io_uring时ring的eventfd也注册在epoll中，由leader收割完成的操作；
 并将fdContext队列初始化，开始运行
  */
 IOManager::IOManager(std::size_t threads, bool use_caller,
-                     const std::string &name)
+                     const std::string &name, Backend backend)
     : Scheduler(threads, use_caller, name) {
   SYLAR_LOG_INFO(g_logger) << "IOManager::IOManager";
   m_epfd = epoll_create(5000);
   SYLAR_ASSERT(m_epfd > 0);
 
-  int rt = pipe(m_ticklefds);
-  SYLAR_ASSERT(!rt);
+  m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  SYLAR_ASSERT(m_tickleFd >= 0);
 
   epoll_event event;
   memset(&event, 0, sizeof(epoll_event));
   event.events = EPOLLIN | EPOLLET;
-  event.data.fd = m_ticklefds[0];
+  event.data.fd = m_tickleFd;
 
-  // 不要写成F_SETFD
-  // 将pipe文件设置为NONBLOCK，防止在while循环中阻塞
-  rt = fcntl(m_ticklefds[0], F_SETFL, O_NONBLOCK);
+  // 将eventfd加入epoll中，方便唤醒
+  int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFd, &event);
   SYLAR_ASSERT(!rt);
 
-  // 将pipe加入epoll中，方便唤醒
-  rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_ticklefds[0], &event);
-  SYLAR_ASSERT(!rt);
+  if (backend == IO_URING ||
+      (backend == DEFAULT && g_iomanager_io_uring->getValue())) {
+    IoUring *uring = new IoUring;
+    if (uring->init(g_iomanager_io_uring_entries->getValue())) {
+      memset(&event, 0, sizeof(epoll_event));
+      event.events = EPOLLIN | EPOLLET;
+      event.data.fd = uring->getEventFd();
+      rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, uring->getEventFd(), &event);
+      SYLAR_ASSERT(!rt);
+      m_uring = uring;
+    } else {
+      SYLAR_LOG_WARN(g_logger) << "IOManager " << name
+                               << " io_uring unavailable, fall back to epoll";
+      delete uring;
+    }
+  }
+
+  m_epollPerThread = g_iomanager_epoll_per_thread->getValue();
+  m_epollPersistent = g_iomanager_epoll_persistent->getValue();
+  m_threadTimers = g_iomanager_thread_timers->getValue();
+  m_epollBatch = std::max<uint32_t>(g_iomanager_epoll_batch->getValue(), 1);
+  m_epollBatchMax =
+      std::max<uint32_t>(g_iomanager_epoll_batch_max->getValue(), m_epollBatch);
+  m_busyPollUs = g_iomanager_busy_poll_us->getValue();
+  m_timerSlackNs = g_iomanager_timer_slack_ns->getValue();
+  // 完成事件只通知共享的epoll
+  if (m_uring && m_epollPerThread) {
+    SYLAR_LOG_WARN(g_logger) << "IOManager " << name
+                             << " io_uring ignores iomanager.epoll_per_thread";
+    m_epollPerThread = false;
+  }
+  m_idleWorkers.resize(getWorkerCount());
+  for (std::size_t i = 0; i < m_idleWorkers.size(); ++i) {
+    IdleWorker *worker = new IdleWorker;
+    worker->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    SYLAR_ASSERT(worker->eventfd >= 0);
+    if (m_epollPerThread) {
+      worker->epfd = epoll_create(5000);
+      SYLAR_ASSERT(worker->epfd > 0);
+      memset(&event, 0, sizeof(epoll_event));
+      event.events = EPOLLIN | EPOLLET;
+      event.data.fd = worker->eventfd;
+      rt = epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->eventfd, &event);
+      SYLAR_ASSERT(!rt);
+    }
+    if (m_threadTimers) {
+      worker->timers = new WorkerTimers(this, i);
+    }
+    m_idleWorkers[i] = worker;
+  }
 
-  contextResize(64);
   start();
 }
 
@@ -126,30 +250,40 @@ IOManager::IOManager(std::size_t threads, bool use_caller,
 IOManager::~IOManager() {
   stop();
   close(m_epfd);
-  close(m_ticklefds[0]);
-  close(m_ticklefds[1]);
-
-  for (std::size_t i = 0; i < m_fdContexts.size(); i++) {
-    if (m_fdContexts[i]) {
-      delete m_fdContexts[i];
+  close(m_tickleFd);
+  if (m_uring) {
+    delete m_uring;
+  }
+  for (auto w : m_idleWorkers) {
+    close(w->eventfd);
+    if (w->epfd >= 0) {
+      close(w->epfd);
+    }
+    if (w->timers) {
+      delete w->timers;
     }
+    delete w;
   }
+
+  m_fdContexts.foreach([](int fd, FdContext *fd_ctx) { delete fd_ctx; });
 }
 
 /**
  * @func: 
- * @param {size_t} size
+ * @param {int} fd
+ * @param {bool} auto_create
  * @return {*}
- * @description: 扩展fd列表
+ * @description: FdContext创建后地址不变，找到之后不需要再持有任何锁
  */
-void IOManager::contextResize(std::size_t size) {
-  m_fdContexts.resize(size);
-  for (size_t i = 0; i < m_fdContexts.size(); i++) {
-    if (!m_fdContexts[i]) {
-      m_fdContexts[i] = new FdContext;
-      m_fdContexts[i]->fd = i;
-    }
+IOManager::FdContext *IOManager::getFdContext(int fd, bool auto_create) {
+  if (!auto_create) {
+    return m_fdContexts.get(fd);
   }
+  return m_fdContexts.getOrCreate(fd, [fd]() {
+    FdContext *fd_ctx = new FdContext;
+    fd_ctx->fd = fd;
+    return fd_ctx;
+  });
 }
 
 /**
@@ -162,17 +296,11 @@ void IOManager::contextResize(std::size_t size) {
  */
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
   // 在全局fd列表中获得相应的FdContext
-  SYLAR_LOG_INFO(g_logger) << "IOManager::addEvent";
-  FdContext *fd_ctx = nullptr;
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_fdContexts.size() > fd) {
-    fd_ctx = m_fdContexts[fd];
-    lock.unlock();
-  } else {
-    lock.unlock();
-    RWMutexType::WriteLock lock2(m_mutex);
-    contextResize(m_fdContexts.size() * 2);
-    fd_ctx = m_fdContexts[fd];
+  SYLAR_LOG_DEBUG(g_logger) << "IOManager::addEvent";
+  FdContext *fd_ctx = getFdContext(fd, true);
+  if (!fd_ctx) {
+    SYLAR_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+    return -1;
   }
 
   // 确保该FdContext没有event属性
@@ -186,16 +314,26 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
   }
 
   // 使用epoll_ctl进行操作
-  int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-  epoll_event epevent;
-  epevent.events = EPOLLET | fd_ctx->events | event;
-  epevent.data.ptr = fd_ctx;
-  int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-  if (rt) {
-    SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << "," << op << ","
-                              << fd << "," << epevent.events << "):" << rt
-                              << " (" << errno << ")" << strerror(errno) << ")";
-    return -1;
+  if (m_epollPersistent) {
+    if (!fd_ctx->registered && !registerFd(fd_ctx)) {
+      return -1;
+    }
+  } else {
+    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (op == EPOLL_CTL_ADD) {
+      chooseOwner(fd_ctx);
+    }
+    int epfd = getEpollFd(fd_ctx);
+    epoll_event epevent;
+    epevent.events = EPOLLET | fd_ctx->events | event;
+    epevent.data.ptr = fd_ctx;
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
+    if (rt) {
+      SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << "," << op << ","
+                                << fd << "," << epevent.events << "):" << rt
+                                << " (" << errno << ")" << strerror(errno) << ")";
+      return -1;
+    }
   }
 
   ++m_pendingEventCount;
@@ -211,10 +349,54 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
     event_ctx.fiber = Fiber::GetThis();
     SYLAR_ASSERT(event_ctx.fiber->getState() == Fiber::EXEC);
   }
+
+  // 等待之前已经就绪过，直接触发；就绪可能已经过时，调用者要重试io
+  if (fd_ctx->ready & event) {
+    fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+    fd_ctx->triggerEvent(event);
+    --m_pendingEventCount;
+  }
   
   return 0;
 }
 
+void IOManager::chooseOwner(FdContext *fd_ctx) {
+  if (!m_epollPerThread) {
+    return;
+  }
+  // 优先放入当前工作线程的epoll，其他线程添加时轮流分配
+  int owner = getWorkerIndex();
+  if (owner < 0) {
+    owner = m_nextOwner++ % m_idleWorkers.size();
+  }
+  fd_ctx->owner = owner;
+}
+
+/**
+ * @func: 
+ * @param {FdContext} *fd_ctx
+ * @return {*}
+ * @description: 读写都注册为边缘触发，之后的就绪记录在fd_ctx->ready中
+ */
+bool IOManager::registerFd(FdContext *fd_ctx) {
+  chooseOwner(fd_ctx);
+  int epfd = getEpollFd(fd_ctx);
+  epoll_event epevent;
+  epevent.events = EPOLLET | EPOLLIN | EPOLLOUT;
+  epevent.data.ptr = fd_ctx;
+  int rt = epoll_ctl(epfd, EPOLL_CTL_ADD, fd_ctx->fd, &epevent);
+  if (rt) {
+    SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << "," << EPOLL_CTL_ADD
+                              << "," << fd_ctx->fd << "," << epevent.events
+                              << "):" << rt << " (" << errno << ")"
+                              << strerror(errno) << ")";
+    return false;
+  }
+  fd_ctx->registered = true;
+  fd_ctx->ready = NONE;
+  return true;
+}
+
 /**
  * @func: 
  * @param {int} fd
@@ -223,34 +405,34 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
  * @description: 把fd中某个事件删除
  */
 bool IOManager::delEvent(int fd, Event event) {
-  SYLAR_LOG_INFO(g_logger) << "IOManager::delEvent";
+  SYLAR_LOG_DEBUG(g_logger) << "IOManager::delEvent";
   // 获得FdContext
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_fdContexts.size() <= fd) {
+  FdContext *fd_ctx = getFdContext(fd, false);
+  if (!fd_ctx) {
     return false;
   }
 
-  FdContext *fd_ctx = m_fdContexts[fd];
-  lock.unlock();
-
   // 确保该FdContext中有event事件
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
   if (!(fd_ctx->events & event)) {
     return false;
   }
 
-  // 进行操作
+  // 进行操作，常驻注册时不修改epoll
   Event new_events = (Event)(fd_ctx->events & ~event);
-  int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-  epoll_event epevent;
-  epevent.events = EPOLLET | new_events;
-  epevent.data.ptr = fd_ctx;
-  int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-  if (rt) {
-    SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << "," << op << ","
-                              << fd << "," << epevent.events << "):" << rt
-                              << " (" << errno << ")" << strerror(errno) << ")";
-    return false;
+  if (!m_epollPersistent) {
+    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = EPOLLET | new_events;
+    epevent.data.ptr = fd_ctx;
+    int epfd = getEpollFd(fd_ctx);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
+    if (rt) {
+      SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << "," << op << ","
+                                << fd << "," << epevent.events << "):" << rt
+                                << " (" << errno << ")" << strerror(errno) << ")";
+      return false;
+    }
   }
 
   // 修改fd_ctx
@@ -269,33 +451,33 @@ bool IOManager::delEvent(int fd, Event event) {
  * @description: 触发并取消事件
  */
 bool IOManager::cancelEvent(int fd, Event event) {
-  SYLAR_LOG_INFO(g_logger) << "IOManager::cancelEvent";
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_fdContexts.size() <= fd) {
+  SYLAR_LOG_DEBUG(g_logger) << "IOManager::cancelEvent";
+  FdContext *fd_ctx = getFdContext(fd, false);
+  if (!fd_ctx) {
     return false;
   }
 
-  FdContext *fd_ctx = m_fdContexts[fd];
-  lock.unlock();
-
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
   if (!(fd_ctx->events & event)) {
     return false;
   }
 
-  // 取消事件
-  Event new_events = (Event)(fd_ctx->events & ~event);
-  int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-  epoll_event epevent;
-  epevent.events = EPOLLET | new_events;
-  epevent.data.ptr = fd_ctx;
-
-  int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-  if (rt) {
-    SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << "," << op << ","
-                              << fd << "," << epevent.events << "):" << rt
-                              << " (" << errno << ")" << strerror(errno) << ")";
-    return false;
+  // 取消事件，常驻注册时不修改epoll
+  if (!m_epollPersistent) {
+    Event new_events = (Event)(fd_ctx->events & ~event);
+    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = EPOLLET | new_events;
+    epevent.data.ptr = fd_ctx;
+
+    int epfd = getEpollFd(fd_ctx);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
+    if (rt) {
+      SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << "," << op << ","
+                                << fd << "," << epevent.events << "):" << rt
+                                << " (" << errno << ")" << strerror(errno) << ")";
+      return false;
+    }
   }
 
   // 触发事件
@@ -311,17 +493,22 @@ bool IOManager::cancelEvent(int fd, Event event) {
  * @description: 触发并取消所有事件
  */
 bool IOManager::cancelAll(int fd) {
-  SYLAR_LOG_INFO(g_logger) << "IOManager::cancelAll";
-  RWMutexType::ReadLock lock(m_mutex);
-  if ((int)m_fdContexts.size() <= fd) {
+  SYLAR_LOG_DEBUG(g_logger) << "IOManager::cancelAll";
+  FdContext *fd_ctx = getFdContext(fd, false);
+  if (!fd_ctx) {
     return false;
   }
-
-  FdContext *fd_ctx = m_fdContexts[fd];
-  lock.unlock();
+  // 进行中的io_uring操作以-ECANCELED完成，大部分fd关闭时没有进行中的操作，不必进入内核
+  if (m_uring && fd_ctx->uringOps.load(std::memory_order_acquire) > 0) {
+    m_uring->cancelFd(fd);
+  }
 
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-  if (!fd_ctx->events) {
+  // 常驻注册的fd在这里移除，fd号复用时重新注册
+  bool registered = fd_ctx->registered;
+  fd_ctx->registered = false;
+  fd_ctx->ready = NONE;
+  if (!fd_ctx->events && !registered) {
     return false;
   }
 
@@ -330,9 +517,10 @@ bool IOManager::cancelAll(int fd) {
   epevent.events = 0;
   epevent.data.ptr = fd_ctx;
 
-  int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+  int epfd = getEpollFd(fd_ctx);
+  int rt = epoll_ctl(epfd, op, fd, &epevent);
   if (rt) {
-    SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << "," << op << ","
+    SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << "," << op << ","
                               << fd << "," << epevent.events << "):" << rt
                               << " (" << errno << ")" << strerror(errno) << ")";
     return false;
@@ -352,6 +540,63 @@ bool IOManager::cancelAll(int fd) {
   return true;
 }
 
+int IOManager::submitIo(const IoUringOp &op, uint64_t timeout_ms) {
+  SYLAR_ASSERT(m_uring);
+  IoRequest req;
+  req.fiber = Fiber::GetThis();
+  SYLAR_ASSERT(!req.fiber->isSharedStack());
+  struct __kernel_timespec *timeout = nullptr;
+  if (timeout_ms != (uint64_t)-1) {
+    req.timeout.tv_sec = timeout_ms / 1000;
+    req.timeout.tv_nsec = timeout_ms % 1000 * 1000000;
+    req.pending = 2;
+    timeout = &req.timeout;
+  }
+
+  // 提交之前计数，close时cancelAll看到0说明还没有提交
+  FdContext *fd_ctx = getFdContext(op.fd, true);
+  if (fd_ctx) {
+    fd_ctx->uringOps.fetch_add(1, std::memory_order_acq_rel);
+  }
+  ++m_pendingEventCount;
+  // 超时的user_data在地址最低位打标记，IoRequest至少按4字节对齐
+  m_uring->submit(op, (uint64_t)&req, timeout, (uint64_t)&req | 1);
+  // 完成可能在切出之前就被其他线程收割，调度器不会运行仍在EXEC状态的协程
+  Fiber::YieldToHold();
+  if (fd_ctx) {
+    fd_ctx->uringOps.fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  if (req.timedOut && req.res < 0) {
+    return -ETIMEDOUT;
+  }
+  return req.res;
+}
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 操作和超时的cqe都收到后才恢复协程，之后IoRequest会随协程栈失效
+ */
+void IOManager::reapIo(TaskBatch &batch) {
+  m_uring->reap([this, &batch](uint64_t data, int res) {
+    // 取消操作本身的结果不需要处理
+    if (!data) {
+      return;
+    }
+    IoRequest *req = (IoRequest *)(data & ~(uint64_t)1);
+    if (data & 1) {
+      req->timedOut = res == -ETIME;
+    } else {
+      req->res = res;
+    }
+    if (--req->pending == 0) {
+      --m_pendingEventCount;
+      batch.add(&req->fiber);
+    }
+  });
+}
+
 IOManager *IOManager::GetThis() {
   return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
@@ -365,15 +610,93 @@ void IOManager::tickle() {
   if (!hasIdleThreads()) {
     return;
   }
+  // 优先唤醒睡眠的follower，都在运行或者已经被唤醒时唤醒leader
+  if (!wakeFollower()) {
+    wakeLeader();
+  }
+}
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 只唤醒指定的线程，线程正在运行时睡眠前会检查自己的队列，不需要唤醒
+ */
+void IOManager::tickleWorker(std::size_t index) {
+  IdleWorker *worker = m_idleWorkers[index];
+  int state = worker->state;
+  if (state == IdleWorker::SLEEPING) {
+    wakeWorker(worker);
+  } else if (state == IdleWorker::LEADER) {
+    wakeLeader();
+  }
+}
+
+bool IOManager::wakeFollower() {
+  std::size_t count = m_idleWorkers.size();
+  std::size_t start = m_nextWake++;
+  for (std::size_t i = 0; i < count; ++i) {
+    IdleWorker *worker = m_idleWorkers[(start + i) % count];
+    bool expected = false;
+    if (worker->state == IdleWorker::SLEEPING &&
+        worker->wakePending.compare_exchange_strong(expected, true)) {
+      uint64_t one = 1;
+      int rt = write_f(worker->eventfd, &one, sizeof(one));
+      SYLAR_ASSERT(rt == sizeof(one));
+      return true;
+    }
+  }
+  return false;
+}
+
+void IOManager::wakeWorker(IdleWorker *worker) {
+  if (!worker->wakePending.exchange(true)) {
+    uint64_t one = 1;
+    int rt = write_f(worker->eventfd, &one, sizeof(one));
+    SYLAR_ASSERT(rt == sizeof(one));
+  }
+}
+
+void IOManager::wakeLeader() {
+  // leader在自己的epoll上等待，成为leader后会重新获取定时器，没有leader时不需要唤醒
+  if (m_epollPerThread) {
+    int leader = m_leader;
+    if (leader >= 0) {
+      wakeWorker(m_idleWorkers[leader]);
+    }
+    return;
+  }
+  if (!m_leaderWakePending.exchange(true)) {
+    uint64_t one = 1;
+    int rt = write_f(m_tickleFd, &one, sizeof(one));
+    SYLAR_ASSERT(rt == sizeof(one));
+  }
+}
 
-  //SYLAR_LOG_INFO(g_logger) << "tickle";
-  int rt = write(m_ticklefds[1], "T", 1);
-  SYLAR_ASSERT(rt == 1);
+// eventfd不在FdManager中，直接调用原始的read/write，避免进入hook
+void IOManager::waitWakeup(IdleWorker *worker, uint64_t timeout_us) {
+  static const uint64_t MAX_TIMEOUT = 3000 * 1000;
+  timeout_us = std::min(timeout_us, MAX_TIMEOUT);
+  struct timespec ts;
+  ts.tv_sec = timeout_us / 1000000;
+  ts.tv_nsec = (timeout_us % 1000000) * 1000;
+  pollfd pfd;
+  pfd.fd = worker->eventfd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  int rt = 0;
+  do {
+    rt = ppoll(&pfd, 1, &ts, nullptr);
+  } while (rt < 0 && errno == EINTR);
+
+  worker->wakePending = false;
+  uint64_t dummy;
+  read_f(worker->eventfd, &dummy, sizeof(dummy));
 }
 
 bool IOManager::stopping(uint64_t &timeout) {
-  timeout = getNextTimer();
-  return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+  timeout = getNextTimerUS();
+  return timeout == ~0ull && m_pendingEventCount == 0 &&
+         Scheduler::stopping() && !hasWorkerTimers();
 
 }
 /**
@@ -392,9 +715,15 @@ bool IOManager::stopping() {
  * @description: epoll_wait，在获得event之后，触发该event的操作，并删除该fd相应的事件
  */
 void IOManager::idle() {
-  epoll_event *events = new epoll_event[64]();
-  std::shared_ptr<epoll_event> shared_events(
-      events, [](epoll_event *ptr) { delete[] ptr; });
+  // 一次取满时说明就绪的fd比数组多，加倍直到m_epollBatchMax
+  std::vector<epoll_event> events(m_epollBatch);
+  int index = getWorkerIndex();
+  SYLAR_ASSERT(index >= 0);
+  IdleWorker *self = m_idleWorkers[index];
+  // 内核默认会把定时唤醒推迟最多50us，亚毫秒的睡眠需要调小
+  if (m_timerSlackNs) {
+    prctl(PR_SET_TIMERSLACK, (unsigned long)m_timerSlackNs);
+  }
 
   while (true) {
 
@@ -403,45 +732,129 @@ void IOManager::idle() {
     if (stopping(next_timeout)) {
       SYLAR_LOG_INFO(g_logger)
           << "name = " << getName() << " idle stopping exit";
+      // 依次唤醒下一个空闲线程，让它也能退出
+      tickle();
       break;
     }
 
+    int expected = -1;
+    bool is_leader = m_leader.compare_exchange_strong(expected, index);
+    int epfd = m_epollPerThread ? self->epfd : m_epfd;
+    if (is_leader) {
+      self->state = IdleWorker::LEADER;
+      // 成为leader之后重新获取定时器，不会漏掉刚插入的定时器
+      next_timeout = std::min(getNextTimerUS(), getWorkerNextTimer(self));
+      if (hasPendingTasks()) {
+        next_timeout = 0;
+      }
+    } else {
+      // 已经有leader在等待，先发布睡眠状态再检查任务，和tickle互相保证不会漏掉唤醒
+      self->state = IdleWorker::SLEEPING;
+      bool can_sleep =
+          m_leader != -1 && !hasPendingTasks() && !stopping(next_timeout);
+      // follower只等待自己的定时器，共享的定时器由leader处理
+      uint64_t worker_timeout = getWorkerNextTimer(self);
+      if (!m_epollPerThread) {
+        if (can_sleep && worker_timeout != 0) {
+          waitWakeup(self, worker_timeout);
+        }
+        self->state = IdleWorker::RUNNING;
+        if (self->timers) {
+          std::vector<std::function<void()>> cbs;
+          self->timers->ListExpiredCb(cbs);
+          schedule(cbs.begin(), cbs.end());
+        }
+        // leader已经离开，回去竞争leader
+        if (m_leader == -1) {
+          continue;
+        }
+        Fiber::ptr cur = Fiber::GetThis();
+        auto raw_ptr = cur.get();
+        cur.reset();
+        raw_ptr->swapOut();
+        continue;
+      }
+      // 自己的epoll中有自己的fd，follower也要等待，只是不处理共享的定时器
+      next_timeout = can_sleep ? worker_timeout : 0;
+    }
+
     // epoll_wait等待
     int rt = 0;
-    do {
+    // 先忙轮询一段时间，期间有事件或任务就不用睡眠，用CPU换取唤醒延迟
+    // 轮询中只读原子变量，不去抢各个队列的锁，进入阻塞等待前再加锁检查一次
+    if (m_busyPollUs && next_timeout != 0) {
+      uint64_t spin = m_busyPollUs;
+      if (next_timeout < spin) {
+        spin = next_timeout;
+      }
+      uint64_t deadline = GetMonotonicUS() + spin;
+      bool has_tasks = false;
+      do {
+        rt = epoll_wait(epfd, &events[0], (int)events.size(), 0);
+      } while (rt == 0 && !(has_tasks = hasPendingTasksNoLock()) &&
+               GetMonotonicUS() < deadline);
+      if (has_tasks || (rt == 0 && hasPendingTasks())) {
+        next_timeout = 0;
+      }
+    }
+    while (rt <= 0) {
       
-      static const int MAX_TIMEOUT = 3000;
-      if(next_timeout != ~0ull) {
-        next_timeout = (int)next_timeout > MAX_TIMEOUT ? MAX_TIMEOUT : next_timeout;
-      } else {
+      static const uint64_t MAX_TIMEOUT = 3000 * 1000;
+      if(next_timeout > MAX_TIMEOUT) {
         next_timeout = MAX_TIMEOUT;
       }
-      SYLAR_LOG_INFO(g_logger) << "epoll wait next_timeout = " << next_timeout;
-      rt = epoll_wait(m_epfd, events, 64, (int)next_timeout);
+      SYLAR_LOG_DEBUG(g_logger) << "epoll wait next_timeout(us) = " << next_timeout;
+      rt = EpollWaitUS(epfd, &events[0], (int)events.size(), next_timeout);
 
       if (rt < 0 && errno == EINTR) {
 
       } else {
         break;
       }
-    } while (true);
+    }
 
+    self->state = IdleWorker::RUNNING;
+    if (is_leader) {
+      // 交出leader，唤醒一个follower接替
+      m_leader = -1;
+      wakeFollower();
+    }
+
+    // 本轮超时的定时器和触发的事件攒成一批，一次放入任务队列，最多唤醒一次
+    // 每个线程独立epoll时，触发的任务回到本线程运行
+    TaskBatch batch(this);
+    int thread = m_epollPerThread ? sylar::getThreadId() : -1;
     std::vector<std::function<void()>> cbs;
-    ListExpiredCb(cbs);
-    if (!cbs.empty()) {
-      schedule(cbs.begin(), cbs.end());
-      cbs.clear();
+    if (is_leader) {
+      ListExpiredCb(cbs);
+    }
+    if (self->timers) {
+      self->timers->ListExpiredCb(cbs);
+    }
+    for (auto &cb : cbs) {
+      batch.add(&cb);
     }
 
     for (int i = 0; i < rt; i++) {
       epoll_event &event = events[i];
 
       // 如果是tickle的话
-      if (event.data.fd == m_ticklefds[0]) {
-        uint8_t dummy[256];
-        //SYLAR_LOG_INFO(g_logger) << "pipe read";
-        while (read(m_ticklefds[0], dummy, sizeof(dummy)) > 0)
-           ;
+      if (event.data.fd == m_tickleFd) {
+        m_leaderWakePending = false;
+        uint64_t dummy;
+        read_f(m_tickleFd, &dummy, sizeof(dummy));
+        continue;
+      }
+      if (m_uring && event.data.fd == m_uring->getEventFd()) {
+        uint64_t dummy;
+        read_f(m_uring->getEventFd(), &dummy, sizeof(dummy));
+        reapIo(batch);
+        continue;
+      }
+      if (event.data.fd == self->eventfd) {
+        self->wakePending = false;
+        uint64_t dummy;
+        read_f(self->eventfd, &dummy, sizeof(dummy));
         continue;
       }
 
@@ -459,36 +872,51 @@ void IOManager::idle() {
         real_events |= WRITE;
       }
 
-      if ((fd_ctx->events & real_events) == NONE) {
+      // 常驻注册时不修改epoll，没有等待者的就绪记下来留给之后的addEvent
+      if (m_epollPersistent) {
+        if (event.events & (EPOLLERR | EPOLLHUP)) {
+          real_events |= READ | WRITE;
+        }
+        fd_ctx->ready =
+            (Event)(fd_ctx->ready | (real_events & ~fd_ctx->events));
+        real_events &= fd_ctx->events;
+      } else if ((fd_ctx->events & real_events) == NONE) {
         continue;
       }
-      
+
       // 修改fd_ctx剩余的事件
-      int left_events = (fd_ctx->events & ~real_events);
-      int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-      event.events = EPOLLET | left_events;
-
-      int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-      if (rt2) {
-        SYLAR_LOG_ERROR(g_logger)
-            << "epoll_ctl(" << m_epfd << "," << op << "," << fd_ctx->fd << ","
-            << event.events << "):" << rt << " (" << errno << ")"
-            << strerror(errno) << ")";
-        continue;
+      if (!m_epollPersistent) {
+        int left_events = (fd_ctx->events & ~real_events);
+        int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        event.events = EPOLLET | left_events;
+
+        int rt2 = epoll_ctl(epfd, op, fd_ctx->fd, &event);
+        if (rt2) {
+          SYLAR_LOG_ERROR(g_logger)
+              << "epoll_ctl(" << epfd << "," << op << "," << fd_ctx->fd << ","
+              << event.events << "):" << rt << " (" << errno << ")"
+              << strerror(errno) << ")";
+          continue;
+        }
       }
 
       if (real_events & READ) {
-        SYLAR_LOG_INFO(g_logger) << "epoll trigger read";
-        fd_ctx->triggerEvent(READ);
+        SYLAR_LOG_DEBUG(g_logger) << "epoll trigger read";
+        fd_ctx->triggerEvent(READ, &batch, thread);
         m_pendingEventCount--;
       }
 
       if (real_events & WRITE) {
-        SYLAR_LOG_INFO(g_logger) << "epoll trigger write";
-        fd_ctx->triggerEvent(WRITE);
+        SYLAR_LOG_DEBUG(g_logger) << "epoll trigger write";
+        fd_ctx->triggerEvent(WRITE, &batch, thread);
         m_pendingEventCount--;
       }
     } 
+    batch.commit();
+
+    if (rt == (int)events.size() && events.size() < m_epollBatchMax) {
+      events.resize(std::min<std::size_t>(events.size() * 2, m_epollBatchMax));
+    }
 
     // 做完一次记得跳出idle协程，去运行任务
     // 否则会导致死循环    
@@ -499,9 +927,90 @@ void IOManager::idle() {
   }
 }
 
+Timer::ptr IOManager::addTimer(uint64_t ms, std::function<void()> cb,
+                               bool recurring) {
+  return getTimerManager()->addTimer(ms, cb, recurring);
+}
+
+Timer::ptr IOManager::addTimerUS(uint64_t us, std::function<void()> cb,
+                                 bool recurring) {
+  return getTimerManager()->addTimerUS(us, cb, recurring);
+}
+
+Timer::ptr IOManager::addConditionTimer(uint64_t ms, std::function<void()> cb,
+                                        std::weak_ptr<void> weak_cond,
+                                        bool recurring) {
+  return getTimerManager()->addConditionTimer(ms, cb, weak_cond, recurring);
+}
+
+void IOManager::addIntrusiveTimer(IntrusiveTimer *timer, uint64_t ms,
+                                  IntrusiveTimer::Callback cb) {
+  getTimerManager()->addIntrusiveTimer(timer, ms, cb);
+}
+
+TimerManager *IOManager::getTimerManager() {
+  if (m_threadTimers) {
+    int index = getWorkerIndex();
+    if (index >= 0) {
+      return m_idleWorkers[index]->timers;
+    }
+  }
+  return this;
+}
+
+uint64_t IOManager::getWorkerNextTimer(IdleWorker *worker) {
+  return worker->timers ? worker->timers->getNextTimerUS() : ~0ull;
+}
+
+// 只在调度器已经要停止时调用，其他线程的定时器通过读锁检查
+bool IOManager::hasWorkerTimers() {
+  if (!m_threadTimers) {
+    return false;
+  }
+  for (auto w : m_idleWorkers) {
+    if (w->timers->hasTimer()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void IOManager::WorkerTimers::onTimerInsertedAtFront() {
+  m_iom->m_idleWorkers[m_index]->timerCheckUS = 0;
+}
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 最早的定时器到期之前只比较一次时间，不加锁
+ */
+void IOManager::beforeTask() {
+  int index = getWorkerIndex();
+  if (index < 0) {
+    return;
+  }
+  IdleWorker *self = m_idleWorkers[index];
+  if (!self->timers) {
+    return;
+  }
+  uint64_t now = GetMonotonicUS();
+  if (now < self->timerCheckUS) {
+    return;
+  }
+  uint64_t next = self->timers->getNextTimerUS();
+  if (next == 0) {
+    std::vector<std::function<void()>> cbs;
+    self->timers->ListExpiredCb(cbs);
+    schedule(cbs.begin(), cbs.end());
+    next = self->timers->getNextTimerUS();
+  }
+  self->timerCheckUS = next == ~0ull ? ~0ull : now + next;
+}
+
 void IOManager::onTimerInsertedAtFront() {
   //SYLAR_LOG_INFO(g_logger) << "onTimerInsertedAtFront";
-  tickle();
+  // 只有leader在等待定时器，让它重新计算超时时间
+  wakeLeader();
 }
 
 }
\ No newline at end of file
@@ -13,7 +13,9 @@
 #define __SYLAR_IOMANAGER_H__
 
 
+#include "sylar/fd_table.h"
 #include "sylar/fiber.h"
+#include "sylar/io_uring.h"
 #include "sylar/mutex.h"
 #include "sylar/scheduler.h"
 #include "sylar/timer.h"
@@ -36,6 +38,13 @@ public:
     WRITE = 0x4
   };
 
+  // io后端，DEFAULT时由配置iomanager.io_uring决定
+  enum Backend {
+    DEFAULT,
+    EPOLL,
+    IO_URING
+  };
+
 private:
   // epoll主要对fd进行操作
   // 如果该fd可读，则触发读操作：将EventContext加入任务队列中
@@ -52,7 +61,9 @@ private:
 
     EventContext &getContext(Event event);
     void resetContext(EventContext &ctx);
-    void triggerEvent(Event event);
+    // batch不为空且事件属于该批次的调度器时放入batch并指定线程thread运行，否则直接调度
+    void triggerEvent(Event event, Scheduler::TaskBatch *batch = nullptr,
+                      int thread = -1);
 
     // 读任务
     EventContext read;
@@ -61,13 +72,22 @@ private:
     int fd;
     // 事件属性
     Event events = NONE;
+    // 每个线程独立epoll时，fd注册在哪个工作线程的epoll中
+    int owner = -1;
+    // 常驻注册时fd是否已经加入epoll
+    bool registered = false;
+    // 常驻注册时没有等待者期间到来的就绪事件，下一次addEvent直接触发
+    Event ready = NONE;
+    // 进行中的io_uring操作数，为0时cancelAll不提交取消
+    std::atomic<int> uringOps = {0};
     MutexType mutex;
   };
   
 public:
   
+  // io_uring创建失败时退回epoll
   IOManager(std::size_t threads = 1, bool use_caller = true,
-            const std::string &name = "");
+            const std::string &name = "", Backend backend = DEFAULT);
   ~IOManager();
 
   int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
@@ -75,25 +95,166 @@ public:
   bool cancelEvent(int fd, Event event);
   bool cancelAll(int fd);
 
+  // 是否使用io_uring执行hook的io
+  bool isIoUring() const { return m_uring != nullptr; }
+
+  // iomanager.thread_timers开启时，工作线程增加的定时器放在该线程自己的定时器中，
+  // 其他线程(以及未开启时)增加的放在IOManager共享的定时器中
+  Timer::ptr addTimer(uint64_t ms, std::function<void()> cb,
+                      bool recurring = false);
+  Timer::ptr addTimerUS(uint64_t us, std::function<void()> cb,
+                        bool recurring = false);
+  Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb,
+                               std::weak_ptr<void> weak_cond,
+                               bool recurring = false);
+  void addIntrusiveTimer(IntrusiveTimer *timer, uint64_t ms,
+                         IntrusiveTimer::Callback cb);
+
+  /**
+   * @func:
+   * @param {IoUringOp} &op 操作使用的内存要在调用期间有效
+   * @param {uint64_t} timeout_ms 超时时间，-1表示不超时
+   * @return {*} 操作的结果，失败返回-errno，超时返回-ETIMEDOUT
+   * @description: 通过io_uring执行op，当前协程挂起直到完成
+   * 操作期间内核会直接读写op指向的内存，共享栈协程的栈会被换出，不能使用
+   */
+  int submitIo(const IoUringOp &op, uint64_t timeout_ms);
+
   static IOManager* GetThis();
 
 protected:
   void tickle() override;
+  void tickleWorker(std::size_t index) override;
   bool stopping() override;
+  // timeout返回距离下一个定时器的微秒数
   bool stopping(uint64_t& timeout);
   void idle() override;
-  void contextResize(std::size_t size);
+  // 任务一直不断时线程不会进入idle，在任务之间处理自己到期的定时器
+  void beforeTask() override;
   void onTimerInsertedAtFront() override;
 
+private:
+  // 工作线程自己的定时器，只有所属线程增加和处理，锁不会被其他线程竞争
+  // 其他线程取消时只做标记，刷新和重置作为任务投递给所属线程
+  class WorkerTimers : public TimerManager {
+  public:
+    WorkerTimers(IOManager *iom, std::size_t index)
+        : m_iom(iom), m_index(index) {}
+    using TimerManager::hasTimer;
+
+  protected:
+    // 定时器只在所属线程运行时增加，睡眠前会重新计算超时，不需要唤醒；
+    // 运行中下一个任务之前就要重新检查
+    void onTimerInsertedAtFront() override;
+    bool isOwnerThread() const override {
+      return m_iom->getWorkerIndex() == (int)m_index;
+    }
+    void postToOwner(std::function<void()> cb) override {
+      m_iom->schedule(cb, m_iom->getWorkerThreadId(m_index));
+    }
+
+  private:
+    IOManager *m_iom;
+    std::size_t m_index;
+  };
+
+  // 空闲线程采用leader/follower模式：同一时刻只有leader在共享的epoll上等待，
+  // 其他空闲线程(follower)在自己的eventfd上睡眠，这样可以只唤醒指定的一个线程
+  // iomanager.epoll_per_thread开启时每个工作线程有自己的epoll，fd在第一次addEvent时分配给当前线程，
+  // 事件触发后协程回到该线程运行；此时follower也在自己的epoll上等待，leader只负责定时器
+  struct IdleWorker {
+    enum State {
+      RUNNING,
+      LEADER,
+      SLEEPING
+    };
+    std::atomic<int> state = {RUNNING};
+    // 已经写过eventfd还没被读取，重复的唤醒合并为一次
+    std::atomic<bool> wakePending = {false};
+    int eventfd = -1;
+    // 每个线程独立epoll时该线程的epoll
+    int epfd = -1;
+    // 该线程自己的定时器，没有开启iomanager.thread_timers时为空
+    WorkerTimers *timers = nullptr;
+    // 任务之间下次检查定时器的时间(us)，只由所属线程读写
+    uint64_t timerCheckUS = 0;
+  };
+
+  // 每个线程独立epoll时为第一次加入epoll的fd选择所在线程
+  void chooseOwner(FdContext *fd_ctx);
+  // 无锁取得fd的上下文，auto_create为true时不存在则创建，fd超出表容量时返回nullptr
+  FdContext *getFdContext(int fd, bool auto_create);
+  // 常驻注册时fd第一次addEvent加入epoll，之后只修改FdContext
+  bool registerFd(FdContext *fd_ctx);
+
+  // fd_ctx所在的epoll
+  int getEpollFd(FdContext *fd_ctx) const {
+    return m_epollPerThread ? m_idleWorkers[fd_ctx->owner]->epfd : m_epfd;
+  }
+
+  // 一次io_uring操作，在发起的协程栈上，完成前协程不会返回
+  struct IoRequest {
+    Fiber::ptr fiber;
+    int res = 0;
+    // 还没收到的cqe数量，带超时时有两个
+    int pending = 1;
+    bool timedOut = false;
+    struct __kernel_timespec timeout;
+  };
+
+  // 收割io_uring完成的操作，把完成的协程放入batch
+  void reapIo(TaskBatch &batch);
+
+  // 当前线程增加定时器使用的TimerManager
+  TimerManager *getTimerManager();
+  // worker自己的定时器距离下次到期的微秒数
+  uint64_t getWorkerNextTimer(IdleWorker *worker);
+  // 是否还有工作线程自己的定时器
+  bool hasWorkerTimers();
+
+  // 唤醒一个正在睡眠的follower，没有时返回false
+  bool wakeFollower();
+  // 唤醒指定的线程
+  void wakeWorker(IdleWorker *worker);
+  // 唤醒在epoll上等待的leader
+  void wakeLeader();
+  // follower睡眠直到被唤醒或超时，超时精确到微秒
+  void waitWakeup(IdleWorker *worker, uint64_t timeout_us);
+
 private:
   // epoll套接字
   int m_epfd = 0;
-  // pipe套接字，方便唤醒epoll_wait
-  int m_ticklefds[2];
-  RWMutexType m_mutex;
-
+  // leader的eventfd，注册在epoll中
+  int m_tickleFd = -1;
+  std::atomic<bool> m_leaderWakePending = {false};
+  // 当前leader在m_idleWorkers中的下标，-1表示没有leader
+  std::atomic<int> m_leader = {-1};
+  // 下标和Scheduler的工作线程下标一致
+  std::vector<IdleWorker*> m_idleWorkers;
+  // 轮流选择唤醒的follower
+  std::atomic<std::size_t> m_nextWake = {0};
+  // 每个工作线程使用自己的epoll
+  bool m_epollPerThread = false;
+  // 每个工作线程使用自己的定时器
+  bool m_threadTimers = false;
+  // iomanager.epoll_persistent开启时fd以EPOLLIN|EPOLLOUT|EPOLLET常驻在epoll中，
+  // 等待和唤醒都不再调用epoll_ctl，直到cancelAll(close)时才移除，
+  // 所以fd必须经过hook的close或者先调用cancelAll再关闭，否则fd号复用后收不到事件
+  bool m_epollPersistent = false;
+  // 每个idle协程epoll_wait数组的初始大小和上限
+  uint32_t m_epollBatch = 64;
+  uint32_t m_epollBatchMax = 1024;
+  // 睡眠前在epoll_wait(..., 0)上忙轮询的微秒数，0表示不轮询
+  uint32_t m_busyPollUs = 0;
+  // 工作线程的timer slack(纳秒)，0表示使用内核默认的50us
+  uint32_t m_timerSlackNs = 0;
+  // 非工作线程添加的fd轮流分配给工作线程
+  std::atomic<std::size_t> m_nextOwner = {0};
+  // 不为空时hook的io通过io_uring完成
+  IoUring *m_uring = nullptr;
   std::atomic<std::size_t> m_pendingEventCount = {0};
-  std::vector<FdContext*> m_fdContexts;
+  // fd上下文在第一次addEvent时创建，直到IOManager析构才释放，查找不加锁
+  FdTable<FdContext> m_fdContexts;
 };
 }
 #endif
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include <cstdarg>
 #include <cstddef>
 #include <cstdio>
+#include <cstring>
+#include <ctime>
 #include <iostream>
 #include <memory>
 #include <ostream>
@@ -18,6 +20,8 @@
 #include <yaml-cpp/node/node.h>
 #include <yaml-cpp/node/parse.h>
 #include "config.h"
+#include "sylar/log_async.h"
+#include "sylar/log_binary.h"
 #include "sylar/mutex.h"
 
 namespace sylar{
@@ -35,6 +39,69 @@ LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level,
       m_fiberId(fiberId), m_time(time), m_threadName(threadName),
       m_logger(logger), m_level(level) {}
 
+// 每个线程缓存的事件数，嵌套打日志时才会同时用到多个
+static const int LOG_EVENT_POOL_SIZE = 8;
+
+struct LogEventPool {
+  LogEvent::ptr events[LOG_EVENT_POOL_SIZE];
+  int count = 0;
+  ~LogEventPool();
+};
+
+// 线程退出时其他thread_local的析构函数里可能还在打日志，缓存析构之后不再使用
+static thread_local bool t_log_event_pool_dead = false;
+static thread_local LogEventPool t_log_event_pool;
+
+LogEventPool::~LogEventPool() { t_log_event_pool_dead = true; }
+
+LogEvent::ptr LogEvent::Create(std::shared_ptr<Logger> logger,
+                               LogLevel::Level level, const char *file,
+                               uint32_t line, uint32_t elapse,
+                               uint32_t threadId, uint32_t fiberId,
+                               uint64_t time) {
+  if (!t_log_event_pool_dead && t_log_event_pool.count > 0) {
+    LogEvent::ptr event;
+    event.swap(t_log_event_pool.events[--t_log_event_pool.count]);
+    event->reset(logger, level, file, line, elapse, threadId, fiberId, time);
+    return event;
+  }
+  return LogEvent::ptr(new LogEvent(logger, level, file, line, elapse,
+                                    threadId, fiberId, time,
+                                    Thread::GetName()));
+}
+
+void LogEvent::Recycle(LogEvent::ptr &event) {
+  if (!event || event.use_count() != 1 || t_log_event_pool_dead ||
+      t_log_event_pool.count >= LOG_EVENT_POOL_SIZE) {
+    return;
+  }
+  // 不让缓存中的事件延长logger的生命周期
+  event->m_logger.reset();
+  t_log_event_pool.events[t_log_event_pool.count++].swap(event);
+}
+
+void LogEvent::reset(std::shared_ptr<Logger> logger, LogLevel::Level level,
+                     const char *file, uint32_t line, uint32_t elapse,
+                     uint32_t threadId, uint32_t fiberId, uint64_t time) {
+  m_file = file;
+  m_line = line;
+  m_elapse = elapse;
+  m_threadId = threadId;
+  m_fiberId = fiberId;
+  m_time = time;
+  // 线程名通常不变，assign不会重新分配
+  m_threadName.assign(Thread::GetName());
+  m_logger.swap(logger);
+  m_level = level;
+  // str("")保留底层string的容量
+  m_ss.str(std::string());
+  m_ss.clear();
+  m_ss.flags(std::ios_base::skipws | std::ios_base::dec);
+  m_ss.precision(6);
+  m_ss.width(0);
+  m_ss.fill(' ');
+}
+
 /**
  * @func: 
  * @param {char} *fmt
@@ -49,15 +116,41 @@ void LogEvent::format(const char *fmt, ...) {
 }
 
 void LogEvent::format(const char *fmt, va_list al) {
+  // 大部分日志放得进栈上的缓冲区，放不下再分配
+  char stack_buf[512];
+  va_list copy;
+  va_copy(copy, al);
+  int len = vsnprintf(stack_buf, sizeof(stack_buf), fmt, copy);
+  va_end(copy);
+  if (len < 0) {
+    return;
+  }
+  if (len < (int)sizeof(stack_buf)) {
+    m_ss.write(stack_buf, len);
+    return;
+  }
   char *buf = nullptr;
-  int len = vasprintf(&buf, fmt, al);
+  len = vasprintf(&buf, fmt, al);
   if (len != -1) {
-    m_ss << std::string(buf, len);
+    m_ss.write(buf, len);
     free(buf);
   }
 }
 
-LogEventWrap::LogEventWrap(const LogEvent::ptr& event) : m_event(event) {}
+void LogEvent::appendContent(std::string &out) {
+  std::stringbuf *buf = m_ss.rdbuf();
+  std::streamoff size = buf->pubseekoff(0, std::ios_base::cur, std::ios_base::out);
+  if (size <= 0) {
+    return;
+  }
+  // 每次从头读，多个appender格式化同一个事件时结果相同
+  buf->pubseekoff(0, std::ios_base::beg, std::ios_base::in);
+  std::size_t pos = out.size();
+  out.resize(pos + size);
+  buf->sgetn(&out[pos], size);
+}
+
+LogEventWrap::LogEventWrap(LogEvent::ptr event) : m_event(std::move(event)) {}
 /**
  * @func: 
  * @return {*}
@@ -65,6 +158,7 @@ LogEventWrap::LogEventWrap(const LogEvent::ptr& event) : m_event(event) {}
  */
 LogEventWrap::~LogEventWrap() {
   m_event->getLogger()->log(m_event->getLevel(), m_event);
+  LogEvent::Recycle(m_event);
 }
 
 std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
@@ -108,125 +202,78 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
     }
     
 /******************Format start********************/
-    class MessageFormatItem : public LogFormatter::FormatItem{
-    public:
-        MessageFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getContent();
-        }
-    };
-
-    class LevelFormatItem : public LogFormatter::FormatItem{
-    public:
-        LevelFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << LogLevel::ToString(level);
-        }
-    };
-
-    class ElapseFormatItem : public LogFormatter::FormatItem{
-    public:
-        ElapseFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getElapse();
-        }
-    };
-
-    class NameFormatItem : public LogFormatter::FormatItem{
-    public:
-        NameFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getLogger()->getName();
-        }
-    };
-
-    class ThreadIdFormatItem : public LogFormatter::FormatItem{
-    public:
-        ThreadIdFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getThreadId();
-        }
-    };
+    // 无符号整数转成十进制追加到out
+    static void AppendUInt(std::string &out, uint64_t v) {
+      char buf[24];
+      char *end = buf + sizeof(buf);
+      char *p = end;
+      do {
+        *--p = '0' + v % 10;
+        v /= 10;
+      } while (v);
+      out.append(p, end - p);
+    }
 
-    class FiberIdFormatItem : public LogFormatter::FormatItem{
-    public:
-        FiberIdFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getFiberId();
-        }
+    // 每个线程缓存最近几种日期格式在某一秒的结果，同一秒内不再调用localtime_r和strftime
+    // 只用定长数组，线程退出阶段也可以安全使用
+    struct DateTimeCache {
+      time_t sec;
+      uint32_t fmtLen;
+      uint32_t len;
+      char fmt[32];
+      char buf[64];
     };
 
-    class DateTimeFormatItem : public LogFormatter::FormatItem{
-    public:
-      DateTimeFormatItem(const std::string &format = "%Y:%m:%d %H:%m:%S")
-          : m_format(format) {
-            if(m_format.empty()) {
-                m_format = "%Y:%m:%d %H:%m:%S";
-            }
-        }
-
-      void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            struct tm tm;
-            time_t time = event->getTime();
-            localtime_r(&time, &tm);
-            char buf[64];
-            strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-            os << buf;
+    static const int DATE_CACHE_SIZE = 4;
+    static thread_local DateTimeCache t_date_cache[DATE_CACHE_SIZE];
+    static thread_local uint32_t t_date_cache_next = 0;
+
+    static void AppendDateTime(std::string &out, const std::string &fmt,
+                               time_t time) {
+      bool cacheable = fmt.size() < sizeof(t_date_cache[0].fmt);
+      if (cacheable) {
+        for (int i = 0; i < DATE_CACHE_SIZE; ++i) {
+          DateTimeCache &c = t_date_cache[i];
+          if (c.sec == time && c.fmtLen == fmt.size() &&
+              memcmp(c.fmt, fmt.c_str(), fmt.size()) == 0) {
+            out.append(c.buf, c.len);
+            return;
+          }
         }
-    private:
-        std::string m_format;
-    };
+      }
+      struct tm tm;
+      localtime_r(&time, &tm);
+      char buf[64];
+      std::size_t len = strftime(buf, sizeof(buf), fmt.c_str(), &tm);
+      out.append(buf, len);
+      if (cacheable) {
+        DateTimeCache &c = t_date_cache[t_date_cache_next++ % DATE_CACHE_SIZE];
+        c.sec = time;
+        c.fmtLen = fmt.size();
+        memcpy(c.fmt, fmt.c_str(), fmt.size());
+        c.len = len;
+        memcpy(c.buf, buf, len);
+      }
+    }
 
-    class FileNameFormatItem : public LogFormatter::FormatItem{
-    public:
-        FileNameFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getFile();
-        }
+    struct FormatBuffer {
+      std::string buf;
+      ~FormatBuffer();
     };
 
-    class LineFormatItem : public LogFormatter::FormatItem{
-    public:
-        LineFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getLine();
-        }
-    };
+    static thread_local bool t_format_buffer_dead = false;
+    static thread_local FormatBuffer t_format_buffer;
 
-    class NewLineFormatItem : public LogFormatter::FormatItem{
-    public:
-        NewLineFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << std::endl;
-        }
-    };
+    FormatBuffer::~FormatBuffer() { t_format_buffer_dead = true; }
 
-    class StringFormatItem : public LogFormatter::FormatItem{
-    public:
-        StringFormatItem(const std::string& str = "")
-            :FormatItem(str), m_string(str) {}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << m_string;
-        }
-    private:
-        std::string m_string;
-    };
-
-    class TabFormatItem : public LogFormatter::FormatItem{
-    public:
-        TabFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << "\t";
-        }
-    };
+    std::string *LogFormatter::GetThreadBuffer() {
+      if (t_format_buffer_dead) {
+        return nullptr;
+      }
+      t_format_buffer.buf.clear();
+      return &t_format_buffer.buf;
+    }
 
-    class ThreadNameFormatItem : public LogFormatter::FormatItem{
-    public:
-        ThreadNameFormatItem(const std::string& str = ""){}
-        void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override {
-            os << event->getThreadName() << "    ";
-        }
-    };
     /**
      * @func: LogFormatter
      * @param {string&} pattern
@@ -244,12 +291,72 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
      * @description: 将事件通过不同的item解析成字符串
      */
     std::string LogFormatter::format(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event){
-        std::stringstream ss;
-        for(auto& i : m_items){
-            i->format(ss, logger, level, event);
+        std::string out;
+        format(out, logger, level, event);
+        return out;
+    }
+
+    void LogFormatter::format(std::string &out, std::shared_ptr<Logger> logger,
+                              LogLevel::Level level,
+                              const LogEvent::ptr &event) {
+      for (auto &op : m_ops) {
+        switch (op.type) {
+        case OP_STRING:
+          out.append(op.text);
+          break;
+        case OP_MESSAGE:
+          event->appendContent(out);
+          break;
+        case OP_LEVEL:
+          out.append(LogLevel::ToString(level));
+          break;
+        case OP_ELAPSE:
+          AppendUInt(out, event->getElapse());
+          break;
+        case OP_NAME:
+          out.append(event->getLogger()->getName());
+          break;
+        case OP_THREAD_ID:
+          AppendUInt(out, event->getThreadId());
+          break;
+        case OP_DATETIME:
+          AppendDateTime(out, op.text, event->getTime());
+          break;
+        case OP_FILE:
+          out.append(event->getFile());
+          break;
+        case OP_LINE:
+          AppendUInt(out, event->getLine());
+          break;
+        case OP_NEWLINE:
+          out.push_back('\n');
+          break;
+        case OP_FIBER_ID:
+          AppendUInt(out, event->getFiberId());
+          break;
+        case OP_TAB:
+          out.push_back('\t');
+          break;
+        case OP_THREAD_NAME:
+          out.append(event->getThreadName());
+          out.append("    ");
+          break;
         }
-        return ss.str();
+      }
     }
+
+    void LogFormatter::addOp(OpType type, const std::string &text) {
+      if (type == OP_STRING && !m_ops.empty() &&
+          m_ops.back().type == OP_STRING) {
+        m_ops.back().text.append(text);
+        return;
+      }
+      Op op;
+      op.type = type;
+      op.text = text;
+      m_ops.push_back(op);
+    }
+
     /**
      * @func: init
      * @return {*}
@@ -284,6 +391,7 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
             //m_pattern[i] == '%'
             if ((i + 1) < m_pattern.size() && m_pattern[i + 1] == '%') {
                 raw.append(1, '%');
+                ++i;
                 continue;
             }
 
@@ -341,48 +449,47 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
             }
 
         }
-
-        static std::map<std::string,
-                        std::function<FormatItem::ptr(const std::string &str)>>
-            s_format_items = {
-#define XX(str, C)                                                         \
-        {                                                                      \
-          #str, [](const std::string &fmt) {                                   \
-            return FormatItem::ptr(new C(fmt));                                \
-          }                                                                    \
+        // 最后一个%之后的普通字符
+        if (!raw.empty()) {
+          vec.push_back(std::make_tuple(std::move(raw), std::string(), 0));
         }
-              XX(m, MessageFormatItem),
-              XX(p, LevelFormatItem),
-              XX(r, ElapseFormatItem),
-              XX(n, NewLineFormatItem),
-              XX(c, NameFormatItem),
-              XX(t, ThreadIdFormatItem),
-              XX(d, DateTimeFormatItem),
-              XX(f, FileNameFormatItem),
-              XX(l, LineFormatItem),
-              XX(F, FiberIdFormatItem),
-              XX(T, TabFormatItem),
-              XX(N, ThreadNameFormatItem)
+
+        static std::map<std::string, OpType> s_format_ops = {
+#define XX(str, op) {#str, op}
+              XX(m, OP_MESSAGE),
+              XX(p, OP_LEVEL),
+              XX(r, OP_ELAPSE),
+              XX(n, OP_NEWLINE),
+              XX(c, OP_NAME),
+              XX(t, OP_THREAD_ID),
+              XX(d, OP_DATETIME),
+              XX(f, OP_FILE),
+              XX(l, OP_LINE),
+              XX(F, OP_FIBER_ID),
+              XX(T, OP_TAB),
+              XX(N, OP_THREAD_NAME)
         #undef XX
         };
 
         for(auto& i : vec) {
             if(std::get<2>(i) == 0) {
-                m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+                addOp(OP_STRING, std::get<0>(i));
             } else {
-                auto it = s_format_items.find(std::get<0>(i));
-                if(it == s_format_items.end()) {
-                  m_items.push_back(FormatItem::ptr(new StringFormatItem(
-                      "<<error_format %" + std::get<0>(i) + ">>")));
+                auto it = s_format_ops.find(std::get<0>(i));
+                if(it == s_format_ops.end()) {
+                  addOp(OP_STRING, "<<error_format %" + std::get<0>(i) + ">>");
                   m_error = true;
+                } else if (it->second == OP_DATETIME) {
+                  std::string fmt = std::get<1>(i);
+                  if (fmt.empty()) {
+                    fmt = "%Y:%m:%d %H:%m:%S";
+                  }
+                  addOp(OP_DATETIME, fmt);
                 } else {
-                    m_items.push_back(it->second(std::get<1>(i)));
+                  addOp(it->second);
                 }
-                
             }
-            //std::cout << "(" << std::get<0>(i) << ") - (" << std::get<1>(i) << ") - (" << std::get<2>(i) << ")" << std::endl;
         }
-    //std::cout << m_items.size() << std::endl;
     }
     
     /******************Logger start********************/
@@ -504,37 +611,67 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
       }
     }
 
-    FileAppender::FileAppender(const std::string &filename){
-      m_filename = filename;
+    FileAppender::FileAppender(const std::string &filename,
+                               const LogRotatePolicy &policy)
+        : m_filename(filename), m_rotator(filename, policy) {
       reopen();
     }
 
     void FileAppender::log(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event){
       if (m_level <= level) {
+        MutexType::Lock lock(m_mutex);
+        std::string tmp;
+        std::string *buf = LogFormatter::GetThreadBuffer();
+        if (!buf) {
+          buf = &tmp;
+        }
+        m_formatter->format(*buf, logger, level, event);
         // 防止在长时间写入文件的过程中，文件被删除，隔段时间就reopen一次
         uint64_t now = event->getTime();
         if(now >= (m_lastTime + 3)) {
-            reopen();
+            reopenLocked();
             m_lastTime = now;
         }
-        m_filestream << m_formatter->format(logger,level, event);
+        // 轮转只是改名和重新打开，压缩在后台线程
+        if (m_rotator.needRotate(now, buf->size())) {
+          m_filestream.close();
+          m_rotator.rotate(now);
+          reopenLocked();
+        }
+        m_filestream.write(buf->data(), buf->size());
+        m_rotator.written(buf->size());
       }
     }
 
     bool FileAppender::reopen() {
       MutexType::Lock lock(m_mutex);
+      return reopenLocked();
+    }
+
+    bool FileAppender::reopenLocked() {
         if(m_filestream){
             m_filestream.close();
         }
-        m_filestream.open(m_filename);
+        // 追加写，不能截断已有的内容
+        m_filestream.open(m_filename, std::ios::app);
+        m_rotator.opened(time(0));
         return !!m_filestream;
     }
 
+    bool FileAppender::rotate() {
+      MutexType::Lock lock(m_mutex);
+      m_filestream.close();
+      bool rt = m_rotator.rotate(time(0));
+      reopenLocked();
+      return rt;
+    }
+
     std::string FileAppender::toYamlString() {
       MutexType::Lock lock(m_mutex);
       YAML::Node node;
       node["type"] = "FileLogAppender";
       node["path"] = m_filename;
+      m_rotator.getPolicy().dump(node);
 
       if (m_level != LogLevel::UNKNOW) {
         node["level"] = LogLevel::ToString(m_level);
@@ -553,7 +690,13 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
     void StdoutLogAppender::log(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event){
       if (m_level <= level) {
         MutexType::Lock lock(m_mutex);
-        std::cout << m_formatter->format( logger, level, event);
+        std::string tmp;
+        std::string *buf = LogFormatter::GetThreadBuffer();
+        if (!buf) {
+          buf = &tmp;
+        }
+        m_formatter->format(*buf, logger, level, event);
+        std::cout.write(buf->data(), buf->size());
       }
     }
 
@@ -580,10 +723,17 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
       LogLevel::Level level = LogLevel::UNKNOW;
       std::string formatter;
       std::string file;
+      // 是否由后台线程异步写出，以及缓冲区满时的处理
+      bool async = false;
+      int overflow = AsyncLogWriter::BLOCK;
+      // 日志文件的轮转策略，二进制日志默认按64MB轮转保留5个
+      LogRotatePolicy rotate;
 
       bool operator==(const LogAppenderDefine &oth) const {
         return type == oth.type && level == oth.level &&
-               formatter == oth.formatter && file == oth.file;
+               formatter == oth.formatter && file == oth.file &&
+               async == oth.async && overflow == oth.overflow &&
+               rotate == oth.rotate;
       }
     };
 
@@ -607,6 +757,24 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
       }
     };
 
+    // 文本和二进制日志共用的轮转配置
+    static void LoadRotatePolicy(const YAML::Node &node,
+                                 LogRotatePolicy &policy) {
+      if (node["max_size"].IsDefined()) {
+        policy.max_size = node["max_size"].as<uint64_t>();
+      }
+      if (node["rotate_interval"].IsDefined()) {
+        policy.interval = LogRotatePolicy::IntervalFromString(
+            node["rotate_interval"].as<std::string>());
+      }
+      if (node["max_files"].IsDefined()) {
+        policy.max_files = node["max_files"].as<uint32_t>();
+      }
+      if (node["compress"].IsDefined()) {
+        policy.compress = node["compress"].as<bool>();
+      }
+    }
+
     template <>
     class LexicalCast<std::string, LogDefine> {
     public:
@@ -650,16 +818,39 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
               if (tmp["formatter"].IsDefined()) {
                 lad.formatter = tmp["formatter"].as<std::string>();
               }
+              LoadRotatePolicy(tmp, lad.rotate);
             } else if (type == "StdoutLogAppender") {
               lad.type = 2;
               if (tmp["formatter"].IsDefined()) {
                 lad.formatter = tmp["formatter"].as<std::string>();
               }
+            } else if (type == "BinaryLogAppender") {
+              lad.type = 3;
+              if (!tmp["path"].IsDefined()) {
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT())
+                    << "connot find appender path. logs name: "
+                    << node["name"].as<std::string>()
+                    << " appenders index: " << i;
+                continue;
+              }
+              lad.file = tmp["path"].as<std::string>();
+              if (tmp["formatter"].IsDefined()) {
+                lad.formatter = tmp["formatter"].as<std::string>();
+              }
+              lad.rotate = BinaryLogAppender::DefaultPolicy();
+              LoadRotatePolicy(tmp, lad.rotate);
             } else {
               SYLAR_LOG_ERROR(SYLAR_LOG_ROOT())
                   << "connot config appender type:" << type;
               continue;
             }
+            if (tmp["async"].IsDefined()) {
+              lad.async = tmp["async"].as<bool>();
+            }
+            if (tmp["overflow"].IsDefined()) {
+              lad.overflow = AsyncLogWriter::OverflowFromString(
+                  tmp["overflow"].as<std::string>());
+            }
           ld.appenders.push_back(lad);            
           }
         }
@@ -677,11 +868,16 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
         node["formatter"] = v.formatter;
         for (auto &appender : v.appenders) {
           YAML::Node ap;
-          if (appender.level == 1) {
+          if (appender.type == 1) {
             ap["type"] = "FileLogAppender";
             ap["path"] = appender.file;
+            appender.rotate.dump(ap);
           } else if (appender.type == 2) {
             ap["type"] = "StdoutLogAppender";
+          } else if (appender.type == 3) {
+            ap["type"] = "BinaryLogAppender";
+            ap["path"] = appender.file;
+            appender.rotate.dump(ap);
           }
 
           if (appender.level != LogLevel::UNKNOW) {
@@ -692,6 +888,12 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
             ap["formatter"] = appender.formatter;
           }
 
+          if (appender.async) {
+            ap["async"] = true;
+            ap["overflow"] = AsyncLogWriter::ToString(
+                (AsyncLogWriter::Overflow)appender.overflow);
+          }
+
           node["appenders"].push_back(ap);
         }
         std::stringstream ss;
@@ -732,8 +934,15 @@ std::stringstream &LogEventWrap::getSS() { return m_event->getSS(); }
             logger->clearAppenders();
             for (auto &a : i.appenders) {
               LogAppender::ptr ap;
-              if (a.type == 1) {
-                ap.reset(new FileAppender(a.file));
+              if (a.type == 3) {
+                // 二进制日志只是memcpy到mmap的文件，不需要异步
+                ap.reset(new BinaryLogAppender(a.file, a.rotate));
+              } else if (a.async) {
+                ap.reset(new AsyncLogAppender(
+                    a.type == 1 ? a.file : "",
+                    (AsyncLogWriter::Overflow)a.overflow, a.rotate));
+              } else if (a.type == 1) {
+                ap.reset(new FileAppender(a.file, a.rotate));
               } else if (a.type == 2) {
                 ap.reset(new StdoutLogAppender);
               }
@@ -12,6 +12,7 @@
 #define __SYLAR_LOG_H__
 
 #include "singleton.h"
+#include "sylar/log_rotate.h"
 #include "sylar/mutex.h"
 #include "sylar/thread.h"
 #include <cstdint>
@@ -25,12 +26,21 @@
 #include <vector>
 #include <ctime>
 #include <map>
+// 编译期最低日志等级(LogLevel::Level的数值)，低于它的日志语句条件恒为假，
+// 开启优化后整条语句被编译器删掉；cmake中用-DSYLAR_LOG_MIN_LEVEL=2去掉DEBUG
+#ifndef SYLAR_LOG_MIN_LEVEL
+#define SYLAR_LOG_MIN_LEVEL 0
+#endif
+
+#define SYLAR_LOG_ENABLED(logger, level)                                       \
+  ((int)(level) >= SYLAR_LOG_MIN_LEVEL && logger->getLevel() <= level)
+
 #define SYLAR_LOG_LEVEL(logger, level)                                         \
-  if (logger->getLevel() <= level)                                             \
-  sylar::LogEventWrap(                                                         \
-      sylar::LogEvent::ptr(new sylar::LogEvent(                                \
-          logger, level, __FILE__, __LINE__, 0, sylar::getThreadId(),          \
-          sylar::getFiberId(), time(0), sylar::Thread::GetName())))            \
+  if (SYLAR_LOG_ENABLED(logger, level))                                        \
+  sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, __FILE__,         \
+                                              __LINE__, 0,                     \
+                                              sylar::getThreadId(),            \
+                                              sylar::getFiberId(), time(0)))   \
       .getSS()
 
 #define SYLAR_LOG_DEBUG(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::DEBUG)
@@ -40,11 +50,11 @@
 #define SYLAR_LOG_FATAL(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::FATAL)
 
 #define SYLAR_LOG_FORMAT_LEVEL(logger, level, fmt, ...)                        \
-  if (logger->getLevel() <= level)                                             \
-  sylar::LogEventWrap(                                                         \
-      sylar::LogEvent::ptr(new sylar::LogEvent(                                \
-          logger, level, __FILE__, __LINE__, 0, sylar::getThreadId(),          \
-          sylar::getFiberId(), time(0), sylar::Thread::GetName())))            \
+  if (SYLAR_LOG_ENABLED(logger, level))                                        \
+  sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, __FILE__,         \
+                                              __LINE__, 0,                     \
+                                              sylar::getThreadId(),            \
+                                              sylar::getFiberId(), time(0)))   \
       .getEvent()                                                              \
       ->format(fmt, __VA_ARGS__)
 
@@ -89,6 +99,20 @@ public:
            const char *file, uint32_t line, uint32_t elapse, uint32_t threadId,
            uint32_t fiberId, uint64_t time, const std::string &threadName);
 
+  /**
+   * @func:
+   * @return {*}
+   * @description: 优先复用当前线程缓存的事件，内容缓冲区保留上次的容量，
+   *               稳定之后写一条日志不再分配内存
+   */
+  static LogEvent::ptr Create(std::shared_ptr<Logger> logger,
+                              LogLevel::Level level, const char *file,
+                              uint32_t line, uint32_t elapse,
+                              uint32_t threadId, uint32_t fiberId,
+                              uint64_t time);
+  // 日志写完后放回当前线程的缓存，其他地方还持有时不放回
+  static void Recycle(LogEvent::ptr &event);
+
   const char* getFile() const {return m_file;}
   uint32_t getLine() const {return m_line;}
   uint32_t getElapse() const {return m_elapse;}
@@ -96,6 +120,8 @@ public:
   uint32_t getFiberId() const {return m_fiberId;}
   uint32_t getTime() const {return m_time;}
   std::string getContent() { return m_ss.str(); }
+  // 把内容追加到out末尾，不产生临时字符串
+  void appendContent(std::string &out);
   const std::string &getThreadName() const { return m_threadName; }
 
   std::stringstream &getSS() { return m_ss; }
@@ -104,6 +130,11 @@ public:
 
   void format(const char *fmt, ...);
   void format(const char *fmt, va_list al);
+private:
+  // 复用时重新设置所有字段，并清空内容和流的格式状态
+  void reset(std::shared_ptr<Logger> logger, LogLevel::Level level,
+             const char *file, uint32_t line, uint32_t elapse,
+             uint32_t threadId, uint32_t fiberId, uint64_t time);
 private:
   const char* m_file = nullptr;   //文件名
   uint32_t m_line = 0;            //行号
@@ -121,7 +152,7 @@ private:
 // 通过wrap类输出内容
 class LogEventWrap {
 public:
-  LogEventWrap(const LogEvent::ptr& event);
+  LogEventWrap(LogEvent::ptr event);
   ~LogEventWrap();
   std::stringstream &getSS();
   const LogEvent::ptr getEvent() const {return m_event;}
@@ -129,28 +160,61 @@ private:
   LogEvent::ptr m_event;
 };
 
-// 日志格式解析成为相应的item内容存储
+// 日志格式在构造时编译成一组指令，格式化时按顺序追加到同一个缓冲区
 class LogFormatter{
 public:
   typedef std::shared_ptr<LogFormatter> ptr;     
   LogFormatter(const std::string& pattern);
 
   std::string format(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event);
+  /**
+   * @func:
+   * @param {string} &out 格式化的结果追加到末尾
+   * @return {*}
+   * @description: 配合GetThreadBuffer复用缓冲区，稳定后不再分配内存
+   */
+  void format(std::string &out, std::shared_ptr<Logger> logger,
+              LogLevel::Level level, const LogEvent::ptr &event);
   void init();
   bool isError() { return m_error; }
   
   const std::string getPattern() const {return m_pattern;}
-  class FormatItem{
-  public:
-    typedef std::shared_ptr<FormatItem> ptr;
-    FormatItem(const std::string& fmt = ""){};
-    virtual ~FormatItem(){};
-    //virtual std::string format(LogEvent::ptr event) = 0;
-    virtual void format(std::ostream& os,std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) = 0;
+
+  /**
+   * @func:
+   * @return {*} 线程退出阶段缓冲区已经析构时返回nullptr
+   * @description: 当前线程复用的格式化缓冲区，返回前已清空
+   */
+  static std::string *GetThreadBuffer();
+
+private:
+  enum OpType {
+    OP_STRING,      // 原样输出m_text
+    OP_MESSAGE,     // %m
+    OP_LEVEL,       // %p
+    OP_ELAPSE,      // %r
+    OP_NAME,        // %c
+    OP_THREAD_ID,   // %t
+    OP_DATETIME,    // %d{m_text}
+    OP_FILE,        // %f
+    OP_LINE,        // %l
+    OP_NEWLINE,     // %n
+    OP_FIBER_ID,    // %F
+    OP_TAB,         // %T
+    OP_THREAD_NAME  // %N
+  };
+
+  struct Op {
+    OpType type;
+    std::string text;
   };
+
+  // 连续的字符串指令合并成一条
+  void addOp(OpType type, const std::string &text = "");
+
 private:
   std::string m_pattern;
-  std::vector<FormatItem::ptr> m_items;
+  std::vector<Op> m_ops;
   bool m_error = false;
 };
 
@@ -188,14 +252,20 @@ public:
 class FileAppender : public LogAppender{
 public:
   typedef std::shared_ptr<FileAppender> ptr;
-  FileAppender(const std::string &filename);
+  FileAppender(const std::string &filename,
+               const LogRotatePolicy &policy = LogRotatePolicy());
   void log(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) override;
   bool reopen();
+  // 立即轮转当前文件
+  bool rotate();
   std::string toYamlString() override;
+private:
+  bool reopenLocked();
 private:
   std::string m_filename;
   std::ofstream m_filestream;
-  uint64_t m_lastTime;
+  uint64_t m_lastTime = 0;
+  LogRotator m_rotator;
 };
 
 //日志器
@@ -222,7 +292,7 @@ class Logger : public std::enable_shared_from_this<Logger>{
   LogLevel::Level getLevel() const {return m_level;}
   void setLevel(LogLevel::Level val) {m_level = val;}
 
-  const std::string getName() const {return m_name;}
+  const std::string &getName() const {return m_name;}
   void setName(const std::string &val) { m_name = val; }
 
   const LogFormatter::ptr getFormatter() const { return m_formatter; }
@@ -0,0 +1,487 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 01:20:14
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 01:20:14
+ * @FilePath     : /sylar/log_async.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 01:20:14
+ */
+#include "log_async.h"
+#include "sylar/config.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sched.h>
+#include <sstream>
+#include <unistd.h>
+#include <yaml-cpp/yaml.h>
+
+namespace sylar {
+
+static ConfigVar<uint32_t>::ptr g_log_async_buffer_size =
+    Config::Lookup<uint32_t>("log.async.buffer_size", 1024 * 1024,
+                             "async log ring buffer bytes per thread");
+
+static ConfigVar<uint32_t>::ptr g_log_async_flush_interval =
+    Config::Lookup<uint32_t>("log.async.flush_interval_ms", 10,
+                             "async log writer flush interval");
+
+// 缓冲区中每条记录的头部
+struct RecordHeader {
+  uint32_t len;
+  uint32_t reserved;
+  LogSink *sink;
+};
+
+// 尾部放不下时的回绕标记，只写len字段
+static const uint32_t WRAP = 0xffffffffu;
+
+static std::size_t AlignRecord(std::size_t len) { return (len + 7) & ~(std::size_t)7; }
+
+LogSink::LogSink(const std::string &path, const LogRotatePolicy &policy)
+    : m_path(path), m_rotator(path, policy) {
+  if (m_path.empty()) {
+    m_fd = STDOUT_FILENO;
+  } else {
+    reopen();
+  }
+}
+
+LogSink::~LogSink() {
+  if (!m_path.empty() && m_fd >= 0) {
+    ::close(m_fd);
+  }
+}
+
+bool LogSink::reopen() {
+  m_lastOpen = time(0);
+  int fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+  if (m_fd >= 0) {
+    ::close(m_fd);
+  }
+  m_fd = fd;
+  m_rotator.opened(m_lastOpen);
+  return true;
+}
+
+void LogSink::write(struct iovec *iov, int cnt) {
+  Mutex::Lock lock(m_mutex);
+  if (!m_path.empty() && (uint64_t)time(0) >= m_lastOpen + 3) {
+    reopen();
+  }
+  if (m_fd < 0) {
+    return;
+  }
+  if (!m_path.empty() && m_rotator.getPolicy().enabled()) {
+    std::size_t len = 0;
+    for (int i = 0; i < cnt; ++i) {
+      len += iov[i].iov_len;
+    }
+    uint64_t now = time(0);
+    if (m_rotator.needRotate(now, len) && m_rotator.rotate(now)) {
+      reopen();
+    }
+    m_rotator.written(len);
+  }
+  while (cnt > 0) {
+    ssize_t n = ::writev(m_fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    // 跳过已经写完的部分
+    while (cnt > 0 && (std::size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --cnt;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+LogRingBuffer::LogRingBuffer(std::size_t capacity) {
+  m_capacity = 4096;
+  while (m_capacity < capacity) {
+    m_capacity <<= 1;
+  }
+  m_buf = new char[m_capacity];
+}
+
+LogRingBuffer::~LogRingBuffer() { delete[] m_buf; }
+
+std::size_t LogRingBuffer::maxRecord() const {
+  return m_capacity / 2 - sizeof(RecordHeader);
+}
+
+bool LogRingBuffer::push(LogSink *sink, const char *data, std::size_t len) {
+  std::size_t need = AlignRecord(sizeof(RecordHeader) + len);
+  uint64_t tail = m_tail.load(std::memory_order_relaxed);
+  uint64_t head = m_head.load(std::memory_order_acquire);
+  std::size_t pos = tail & (m_capacity - 1);
+  std::size_t room = m_capacity - pos;
+  std::size_t skip = room < need ? room : 0;
+  if (tail + skip + need - head > m_capacity) {
+    return false;
+  }
+  if (skip) {
+    ((RecordHeader *)(m_buf + pos))->len = WRAP;
+    tail += skip;
+    pos = 0;
+  }
+  RecordHeader *header = (RecordHeader *)(m_buf + pos);
+  header->len = len;
+  header->reserved = 0;
+  header->sink = sink;
+  memcpy(m_buf + pos + sizeof(RecordHeader), data, len);
+  m_tail.store(tail + need, std::memory_order_release);
+  return true;
+}
+
+// 当前线程的缓冲区已经交出，之后的日志同步写
+// 没有析构函数，其他线程局部变量析构时仍然可以读
+static thread_local bool t_log_ring_dead = false;
+
+// 线程退出时把缓冲区交给后台线程释放
+struct LogRingHolder {
+  LogRingBuffer *ring = nullptr;
+  ~LogRingHolder() {
+    if (ring) {
+      ring->m_orphaned.store(true, std::memory_order_release);
+      ring = nullptr;
+    }
+    t_log_ring_dead = true;
+  }
+};
+
+static thread_local LogRingHolder t_log_ring;
+
+// 只在单例构造和析构时修改，析构之后仍然可以读
+static bool s_writer_alive = false;
+
+AsyncLogWriter::AsyncLogWriter() {
+  s_writer_alive = true;
+  m_bufferSize = g_log_async_buffer_size->getValue();
+  m_flushInterval = std::max<uint32_t>(g_log_async_flush_interval->getValue(), 1);
+  m_iov.reserve(IOV_MAX);
+}
+
+AsyncLogWriter::~AsyncLogWriter() {
+  m_stopping = true;
+  if (m_thread) {
+    m_sem.notify();
+    m_thread->join();
+  }
+  drain();
+  for (auto ring : m_rings) {
+    delete ring;
+  }
+  // 还没释放的目的地由appender析构时自己delete
+  s_writer_alive = false;
+}
+
+bool AsyncLogWriter::IsAlive() { return s_writer_alive; }
+
+bool AsyncLogWriter::HasThreadRing() { return !t_log_ring_dead; }
+
+AsyncLogWriter::Overflow AsyncLogWriter::OverflowFromString(const std::string &v) {
+  if (v == "drop") {
+    return DROP;
+  }
+  if (v == "drop_count") {
+    return DROP_COUNT;
+  }
+  return BLOCK;
+}
+
+const char *AsyncLogWriter::ToString(Overflow v) {
+  switch (v) {
+  case DROP:
+    return "drop";
+  case DROP_COUNT:
+    return "drop_count";
+  default:
+    return "block";
+  }
+}
+
+LogSink *AsyncLogWriter::addSink(const std::string &path,
+                                 const LogRotatePolicy &policy) {
+  LogSink *sink = new LogSink(path, policy);
+  Mutex::Lock lock(m_mutex);
+  m_sinks.push_back(sink);
+  if (!m_thread) {
+    m_thread.reset(new Thread(std::bind(&AsyncLogWriter::run, this), "log_writer"));
+  }
+  return sink;
+}
+
+void AsyncLogWriter::releaseSink(LogSink *sink) {
+  sink->m_released.store(true, std::memory_order_release);
+  wakeup();
+}
+
+/**
+ * @func:
+ * @return {*}
+ * @description: 和IOManager的tickle一样合并唤醒，后台线程醒来之前只post一次
+ */
+void AsyncLogWriter::wakeup() {
+  if (!m_notified.load(std::memory_order_relaxed) &&
+      !m_notified.exchange(true, std::memory_order_acq_rel)) {
+    m_sem.notify();
+  }
+}
+
+LogRingBuffer *AsyncLogWriter::getThreadRing() {
+  if (t_log_ring_dead) {
+    return nullptr;
+  }
+  if (!t_log_ring.ring) {
+    LogRingBuffer *ring = new LogRingBuffer(m_bufferSize);
+    Mutex::Lock lock(m_mutex);
+    m_rings.push_back(ring);
+    t_log_ring.ring = ring;
+  }
+  return t_log_ring.ring;
+}
+
+bool AsyncLogWriter::append(LogSink *sink, const char *data, std::size_t len,
+                            Overflow overflow) {
+  LogRingBuffer *ring = getThreadRing();
+  if (!ring) {
+    // 调用方应该先用HasThreadRing判断，这里只是兜底
+    struct iovec iov;
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    sink->write(&iov, 1);
+    return true;
+  }
+  if (len > ring->maxRecord()) {
+    len = ring->maxRecord();
+  }
+  std::size_t half = ring->capacity() / 2;
+  bool below_half = ring->used() < half;
+  while (!ring->push(sink, data, len)) {
+    if (overflow == DROP_COUNT) {
+      sink->addDropped();
+    }
+    if (overflow != BLOCK) {
+      return false;
+    }
+    // 可能在持有Logger锁的协程中，不能让出协程，只让出CPU
+    wakeup();
+    sched_yield();
+  }
+  // 超过一半时提前唤醒后台线程，平时等到刷新间隔再批量写
+  if (below_half && ring->used() >= half) {
+    wakeup();
+  }
+  return true;
+}
+
+void AsyncLogWriter::flush() {
+  if (!m_thread) {
+    return;
+  }
+  // 正在进行的一轮可能在调用之前就开始了，等下一轮结束
+  uint64_t target = m_passes.load(std::memory_order_acquire) + 2;
+  while (m_passes.load(std::memory_order_acquire) < target) {
+    wakeup();
+    sched_yield();
+  }
+}
+
+void AsyncLogWriter::run() {
+  while (true) {
+    // 先清除标记再写出，写出期间放入的日志会重新唤醒
+    m_notified.store(false, std::memory_order_release);
+    drain();
+    if (m_stopping) {
+      break;
+    }
+    m_sem.waitFor(m_flushInterval);
+  }
+}
+
+void AsyncLogWriter::writeGroup(LogSink *sink) {
+  if (sink && !m_iov.empty()) {
+    sink->write(&m_iov[0], (int)m_iov.size());
+  }
+  m_iov.clear();
+}
+
+std::size_t AsyncLogWriter::drainRing(LogRingBuffer *ring) {
+  uint64_t head = ring->m_head.load(std::memory_order_relaxed);
+  uint64_t tail = ring->m_tail.load(std::memory_order_acquire);
+  std::size_t mask = ring->m_capacity - 1;
+  std::size_t count = 0;
+  LogSink *cur = nullptr;
+  while (head < tail) {
+    std::size_t pos = head & mask;
+    RecordHeader *header = (RecordHeader *)(ring->m_buf + pos);
+    if (header->len == WRAP) {
+      head += ring->m_capacity - pos;
+      continue;
+    }
+    // 同一个目的地的连续记录合并成一次writev
+    if (header->sink != cur || m_iov.size() >= IOV_MAX) {
+      writeGroup(cur);
+      cur = header->sink;
+    }
+    struct iovec iov;
+    iov.iov_base = ring->m_buf + pos + sizeof(RecordHeader);
+    iov.iov_len = header->len;
+    m_iov.push_back(iov);
+    head += AlignRecord(sizeof(RecordHeader) + header->len);
+    ++count;
+  }
+  writeGroup(cur);
+  // 写完之后才归还空间
+  ring->m_head.store(head, std::memory_order_release);
+  return count;
+}
+
+std::size_t AsyncLogWriter::drain() {
+  std::vector<LogRingBuffer *> rings;
+  std::vector<LogSink *> sinks;
+  std::vector<LogSink *> released;
+  {
+    Mutex::Lock lock(m_mutex);
+    rings = m_rings;
+    // 释放标记在本轮开始前已经设置，之前放入的记录本轮都会写完
+    for (auto it = m_sinks.begin(); it != m_sinks.end();) {
+      if ((*it)->m_released.load(std::memory_order_acquire)) {
+        released.push_back(*it);
+        it = m_sinks.erase(it);
+      } else {
+        sinks.push_back(*it);
+        ++it;
+      }
+    }
+  }
+
+  std::size_t count = 0;
+  std::vector<LogRingBuffer *> orphaned;
+  for (auto ring : rings) {
+    // 先看退出标记再读，标记之前放入的记录这次都能读到
+    bool orphan = ring->m_orphaned.load(std::memory_order_acquire);
+    count += drainRing(ring);
+    if (orphan) {
+      orphaned.push_back(ring);
+    }
+  }
+  if (!orphaned.empty()) {
+    Mutex::Lock lock(m_mutex);
+    for (auto ring : orphaned) {
+      m_rings.erase(std::find(m_rings.begin(), m_rings.end(), ring));
+      delete ring;
+    }
+  }
+
+  sinks.insert(sinks.end(), released.begin(), released.end());
+  for (auto sink : sinks) {
+    uint64_t dropped = sink->m_dropped.load(std::memory_order_relaxed);
+    if (dropped != sink->m_reportedDropped) {
+      std::stringstream ss;
+      ss << "async log dropped " << dropped - sink->m_reportedDropped
+         << " messages" << std::endl;
+      std::string msg = ss.str();
+      struct iovec iov;
+      iov.iov_base = &msg[0];
+      iov.iov_len = msg.size();
+      sink->write(&iov, 1);
+      sink->m_reportedDropped = dropped;
+    }
+  }
+  for (auto sink : released) {
+    delete sink;
+  }
+  m_passes.fetch_add(1, std::memory_order_release);
+  return count;
+}
+
+AsyncLogAppender::AsyncLogAppender(const std::string &path,
+                                   AsyncLogWriter::Overflow overflow,
+                                   const LogRotatePolicy &policy)
+    : m_path(path), m_overflow(overflow), m_policy(policy) {
+  m_sink = AsyncLogWriterMgr::getInstance()->addSink(path, policy);
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+  if (AsyncLogWriter::IsAlive()) {
+    AsyncLogWriterMgr::getInstance()->releaseSink(m_sink);
+  } else {
+    delete m_sink;
+  }
+}
+
+void AsyncLogAppender::log(std::shared_ptr<Logger> logger,
+                           LogLevel::Level level, LogEvent::ptr event) {
+  if (m_level <= level) {
+    LogFormatter::ptr formatter;
+    {
+      MutexType::Lock lock(m_mutex);
+      formatter = m_formatter;
+    }
+    std::string tmp;
+    std::string *msg = LogFormatter::GetThreadBuffer();
+    if (!msg) {
+      msg = &tmp;
+    }
+    formatter->format(*msg, logger, level, event);
+    // 线程退出时其他线程局部变量(比如协程)析构中写的日志没有缓冲区可放，
+    // 和后台线程退出之后一样同步写
+    if (AsyncLogWriter::IsAlive() && AsyncLogWriter::HasThreadRing()) {
+      AsyncLogWriterMgr::getInstance()->append(m_sink, msg->data(),
+                                              msg->size(), m_overflow);
+    } else {
+      MutexType::Lock lock(m_mutex);
+      struct iovec iov;
+      iov.iov_base = &(*msg)[0];
+      iov.iov_len = msg->size();
+      m_sink->write(&iov, 1);
+    }
+  }
+}
+
+std::string AsyncLogAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  if (m_path.empty()) {
+    node["type"] = "StdoutLogAppender";
+  } else {
+    node["type"] = "FileLogAppender";
+    node["path"] = m_path;
+    m_policy.dump(node);
+  }
+  node["async"] = true;
+  node["overflow"] = AsyncLogWriter::ToString(m_overflow);
+
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::ToString(m_level);
+  }
+
+  if (has_formatter && m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+} // namespace sylar
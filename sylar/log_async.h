@@ -0,0 +1,203 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 01:20:14
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 01:20:14
+ * @FilePath     : /sylar/log_async.h
+ * @Description  : 异步日志：每个线程一个无锁环形缓冲区，后台线程用writev批量写出
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 01:20:14
+ */
+#ifndef __SYLAR_LOG_ASYNC_H__
+#define __SYLAR_LOG_ASYNC_H__
+
+#include "sylar/log.h"
+#include "sylar/log_rotate.h"
+#include "sylar/mutex.h"
+#include "sylar/singleton.h"
+#include "sylar/thread.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+namespace sylar {
+
+// 异步日志的输出目的地，平时只由后台线程写入
+class LogSink {
+  friend class AsyncLogWriter;
+
+public:
+  // path为空时写标准输出，这时不轮转
+  LogSink(const std::string &path,
+          const LogRotatePolicy &policy = LogRotatePolicy());
+  ~LogSink();
+
+  const std::string &getPath() const { return m_path; }
+  // 缓冲区满被丢弃的日志条数
+  uint64_t getDropped() const { return m_dropped; }
+  void addDropped() { m_dropped.fetch_add(1, std::memory_order_relaxed); }
+
+  // 写出iov中的全部内容，处理部分写入；
+  // 线程退出时的同步写可能和后台线程同时进行，所以加锁，平时没有竞争
+  void write(struct iovec *iov, int cnt);
+
+private:
+  // 和FileAppender一样定期重新打开，防止文件被删除后一直写不出来
+  bool reopen();
+
+private:
+  Mutex m_mutex;
+  std::string m_path;
+  int m_fd = -1;
+  // 在后台线程中轮转，不影响调用线程
+  LogRotator m_rotator;
+  // 上次打开的时间(秒)
+  uint64_t m_lastOpen = 0;
+  std::atomic<uint64_t> m_dropped = {0};
+  // 已经在日志中报告过的丢弃条数
+  uint64_t m_reportedDropped = 0;
+  // 对应的appender已经释放，缓冲区中的记录写完后关闭
+  std::atomic<bool> m_released = {false};
+};
+
+// 单生产者单消费者的字节环形缓冲区，生产者是所属线程，消费者是后台线程
+// 每条记录是RecordHeader加内容，按8字节对齐；尾部放不下时写一个回绕标记从头开始
+class LogRingBuffer {
+  friend class AsyncLogWriter;
+  friend struct LogRingHolder;
+
+public:
+  // capacity向上取整到2的幂
+  LogRingBuffer(std::size_t capacity);
+  ~LogRingBuffer();
+
+  /**
+   * @func:
+   * @return {*} 空间不够时返回false，不会写入一部分
+   * @description: 放入一条记录，只能由所属线程调用
+   */
+  bool push(LogSink *sink, const char *data, std::size_t len);
+
+  std::size_t used() const {
+    return m_tail.load(std::memory_order_relaxed) -
+           m_head.load(std::memory_order_acquire);
+  }
+  std::size_t capacity() const { return m_capacity; }
+  // 单条记录的最大长度，更长的内容会被截断
+  std::size_t maxRecord() const;
+
+private:
+  LogRingBuffer(const LogRingBuffer &) = delete;
+  LogRingBuffer &operator=(const LogRingBuffer &) = delete;
+
+private:
+  char *m_buf = nullptr;
+  std::size_t m_capacity = 0;
+  // 消费者读到的位置，和m_tail分开放在不同的缓存行
+  std::atomic<uint64_t> m_head = {0};
+  char m_pad0[64];
+  // 生产者写到的位置
+  std::atomic<uint64_t> m_tail = {0};
+  char m_pad1[64];
+  // 所属线程已经退出，写完后由后台线程释放
+  std::atomic<bool> m_orphaned = {false};
+};
+
+// 后台写日志的线程，全局一个
+class AsyncLogWriter {
+public:
+  // 缓冲区满时的处理：等待后台线程写出、直接丢弃、丢弃并计数(定期写一条丢弃了多少条的日志)
+  enum Overflow { BLOCK = 0, DROP = 1, DROP_COUNT = 2 };
+
+  AsyncLogWriter();
+  ~AsyncLogWriter();
+
+  static Overflow OverflowFromString(const std::string &v);
+  // 程序退出时单例可能先于appender析构，之后appender改为同步写
+  static bool IsAlive();
+  // 当前线程的缓冲区是否还在，线程局部变量析构之后返回false
+  static bool HasThreadRing();
+  static const char *ToString(Overflow v);
+
+  /**
+   * @func:
+   * @param {string} &path 为空时写标准输出
+   * @return {*}
+   * @description: 增加一个输出目的地，第一次调用时启动后台线程
+   */
+  LogSink *addSink(const std::string &path,
+                   const LogRotatePolicy &policy = LogRotatePolicy());
+  // appender释放时调用，已经放入缓冲区的记录写完后再关闭
+  void releaseSink(LogSink *sink);
+
+  /**
+   * @func:
+   * @return {*} 被丢弃时返回false
+   * @description: 把一条格式化好的日志放入当前线程的缓冲区
+   */
+  bool append(LogSink *sink, const char *data, std::size_t len,
+              Overflow overflow);
+
+  // 等待调用之前放入的日志全部写出
+  void flush();
+
+private:
+  LogRingBuffer *getThreadRing();
+  // 唤醒后台线程，已经唤醒还没开始写出时不重复post
+  void wakeup();
+  void run();
+  // 写出所有缓冲区中的记录，返回写出的条数
+  std::size_t drain();
+  std::size_t drainRing(LogRingBuffer *ring);
+  void writeGroup(LogSink *sink);
+
+private:
+  // 保护m_rings和m_sinks，只在注册和后台线程取快照时加锁
+  Mutex m_mutex;
+  std::vector<LogRingBuffer *> m_rings;
+  std::vector<LogSink *> m_sinks;
+  Thread::ptr m_thread;
+  Semaphore m_sem;
+  // 已经post过信号量，后台线程开始下一轮写出时清除
+  std::atomic<bool> m_notified = {false};
+  std::atomic<bool> m_stopping = {false};
+  // 已经完成的写出轮数，flush用来判断
+  std::atomic<uint64_t> m_passes = {0};
+  // 后台线程复用的iovec数组
+  std::vector<struct iovec> m_iov;
+  std::size_t m_bufferSize;
+  uint32_t m_flushInterval;
+};
+
+typedef Singleton<AsyncLogWriter> AsyncLogWriterMgr;
+
+// 异步输出的appender：调用线程只格式化并放入缓冲区，不做磁盘io
+class AsyncLogAppender : public LogAppender {
+public:
+  typedef std::shared_ptr<AsyncLogAppender> ptr;
+
+  // path为空时写标准输出
+  AsyncLogAppender(const std::string &path,
+                   AsyncLogWriter::Overflow overflow = AsyncLogWriter::BLOCK,
+                   const LogRotatePolicy &policy = LogRotatePolicy());
+  ~AsyncLogAppender();
+
+  void log(std::shared_ptr<Logger> logger, LogLevel::Level level,
+           LogEvent::ptr event) override;
+  std::string toYamlString() override;
+
+  uint64_t getDropped() const { return m_sink->getDropped(); }
+
+private:
+  std::string m_path;
+  AsyncLogWriter::Overflow m_overflow;
+  LogRotatePolicy m_policy;
+  LogSink *m_sink;
+};
+
+} // namespace sylar
+
+#endif
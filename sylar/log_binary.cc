@@ -0,0 +1,378 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 02:52:09
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 02:52:09
+ * @FilePath     : /sylar/log_binary.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 02:52:09
+ */
+#include "log_binary.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <yaml-cpp/yaml.h>
+#include <zlib.h>
+
+namespace sylar {
+
+// 文件太小时放不下字典记录，至少一页
+static const uint64_t MIN_FILE_SIZE = 4096;
+
+static LogRotatePolicy FixedPolicy(const LogRotatePolicy &policy) {
+  LogRotatePolicy rt = policy;
+  if (!rt.max_size) {
+    rt.max_size = BinaryLogAppender::DefaultPolicy().max_size;
+  }
+  rt.max_size = std::max(rt.max_size, MIN_FILE_SIZE);
+  return rt;
+}
+
+LogRotatePolicy BinaryLogAppender::DefaultPolicy() {
+  LogRotatePolicy policy;
+  policy.max_size = 64 * 1024 * 1024;
+  policy.max_files = 5;
+  return policy;
+}
+
+BinaryLogAppender::BinaryLogAppender(const std::string &path,
+                                     const LogRotatePolicy &policy)
+    : m_path(path), m_maxSize(FixedPolicy(policy).max_size),
+      m_rotator(path, FixedPolicy(policy)) {
+  openFile();
+}
+
+BinaryLogAppender::~BinaryLogAppender() { closeFile(); }
+
+bool BinaryLogAppender::openFile() {
+  m_lastOpen = time(0);
+  // 已有的内容(上次运行或者刚写满关闭的文件)改名轮转出去，只有一次rename，
+  // 压缩和清理多余的旧文件由LogCompressor在后台做；空文件不改名
+  m_rotator.opened(m_lastOpen);
+  if (!m_rotator.rotate(m_lastOpen)) {
+    // 改名失败时不能截断，隔一段时间再试
+    return false;
+  }
+
+  int fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+  // 未写的部分是0，进程崩溃后解析到size为0的记录就结束
+  // 用posix_fallocate真正分配磁盘块，ftruncate得到的是稀疏文件，
+  // 磁盘满时写mmap会收到SIGBUS；分配失败返回false，由log()隔几秒重试
+  if (posix_fallocate(fd, 0, m_maxSize) != 0) {
+    ::close(fd);
+    return false;
+  }
+  void *data =
+      mmap(nullptr, m_maxSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    ::close(fd);
+    return false;
+  }
+  m_fd = fd;
+  m_data = (char *)data;
+
+  BinaryLogFileHeader header;
+  memcpy(header.magic, BINARY_LOG_MAGIC, sizeof(header.magic));
+  header.version = BINARY_LOG_VERSION;
+  header.reserved = 0;
+  memcpy(m_data, &header, sizeof(header));
+  m_offset = sizeof(header);
+  return true;
+}
+
+void BinaryLogAppender::closeFile() {
+  if (m_data) {
+    munmap(m_data, m_maxSize);
+    m_data = nullptr;
+  }
+  if (m_fd >= 0) {
+    if (ftruncate(m_fd, m_offset) != 0) {
+      // 截断失败时文件尾部保留为0，不影响解析
+    }
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_offset = 0;
+  m_writtenFormatter.reset();
+  m_sites.clear();
+  m_strings.clear();
+  m_nextId = 1;
+}
+
+bool BinaryLogAppender::rotate() {
+  MutexType::Lock lock(m_mutex);
+  return rotateLocked();
+}
+
+bool BinaryLogAppender::rotateLocked() {
+  closeFile();
+  return openFile();
+}
+
+void BinaryLogAppender::writeRecord(uint16_t type, uint16_t level,
+                                    const void *body, std::size_t body_len,
+                                    const void *data, std::size_t data_len) {
+  BinaryLogRecordHeader header;
+  header.size = sizeof(header) + body_len + data_len;
+  header.type = type;
+  header.level = level;
+  char *p = m_data + m_offset;
+  memcpy(p, &header, sizeof(header));
+  memcpy(p + sizeof(header), body, body_len);
+  memcpy(p + sizeof(header) + body_len, data, data_len);
+  m_offset += header.size;
+}
+
+uint32_t BinaryLogAppender::addSite(const std::pair<const char *, uint32_t> &site) {
+  uint32_t body[2] = {m_nextId++, site.second};
+  writeRecord(BinaryLogRecordHeader::SITE, 0, body, sizeof(body), site.first,
+              strlen(site.first));
+  m_sites[site] = body[0];
+  return body[0];
+}
+
+uint32_t BinaryLogAppender::addString(const std::string &str) {
+  uint32_t id = m_nextId++;
+  writeRecord(BinaryLogRecordHeader::STRING, 0, &id, sizeof(id), str.data(),
+              str.size());
+  m_strings[str] = id;
+  return id;
+}
+
+void BinaryLogAppender::log(std::shared_ptr<Logger> logger,
+                            LogLevel::Level level, LogEvent::ptr event) {
+  if (m_level > level) {
+    return;
+  }
+  MutexType::Lock lock(m_mutex);
+  if (!m_data && ((uint64_t)time(0) < m_lastOpen + 3 || !openFile())) {
+    return;
+  }
+  // 不调用m_rotator.written，needRotate只按时间判断，写满在下面按m_offset判断
+  if (m_rotator.needRotate(event->getTime(), 0) && !rotateLocked()) {
+    return;
+  }
+
+  std::string tmp;
+  std::string *msg = LogFormatter::GetThreadBuffer();
+  if (!msg) {
+    msg = &tmp;
+  }
+  event->appendContent(*msg);
+  std::pair<const char *, uint32_t> site(event->getFile(), event->getLine());
+  Logger::ptr owner = event->getLogger();
+  const std::string &logger_name = owner->getName();
+  const std::string &thread_name = event->getThreadName();
+
+  // 每个字典只查一次，0表示还没写进当前文件
+  uint32_t site_id = 0;
+  uint32_t logger_id = 0;
+  uint32_t thread_id = 0;
+  auto sit = m_sites.find(site);
+  if (sit != m_sites.end()) {
+    site_id = sit->second;
+  }
+  auto lit = m_strings.find(logger_name);
+  if (lit != m_strings.end()) {
+    logger_id = lit->second;
+  }
+  auto tit = m_strings.find(thread_name);
+  if (tit != m_strings.end()) {
+    thread_id = tit->second;
+  }
+  bool need_pattern = m_formatter && m_formatter != m_writtenFormatter;
+
+  const std::size_t head = sizeof(BinaryLogRecordHeader);
+  std::size_t size = head + sizeof(BinaryLogEventBody) + msg->size();
+  // 字典记录的大小，只在第一次出现和轮转后需要
+  std::size_t dict = 0;
+  if (!site_id) {
+    dict += head + 8 + strlen(site.first);
+  }
+  if (!logger_id) {
+    dict += head + 4 + logger_name.size();
+  }
+  if (!thread_id && thread_name != logger_name) {
+    dict += head + 4 + thread_name.size();
+  }
+  if (need_pattern) {
+    dict += head + m_formatter->getPattern().size();
+  }
+  if (m_offset + size + dict > m_maxSize) {
+    if (!rotateLocked()) {
+      return;
+    }
+    site_id = logger_id = thread_id = 0;
+    need_pattern = !!m_formatter;
+    dict = head + 8 + strlen(site.first) + head + 4 + logger_name.size();
+    if (thread_name != logger_name) {
+      dict += head + 4 + thread_name.size();
+    }
+    if (need_pattern) {
+      dict += head + m_formatter->getPattern().size();
+    }
+    // 一个空文件都放不下时截断内容
+    if (m_offset + size + dict > m_maxSize) {
+      std::size_t over = m_offset + size + dict - m_maxSize;
+      if (over > msg->size()) {
+        return;
+      }
+      msg->resize(msg->size() - over);
+    }
+  }
+
+  if (need_pattern) {
+    std::string pattern = m_formatter->getPattern();
+    writeRecord(BinaryLogRecordHeader::PATTERN, 0, pattern.data(),
+                pattern.size(), "", 0);
+    m_writtenFormatter = m_formatter;
+  }
+  if (!site_id) {
+    site_id = addSite(site);
+  }
+  if (!logger_id) {
+    logger_id = addString(logger_name);
+  }
+  if (!thread_id) {
+    thread_id = thread_name == logger_name ? logger_id : addString(thread_name);
+  }
+  BinaryLogEventBody body;
+  body.time = event->getTime();
+  body.elapse = event->getElapse();
+  body.threadId = event->getThreadId();
+  body.fiberId = event->getFiberId();
+  body.site = site_id;
+  body.logger = logger_id;
+  body.threadName = thread_id;
+  writeRecord(BinaryLogRecordHeader::EVENT, level, &body, sizeof(body),
+              msg->data(), msg->size());
+}
+
+std::string BinaryLogAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "BinaryLogAppender";
+  node["path"] = m_path;
+  m_rotator.getPolicy().dump(node);
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::ToString(m_level);
+  }
+  if (has_formatter && m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+bool BinaryLogReader::open(const std::string &path) {
+  // 不是gzip格式的文件gzread按原样读出
+  gzFile gz = gzopen(path.c_str(), "rb");
+  if (!gz) {
+    return false;
+  }
+  m_content.clear();
+  char buf[64 * 1024];
+  int n;
+  while ((n = gzread(gz, buf, sizeof(buf))) > 0) {
+    m_content.append(buf, n);
+  }
+  gzclose(gz);
+  if (n < 0) {
+    return false;
+  }
+
+  BinaryLogFileHeader header;
+  if (m_content.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, m_content.data(), sizeof(header));
+  if (memcmp(header.magic, BINARY_LOG_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != BINARY_LOG_VERSION) {
+    return false;
+  }
+  m_pos = sizeof(header);
+  m_pattern.clear();
+  m_formatter = Logger().getFormatter();
+  m_strings.clear();
+  m_sites.clear();
+  m_loggers.clear();
+  return true;
+}
+
+bool BinaryLogReader::next(std::string &out, LogFormatter::ptr fmt) {
+  while (m_pos + sizeof(BinaryLogRecordHeader) <= m_content.size()) {
+    BinaryLogRecordHeader header;
+    const char *p = m_content.data() + m_pos;
+    memcpy(&header, p, sizeof(header));
+    if (header.size < sizeof(header) ||
+        m_pos + header.size > m_content.size()) {
+      // size为0是没写完的文件尾部，其他情况是文件损坏
+      return false;
+    }
+    m_pos += header.size;
+    const char *data = p + sizeof(header);
+    std::size_t len = header.size - sizeof(header);
+
+    switch (header.type) {
+    case BinaryLogRecordHeader::PATTERN:
+      m_pattern.assign(data, len);
+      m_formatter.reset(new LogFormatter(m_pattern));
+      break;
+    case BinaryLogRecordHeader::STRING: {
+      uint32_t id;
+      if (len < sizeof(id)) {
+        return false;
+      }
+      memcpy(&id, data, sizeof(id));
+      m_strings[id].assign(data + sizeof(id), len - sizeof(id));
+      break;
+    }
+    case BinaryLogRecordHeader::SITE: {
+      uint32_t body[2];
+      if (len < sizeof(body)) {
+        return false;
+      }
+      memcpy(body, data, sizeof(body));
+      Site &site = m_sites[body[0]];
+      site.line = body[1];
+      site.file.assign(data + sizeof(body), len - sizeof(body));
+      break;
+    }
+    case BinaryLogRecordHeader::EVENT: {
+      BinaryLogEventBody body;
+      if (len < sizeof(body)) {
+        return false;
+      }
+      memcpy(&body, data, sizeof(body));
+      Logger::ptr &logger = m_loggers[body.logger];
+      if (!logger) {
+        logger.reset(new Logger(m_strings[body.logger]));
+      }
+      Site &site = m_sites[body.site];
+      LogLevel::Level level = (LogLevel::Level)header.level;
+      LogEvent::ptr event(new LogEvent(
+          logger, level, site.file.c_str(), site.line, body.elapse,
+          body.threadId, body.fiberId, body.time, m_strings[body.threadName]));
+      event->getSS().write(data + sizeof(body), len - sizeof(body));
+      (fmt ? fmt : m_formatter)->format(out, logger, level, event);
+      return true;
+    }
+    default:
+      // 新版本增加的记录类型，跳过
+      break;
+    }
+  }
+  return false;
+}
+
+} // namespace sylar
@@ -0,0 +1,154 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 02:52:09
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 02:52:09
+ * @FilePath     : /sylar/log_binary.h
+ * @Description  : 二进制日志：写入时不做文本格式化，离线用BinaryLogReader还原成文本
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 02:52:09
+ */
+#ifndef __SYLAR_LOG_BINARY_H__
+#define __SYLAR_LOG_BINARY_H__
+
+#include "sylar/log.h"
+#include "sylar/log_rotate.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace sylar {
+
+/*
+ * 文件格式(本机字节序)：
+ *   文件头 BinaryLogFileHeader
+ *   若干条记录，每条以BinaryLogRecordHeader开头，size为整条记录的字节数；size为0表示结束
+ *     PATTERN: 写入时appender使用的日志格式
+ *     STRING:  uint32 id + 字符串，logger名和线程名
+ *     SITE:    uint32 id + uint32 行号 + 文件名，相当于格式串的id
+ *     EVENT:   BinaryLogEventBody + 日志内容
+ * 同一个文件中字典记录总在引用它的EVENT之前，每个文件可以单独解析
+ */
+static const char BINARY_LOG_MAGIC[8] = {'S', 'Y', 'L', 'A', 'R', 'B', 'L', 'G'};
+static const uint32_t BINARY_LOG_VERSION = 1;
+
+struct BinaryLogFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct BinaryLogRecordHeader {
+  enum Type { PATTERN = 1, STRING = 2, SITE = 3, EVENT = 4 };
+  uint32_t size;
+  uint16_t type;
+  uint16_t level;
+};
+
+struct BinaryLogEventBody {
+  uint64_t time;
+  uint32_t elapse;
+  uint32_t threadId;
+  uint32_t fiberId;
+  uint32_t site;
+  uint32_t logger;
+  uint32_t threadName;
+};
+
+// 写入mmap的文件，写满policy.max_size或者到了轮转时间后轮转；
+// 和FileAppender一样由LogRotator改名为path.YYYYMMDD-HHMMSS，压缩和清理旧文件在后台线程
+// 每个文件都从文件头开始，打开时path已有内容的话先轮转出去
+class BinaryLogAppender : public LogAppender {
+public:
+  typedef std::shared_ptr<BinaryLogAppender> ptr;
+
+  // policy.max_size为0时使用默认的文件大小
+  BinaryLogAppender(const std::string &path,
+                    const LogRotatePolicy &policy = DefaultPolicy());
+  ~BinaryLogAppender();
+
+  // 64MB一个文件，保留5个旧文件
+  static LogRotatePolicy DefaultPolicy();
+
+  void log(std::shared_ptr<Logger> logger, LogLevel::Level level,
+           LogEvent::ptr event) override;
+  std::string toYamlString() override;
+
+  // 关闭当前文件并开始一个新文件
+  bool rotate();
+
+private:
+  // 已经持有m_mutex时轮转
+  bool rotateLocked();
+  bool openFile();
+  // 截掉未使用的部分后关闭
+  void closeFile();
+  // 写一条记录，调用前已经确认空间足够
+  void writeRecord(uint16_t type, uint16_t level, const void *body,
+                   std::size_t body_len, const void *data,
+                   std::size_t data_len);
+  // 写入字典记录，返回分配的id，调用前已经确认空间足够
+  uint32_t addSite(const std::pair<const char *, uint32_t> &site);
+  uint32_t addString(const std::string &str);
+
+private:
+  std::string m_path;
+  // mmap的文件大小
+  uint64_t m_maxSize;
+  // 只用来改名和按时间轮转，写满由m_offset判断
+  LogRotator m_rotator;
+  int m_fd = -1;
+  char *m_data = nullptr;
+  uint64_t m_offset = 0;
+  // 上次尝试打开文件的时间(秒)，打开失败时隔一段时间再试
+  uint64_t m_lastOpen = 0;
+  // 以下字典只对当前文件有效，轮转时清空
+  // 已经写入当前文件的格式
+  LogFormatter::ptr m_writtenFormatter;
+  std::map<std::pair<const char *, uint32_t>, uint32_t> m_sites;
+  std::unordered_map<std::string, uint32_t> m_strings;
+  uint32_t m_nextId = 1;
+};
+
+// 读取二进制日志文件，按日志格式还原成文本
+class BinaryLogReader {
+public:
+  /**
+   * @func:
+   * @return {*} 文件不存在或者不是二进制日志时返回false
+   * @description: 读入整个文件，轮转后压缩成.gz的文件也可以直接读
+   */
+  bool open(const std::string &path);
+
+  /**
+   * @func:
+   * @param {ptr} fmt 为空时使用文件中记录的格式
+   * @return {*} 没有更多日志或者文件损坏时返回false
+   * @description: 读出下一条日志，格式化后追加到out
+   */
+  bool next(std::string &out, LogFormatter::ptr fmt = nullptr);
+
+  // 最近读到的写入时的日志格式
+  const std::string &getPattern() const { return m_pattern; }
+
+private:
+  struct Site {
+    uint32_t line;
+    std::string file;
+  };
+
+  std::string m_content;
+  std::size_t m_pos = 0;
+  std::string m_pattern;
+  LogFormatter::ptr m_formatter;
+  std::map<uint32_t, std::string> m_strings;
+  std::map<uint32_t, Site> m_sites;
+  std::map<uint32_t, Logger::ptr> m_loggers;
+};
+
+} // namespace sylar
+
+#endif
@@ -0,0 +1,329 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 04:02:37
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 04:02:37
+ * @FilePath     : /sylar/log_rotate.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 04:02:37
+ */
+#include "log_rotate.h"
+#include "sylar/util.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+#include <zlib.h>
+
+namespace sylar {
+
+uint32_t LogRotatePolicy::IntervalFromString(const std::string &v) {
+  if (v == "hourly") {
+    return 3600;
+  }
+  if (v == "daily") {
+    return 86400;
+  }
+  return strtoul(v.c_str(), nullptr, 10);
+}
+
+void LogRotatePolicy::dump(YAML::Node &node) const {
+  if (!enabled()) {
+    return;
+  }
+  if (max_size) {
+    node["max_size"] = max_size;
+  }
+  if (interval) {
+    node["rotate_interval"] = interval;
+  }
+  if (max_files) {
+    node["max_files"] = max_files;
+  }
+  if (compress) {
+    node["compress"] = true;
+  }
+}
+
+LogRotator::LogRotator(const std::string &path, const LogRotatePolicy &policy)
+    : m_path(path), m_policy(policy) {}
+
+uint64_t LogRotator::nextTime(uint64_t now) const {
+  if (!m_policy.interval) {
+    return 0;
+  }
+  struct tm tm;
+  time_t t = now;
+  localtime_r(&t, &tm);
+  // 按本地时间对齐，按天轮转时在零点而不是UTC零点
+  int64_t offset = tm.tm_gmtoff;
+  uint64_t local = now + offset;
+  return (local / m_policy.interval + 1) * m_policy.interval - offset;
+}
+
+void LogRotator::opened(uint64_t now) {
+  struct stat st;
+  if (stat(m_path.c_str(), &st) == 0) {
+    m_size = st.st_size;
+  } else {
+    m_size = 0;
+  }
+  if (m_policy.interval && !m_nextTime) {
+    // 重启前留下的文件按修改时间算，已经跨过轮转点的第一次写入时就轮转
+    uint64_t base = m_size ? std::min<uint64_t>(st.st_mtime, now) : now;
+    m_nextTime = nextTime(base);
+  }
+}
+
+bool LogRotator::rotate(uint64_t now) {
+  if (m_policy.interval) {
+    m_nextTime = nextTime(now);
+  }
+  if (!m_size) {
+    return true;
+  }
+  struct tm tm;
+  time_t t = now;
+  localtime_r(&t, &tm);
+  char buf[32];
+  strftime(buf, sizeof(buf), "%Y%m%d-%H%M%S", &tm);
+  std::string stem = m_path + "." + buf;
+  // 同一秒内多次按大小轮转时加递增的序号，
+  // 不能只看文件是否存在，前面的可能已经被清理掉，重用会排到最旧的位置
+  uint32_t seq = stem == m_lastStem ? m_lastSeq + 1 : 0;
+  std::string target;
+  while (true) {
+    target = stem;
+    if (seq) {
+      snprintf(buf, sizeof(buf), ".%03u", seq);
+      target += buf;
+    }
+    if (access(target.c_str(), F_OK) != 0 &&
+        access((target + ".gz").c_str(), F_OK) != 0) {
+      break;
+    }
+    ++seq;
+  }
+  if (rename(m_path.c_str(), target.c_str()) != 0) {
+    m_retryTime = now + 3;
+    return false;
+  }
+  m_retryTime = 0;
+  m_lastStem = stem;
+  m_lastSeq = seq;
+  m_size = 0;
+  if ((m_policy.compress || m_policy.max_files) && LogCompressor::IsAlive()) {
+    LogCompressorMgr::getInstance()->add(target, m_path, m_policy);
+  }
+  return true;
+}
+
+// 只在单例析构时设置，析构之后仍然可以读
+static bool s_compressor_dead = false;
+
+LogCompressor::LogCompressor() {}
+
+LogCompressor::~LogCompressor() {
+  {
+    Mutex::Lock lock(m_mutex);
+    m_stopping = true;
+  }
+  // 后台线程处理完已经加入的文件再退出
+  if (m_thread) {
+    m_sem.notify();
+    m_thread->join();
+  }
+  s_compressor_dead = true;
+}
+
+bool LogCompressor::IsAlive() { return !s_compressor_dead; }
+
+void LogCompressor::add(const std::string &file, const std::string &path,
+                        const LogRotatePolicy &policy) {
+  Task task;
+  task.file = file;
+  task.path = path;
+  task.policy = policy;
+  Mutex::Lock lock(m_mutex);
+  m_tasks.push_back(task);
+  ++m_added;
+  if (!m_thread) {
+    m_thread.reset(
+        new Thread(std::bind(&LogCompressor::run, this), "log_rotate"));
+  }
+  m_sem.notify();
+}
+
+void LogCompressor::flush() {
+  uint64_t target;
+  {
+    Mutex::Lock lock(m_mutex);
+    target = m_added;
+  }
+  while (true) {
+    {
+      Mutex::Lock lock(m_mutex);
+      if (m_done >= target) {
+        return;
+      }
+    }
+    usleep(1000);
+  }
+}
+
+void LogCompressor::run() {
+  // 压缩很占CPU，降低优先级，不和处理请求的线程抢
+  setpriority(PRIO_PROCESS, getThreadId(), 10);
+  while (true) {
+    Task task;
+    bool has_task = false;
+    {
+      Mutex::Lock lock(m_mutex);
+      if (!m_tasks.empty()) {
+        task = m_tasks.front();
+        m_tasks.pop_front();
+        has_task = true;
+      } else if (m_stopping) {
+        break;
+      }
+    }
+    if (!has_task) {
+      m_sem.wait();
+      continue;
+    }
+    if (task.policy.compress) {
+      Compress(task.file);
+    }
+    if (task.policy.max_files) {
+      Prune(task.path, task.policy.max_files);
+    }
+    Mutex::Lock lock(m_mutex);
+    ++m_done;
+  }
+}
+
+bool LogCompressor::Compress(const std::string &file) {
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  // 先写临时文件，写完再改名，不会留下不完整的.gz
+  std::string tmp = file + ".gz.tmp";
+  gzFile gz = gzopen(tmp.c_str(), "wb");
+  if (!gz) {
+    ::close(fd);
+    return false;
+  }
+  std::vector<char> buf(64 * 1024);
+  bool ok = true;
+  while (true) {
+    ssize_t n = ::read(fd, &buf[0], buf.size());
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ok = false;
+      break;
+    }
+    if (n == 0) {
+      break;
+    }
+    if (gzwrite(gz, &buf[0], n) != n) {
+      ok = false;
+      break;
+    }
+  }
+  ::close(fd);
+  if (gzclose(gz) != Z_OK) {
+    ok = false;
+  }
+  if (!ok || rename(tmp.c_str(), (file + ".gz").c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  unlink(file.c_str());
+  return true;
+}
+
+// 轮转生成的后缀：YYYYMMDD-HHMMSS，可能带.NNN序号和.gz
+static bool IsRotatedSuffix(const std::string &v) {
+  if (v.size() < 15 || v[8] != '-') {
+    return false;
+  }
+  for (std::size_t i = 0; i < 15; ++i) {
+    if (i != 8 && !isdigit((unsigned char)v[i])) {
+      return false;
+    }
+  }
+  std::string rest = v.substr(15);
+  if (rest.size() >= 3 && rest.compare(rest.size() - 3, 3, ".gz") == 0) {
+    rest.resize(rest.size() - 3);
+  }
+  if (rest.empty()) {
+    return true;
+  }
+  if (rest.size() < 2 || rest[0] != '.') {
+    return false;
+  }
+  for (std::size_t i = 1; i < rest.size(); ++i) {
+    if (!isdigit((unsigned char)rest[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 排序时去掉.gz，压缩前后的同一个文件位置不变
+static std::string SortKey(const std::string &name) {
+  if (name.size() >= 3 && name.compare(name.size() - 3, 3, ".gz") == 0) {
+    return name.substr(0, name.size() - 3);
+  }
+  return name;
+}
+
+void LogCompressor::Prune(const std::string &path, uint32_t max_files) {
+  std::string dir = ".";
+  std::string base = path;
+  std::size_t pos = path.rfind('/');
+  if (pos != std::string::npos) {
+    dir = pos ? path.substr(0, pos) : "/";
+    base = path.substr(pos + 1);
+  }
+  DIR *d = opendir(dir.c_str());
+  if (!d) {
+    return;
+  }
+  std::string prefix = base + ".";
+  std::vector<std::string> files;
+  struct dirent *ent;
+  while ((ent = readdir(d)) != nullptr) {
+    std::string name = ent->d_name;
+    if (name.compare(0, prefix.size(), prefix) == 0 &&
+        IsRotatedSuffix(name.substr(prefix.size()))) {
+      files.push_back(name);
+    }
+  }
+  closedir(d);
+  if (files.size() <= max_files) {
+    return;
+  }
+  std::sort(files.begin(), files.end(),
+            [](const std::string &a, const std::string &b) {
+              return SortKey(a) < SortKey(b);
+            });
+  for (std::size_t i = 0; i < files.size() - max_files; ++i) {
+    unlink((dir + "/" + files[i]).c_str());
+  }
+}
+
+} // namespace sylar
@@ -0,0 +1,152 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 04:02:37
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 04:02:37
+ * @FilePath     : /sylar/log_rotate.h
+ * @Description  : 日志文件按大小和时间轮转，旧文件由后台线程压缩和清理
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 04:02:37
+ */
+#ifndef __SYLAR_LOG_ROTATE_H__
+#define __SYLAR_LOG_ROTATE_H__
+
+#include "sylar/mutex.h"
+#include "sylar/singleton.h"
+#include "sylar/thread.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+
+namespace YAML {
+class Node;
+}
+
+namespace sylar {
+
+// 轮转策略，max_size和interval都为0时不轮转
+struct LogRotatePolicy {
+  // 单个文件的最大字节数
+  uint64_t max_size = 0;
+  // 轮转间隔(秒)，按本地时间对齐，86400就是每天零点
+  uint32_t interval = 0;
+  // 保留的旧文件个数，0表示不清理
+  uint32_t max_files = 0;
+  // 旧文件是否压缩成.gz
+  bool compress = false;
+
+  bool enabled() const { return max_size || interval; }
+
+  // "hourly"、"daily"或者秒数
+  static uint32_t IntervalFromString(const std::string &v);
+  // 写入appender的yaml配置，不轮转时不写
+  void dump(YAML::Node &node) const;
+
+  bool operator==(const LogRotatePolicy &oth) const {
+    return max_size == oth.max_size && interval == oth.interval &&
+           max_files == oth.max_files && compress == oth.compress;
+  }
+};
+
+/*
+ * 记录当前文件的大小和下次轮转的时间，由持有文件的appender在锁内调用
+ * 轮转时当前文件改名为 path.YYYYMMDD-HHMMSS，rename是原子的，写入方随后重新打开path；
+ * 压缩和删除多余的旧文件交给LogCompressor的后台线程
+ */
+class LogRotator {
+public:
+  LogRotator(const std::string &path,
+             const LogRotatePolicy &policy = LogRotatePolicy());
+
+  const LogRotatePolicy &getPolicy() const { return m_policy; }
+
+  // 打开文件之后调用，从文件中同步当前大小
+  void opened(uint64_t now);
+
+  // 再写入len字节之前是否需要轮转，上次改名失败后的几秒内不再尝试
+  bool needRotate(uint64_t now, std::size_t len) const {
+    if (now < m_retryTime) {
+      return false;
+    }
+    return (m_policy.max_size && m_size && m_size + len > m_policy.max_size) ||
+           (m_nextTime && now >= m_nextTime);
+  }
+  void written(std::size_t len) { m_size += len; }
+
+  /**
+   * @func:
+   * @return {*} 改名失败时返回false，继续写原来的文件，3秒后needRotate才会再返回true
+   * @description: 调用前关闭文件，调用后重新打开path；空文件只推迟下次轮转的时间
+   */
+  bool rotate(uint64_t now);
+
+private:
+  // now之后的下一个轮转时间点
+  uint64_t nextTime(uint64_t now) const;
+
+private:
+  std::string m_path;
+  LogRotatePolicy m_policy;
+  uint64_t m_size = 0;
+  // 0表示不按时间轮转
+  uint64_t m_nextTime = 0;
+  // 上次轮转的文件名(不含序号)和序号
+  std::string m_lastStem;
+  uint32_t m_lastSeq = 0;
+  // 改名失败后在这个时间之前不再轮转，避免每写一行都关闭、改名、重新打开
+  uint64_t m_retryTime = 0;
+};
+
+// 压缩和清理轮转出来的旧文件的后台线程，全局一个
+class LogCompressor {
+public:
+  LogCompressor();
+  ~LogCompressor();
+
+  // 程序退出时单例可能先于appender析构，之后轮转出来的文件不再处理
+  static bool IsAlive();
+
+  /**
+   * @func:
+   * @param {string} &file 轮转出来的文件
+   * @param {string} &path 日志文件的路径，清理时找path.*的旧文件
+   * @return {*}
+   * @description: 第一次调用时启动后台线程
+   */
+  void add(const std::string &file, const std::string &path,
+           const LogRotatePolicy &policy);
+
+  // 等待调用之前加入的文件处理完
+  void flush();
+
+  // 压缩成file.gz后删除file
+  static bool Compress(const std::string &file);
+  // 只保留最新的max_files个path.*旧文件
+  static void Prune(const std::string &path, uint32_t max_files);
+
+private:
+  struct Task {
+    std::string file;
+    std::string path;
+    LogRotatePolicy policy;
+  };
+
+  void run();
+
+private:
+  Mutex m_mutex;
+  std::list<Task> m_tasks;
+  Thread::ptr m_thread;
+  Semaphore m_sem;
+  bool m_stopping = false;
+  // 加入和处理完的文件数，flush用来判断
+  uint64_t m_added = 0;
+  uint64_t m_done = 0;
+};
+
+typedef Singleton<LogCompressor> LogCompressorMgr;
+
+} // namespace sylar
+
+#endif
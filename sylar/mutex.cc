@@ -11,6 +11,8 @@
 
 #include "mutex.h"
 #include <atomic>
+#include <cerrno>
+#include <ctime>
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdexcept>
@@ -32,6 +34,42 @@ void Semaphore::wait() {
   }
 }
 
+// glibc 2.30开始有sem_clockwait，可以按单调时钟等待，修改系统时间不影响超时
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+#define SYLAR_SEM_CLOCKWAIT 1
+#else
+#define SYLAR_SEM_CLOCKWAIT 0
+#endif
+
+bool Semaphore::waitFor(uint64_t ms) {
+  struct timespec ts;
+#if SYLAR_SEM_CLOCKWAIT
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+  clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+  ts.tv_sec += ms / 1000;
+  ts.tv_nsec += (ms % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ++ts.tv_sec;
+    ts.tv_nsec -= 1000000000;
+  }
+#if SYLAR_SEM_CLOCKWAIT
+  while (sem_clockwait(&m_sem, CLOCK_MONOTONIC, &ts)) {
+#else
+  while (sem_timedwait(&m_sem, &ts)) {
+#endif
+    if (errno == ETIMEDOUT) {
+      return false;
+    }
+    if (errno != EINTR) {
+      throw std::logic_error("sem_timedwait error");
+    }
+  }
+  return true;
+}
+
 void Semaphore::notify() {
   if (sem_post(&m_sem)) {
     throw std::logic_error("sem_post error");
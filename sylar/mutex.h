@@ -34,6 +34,8 @@ public:
   ~Semaphore();
 
   void wait();
+  // 最多等待ms毫秒，超时返回false；glibc支持时按单调时钟计时
+  bool waitFor(uint64_t ms);
   void notify();
 private:
   sem_t m_sem;
@@ -10,6 +10,7 @@
  */
 
 #include "scheduler.h"
+#include "sylar/config.h"
 #include "sylar/fiber.h"
 #include "sylar/hook.h"
 #include "sylar/marco.h"
@@ -27,6 +28,18 @@ static Logger::ptr g_logger = SYLAR_LOG_ROOT();
 static thread_local Scheduler *t_scheduler = nullptr;
 // 当前运行的协程的线程主协程，用来在创建子协程时获得返回主协程
 static thread_local Fiber *t_scheduler_fiber = nullptr;
+// 当前线程在调度器中的本地队列下标
+static thread_local int t_worker_index = -1;
+
+static ConfigVar<bool>::ptr g_scheduler_work_stealing =
+    Config::Lookup<bool>("scheduler.work_stealing", false,
+                         "scheduler per-thread queues with work stealing");
+static ConfigVar<bool>::ptr g_scheduler_shared_stack =
+    Config::Lookup<bool>("scheduler.shared_stack", false,
+                         "scheduler run callbacks on per-thread shared stack");
+static ConfigVar<uint32_t>::ptr g_scheduler_fiber_pool_max_cached =
+    Config::Lookup<uint32_t>("scheduler.fiber_pool.max_cached", 64,
+                             "scheduler per-thread recycled fiber count");
 /**
  * @func:
  * @return {*}
@@ -58,6 +71,24 @@ Scheduler::Scheduler(std::size_t threads, bool use_caller,
     m_rootThread = -1;
   }
   m_threadCount = threads;
+
+  m_workStealing = g_scheduler_work_stealing->getValue();
+  m_sharedStack = g_scheduler_shared_stack->getValue();
+  m_fiberPoolMax = g_scheduler_fiber_pool_max_cached->getValue();
+#if !SYLAR_ASM_CONTEXT
+  if (m_sharedStack) {
+    SYLAR_LOG_WARN(g_logger) << "shared stack needs SYLAR_FIBER_ASM, use private stacks";
+    m_sharedStack = false;
+  }
+#endif
+  m_workerQueues.resize(m_threadCount + (use_caller ? 1 : 0));
+  for (std::size_t i = 0; i < m_workerQueues.size(); ++i) {
+    m_workerQueues[i] = new WorkerQueue;
+    m_workerQueues[i]->index = i;
+  }
+  if (use_caller) {
+    m_workerQueues[0]->threadId = m_rootThread;
+  }
 }
 
 Scheduler::~Scheduler() {
@@ -65,6 +96,11 @@ Scheduler::~Scheduler() {
   if (GetThis() == this) {
     t_scheduler = nullptr;
   }
+  for (auto q : m_workerQueues) {
+    delete q;
+  }
+  std::list<FiberAndThread> rest;
+  appendSubmitted(takeSubmitted(), rest);
   SYLAR_LOG_INFO(g_logger) << "finish";
 }
 
@@ -83,10 +119,13 @@ void Scheduler::start() {
   // 初始化线程池
   m_stopping = false;
   m_threads.resize(m_threadCount);
+  std::size_t offset = m_rootThread == -1 ? 0 : 1;
   for (size_t i = 0; i < m_threadCount; ++i) {
     m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this),
                                   "thread_" + std::to_string(i)));
     m_threadIds.push_back(m_threads[i]->getId());
+    // 线程在run中持有m_mutex查找自己的队列，此时已经登记完毕
+    m_workerQueues[offset + i]->threadId = m_threads[i]->getId();
   }
   lock.unlock();
 }
@@ -156,6 +195,21 @@ void Scheduler::run() {
     t_scheduler_fiber = Fiber::GetThis().get();
   }
 
+  // 找到本线程的队列
+  WorkerQueue *self = nullptr;
+  {
+    MutexType::Lock lock(m_mutex);
+    for (std::size_t i = 0; i < m_workerQueues.size(); ++i) {
+      if (m_workerQueues[i]->threadId == sylar::getThreadId()) {
+        self = m_workerQueues[i];
+        t_worker_index = i;
+        break;
+      }
+    }
+    SYLAR_ASSERT(self);
+  }
+  WorkerQueue *local = m_workStealing ? self : nullptr;
+
   Fiber::ptr cb_fiber;
   // 初始化协程
   Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
@@ -163,22 +217,43 @@ void Scheduler::run() {
 
   while (true) {
     ft.reset();
+    beforeTask();
 
     bool need_tickle = false;
     bool is_active = false;
 
+    // 优先运行指定本线程的任务，其次是本地队列中的任务
+    if (popLocal(self, self->pinned, ft) ||
+        (local && popLocal(local, local->tasks, ft))) {
+      is_active = true;
+    }
+
+    // work stealing模式下取走提交的任务放入本地队列，任务多于一个时唤醒其他线程来窃取
+    // 取出和放入都在本地队列的锁内，stopping()不会看到两边都为空
+    if (!is_active && local &&
+        m_submitted.load(std::memory_order_relaxed)) {
+      std::size_t count = 0;
+      {
+        WorkerQueue::MutexType::Lock lock(local->mutex);
+        count = appendSubmitted(takeSubmitted(), local->tasks);
+        local->updateSize();
+      }
+      need_tickle |= count > 1;
+      if (popLocal(local, local->tasks, ft)) {
+        is_active = true;
+      }
+    }
+
     // 确保作用域，防止死锁
-    {
+    if (!is_active) {
       MutexType::Lock lock(m_mutex);
+      if (!local) {
+        appendSubmitted(takeSubmitted(), m_fibers);
+      }
       auto it = m_fibers.begin();
       // 在任务队列中获得任务
+      // 指定线程的任务不会进入全局队列
       while (it != m_fibers.end()) {
-        if (it->m_threadId != -1 && it->m_threadId != sylar::getThreadId()) {
-          ++it;
-          need_tickle = true;
-          continue;
-        }
-
         SYLAR_ASSERT(it->m_cb || it->m_fiber);
         if (it->m_fiber && it->m_fiber->getState() == Fiber::EXEC) {
           ++it;
@@ -191,7 +266,13 @@ void Scheduler::run() {
         is_active = true;
         break;
       }
-      need_tickle |= it != m_fibers.end();      
+      need_tickle |= it != m_fibers.end();
+      m_fibersSize.store(m_fibers.size(), std::memory_order_relaxed);
+    }
+
+    // 本地和全局队列都没有任务时从其他线程窃取
+    if (!is_active && local && steal(local, ft)) {
+      is_active = true;
     }
 
     if (need_tickle) {
@@ -200,28 +281,30 @@ void Scheduler::run() {
 
     if (ft.m_fiber && (ft.m_fiber->getState() != Fiber::TERM &&
                        ft.m_fiber->getState() != Fiber::EXCEPT)) {
-      SYLAR_LOG_INFO(g_logger) << "task fiber get";
+      SYLAR_LOG_DEBUG(g_logger) << "task fiber get";
       ft.m_fiber->swapIn();
-      SYLAR_LOG_INFO(g_logger) << "task fiber finish";
-      --m_activeThreadCount;
+      SYLAR_LOG_DEBUG(g_logger) << "task fiber finish";
 
+      // 让出的协程放回队列之后才减少活跃线程数，否则中间stopping()会看到没有任务
       if (ft.m_fiber->getState() == Fiber::READY) {
-        schedule(ft.m_fiber);
+        schedule(ft.m_fiber, ft.m_threadId);
       } else if (ft.m_fiber->getState() != Fiber::TERM &&
                  ft.m_fiber->getState() != Fiber::EXCEPT) {
         ft.m_fiber->m_state = Fiber::HOLD;
+      } else {
+        recycleFiber(self, ft.m_fiber);
       }
+      --m_activeThreadCount;
       ft.reset();
 
     } else if (ft.m_cb) {
       if (cb_fiber) {
         cb_fiber->reset(ft.m_cb);
       } else {
-        cb_fiber.reset(new Fiber(ft.m_cb));
+        cb_fiber = acquireFiber(self, ft.m_cb);
       }
       ft.reset();
       cb_fiber->swapIn();
-      --m_activeThreadCount;
 
       if (cb_fiber->getState() == Fiber::READY) {
         schedule(cb_fiber);
@@ -233,6 +316,7 @@ void Scheduler::run() {
         cb_fiber->m_state = Fiber::HOLD;
         cb_fiber.reset();
       }
+      --m_activeThreadCount;
 
     } else {
 
@@ -243,6 +327,9 @@ void Scheduler::run() {
 
       if (idle_fiber->getState() == Fiber::TERM) {
         SYLAR_LOG_INFO(g_logger) << "idle fiber term";
+        m_fiberPoolSize -= self->fiberPool.size();
+        self->fiberPool.clear();
+        t_worker_index = -1;
         break;
       }
 
@@ -259,6 +346,254 @@ void Scheduler::run() {
   }
 }
 
+int Scheduler::getWorkerIndex() const {
+  return t_scheduler == this ? t_worker_index : -1;
+}
+
+Scheduler::WorkerQueue *Scheduler::getLocalQueue() {
+  if (!m_workStealing || t_scheduler != this || t_worker_index < 0) {
+    return nullptr;
+  }
+  return m_workerQueues[t_worker_index];
+}
+
+/**
+ * @func: 
+ * @param {int} thr
+ * @return {*}
+ * @description: 根据线程id找到专属队列，工作线程数量很少，直接遍历
+ */
+Scheduler::WorkerQueue *Scheduler::getPinnedQueue(int thr) {
+  for (auto q : m_workerQueues) {
+    if (q->threadId == thr) {
+      return q;
+    }
+  }
+  SYLAR_LOG_ERROR(g_logger) << "schedule to thread " << thr
+                            << " which is not a worker of scheduler "
+                            << m_name << ", run it on any thread";
+  return nullptr;
+}
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 从队列的队头取出任务，跳过正在其他线程上执行的协程；
+ * 取出和增加活跃线程数在同一个锁内，stopping()不会看到任务既不在队列中也没有被计数
+ */
+bool Scheduler::popLocal(WorkerQueue *worker,
+                         std::deque<FiberAndThread> &queue,
+                         FiberAndThread &ft) {
+  WorkerQueue::MutexType::Lock lock(worker->mutex);
+  for (auto it = queue.begin(); it != queue.end(); ++it) {
+    SYLAR_ASSERT(it->m_cb || it->m_fiber);
+    if (it->m_fiber && it->m_fiber->getState() == Fiber::EXEC) {
+      continue;
+    }
+    ft = std::move(*it);
+    queue.erase(it);
+    worker->updateSize();
+    ++m_activeThreadCount;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 依次查看其他线程的队列，从队尾窃取一半任务，第一个任务直接运行，其余放入本地队列；
+ * 窃取的任务在放回本地队列之前不在任何队列中，这期间多计一个活跃线程
+ */
+bool Scheduler::steal(WorkerQueue *local, FiberAndThread &ft) {
+  std::size_t count = m_workerQueues.size();
+  std::vector<FiberAndThread> stolen;
+  for (std::size_t i = 1; i < count && stolen.empty(); ++i) {
+    WorkerQueue *victim = m_workerQueues[(t_worker_index + i) % count];
+    WorkerQueue::MutexType::Lock lock(victim->mutex);
+    std::size_t n = (victim->tasks.size() + 1) / 2;
+    if (n) {
+      ++m_activeThreadCount;
+    }
+    while (n-- > 0) {
+      stolen.push_back(std::move(victim->tasks.back()));
+      victim->tasks.pop_back();
+    }
+    victim->updateSize();
+  }
+  if (stolen.empty()) {
+    return false;
+  }
+
+  WorkerQueue::MutexType::Lock lock(local->mutex);
+  // 窃取时按从新到旧的顺序取出，放回本地时恢复原有顺序
+  for (auto it = stolen.rbegin(); it != stolen.rend(); ++it) {
+    local->tasks.push_back(std::move(*it));
+  }
+  local->updateSize();
+  lock.unlock();
+  bool rt = popLocal(local, local->tasks, ft);
+  --m_activeThreadCount;
+  return rt;
+}
+
+Fiber::ptr Scheduler::acquireFiber(WorkerQueue *self,
+                                   std::function<void()> &cb) {
+  while (!self->fiberPool.empty()) {
+    Fiber::ptr fiber = std::move(self->fiberPool.back());
+    self->fiberPool.pop_back();
+    --m_fiberPoolSize;
+    // fiber.stack_size修改之前放入的协程直接释放，池中逐渐换成新的大小
+    if (!m_sharedStack &&
+        fiber->getStackSize() != Fiber::GetDefaultStackSize()) {
+      continue;
+    }
+    ++m_fiberPoolHits;
+    fiber->reset(cb);
+    return fiber;
+  }
+  ++m_fiberPoolMisses;
+  return Fiber::ptr(new Fiber(cb, 0, false, m_sharedStack));
+}
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 还有其他地方持有的协程不能复用，栈类型和调度器不一致的协程也不复用；
+ * 用户指定了栈大小的协程也不复用，否则池中的小栈会被交给需要默认大小的任务
+ */
+void Scheduler::recycleFiber(WorkerQueue *self, Fiber::ptr &fiber) {
+  if (self->fiberPool.size() >= m_fiberPoolMax || fiber.use_count() != 1 ||
+      fiber->isSharedStack() != m_sharedStack ||
+      (!m_sharedStack &&
+       fiber->getStackSize() != Fiber::GetDefaultStackSize())) {
+    return;
+  }
+  fiber->reset(nullptr);
+  self->fiberPool.push_back(std::move(fiber));
+  ++m_fiberPoolSize;
+}
+
+void Scheduler::scheduleBatch(TaskBatch &batch) {
+  // 连续指定同一线程的任务只加一次锁
+  auto &pinned = batch.m_pinned;
+  std::size_t i = 0;
+  while (i < pinned.size()) {
+    int thr = pinned[i].m_threadId;
+    WorkerQueue *queue = getPinnedQueue(thr);
+    if (!queue) {
+      if (pinned[i].m_fiber) {
+        schedule(&pinned[i].m_fiber);
+      } else {
+        schedule(&pinned[i].m_cb);
+      }
+      ++i;
+      continue;
+    }
+    bool need_tickle = false;
+    {
+      WorkerQueue::MutexType::Lock lock(queue->mutex);
+      need_tickle = queue->pinned.empty();
+      for (; i < pinned.size() && pinned[i].m_threadId == thr; ++i) {
+        queue->pinned.push_back(std::move(pinned[i]));
+      }
+      queue->updateSize();
+    }
+    if (need_tickle && queue->index != getWorkerIndex()) {
+      tickleWorker(queue->index);
+    }
+  }
+  pinned.clear();
+
+  if (batch.m_first) {
+    bool need_tickle = pushSubmitted(batch.m_first, batch.m_last);
+    batch.m_first = batch.m_last = nullptr;
+    batch.m_count = 0;
+    if (need_tickle) {
+      tickle();
+    }
+  }
+}
+
+Scheduler::SubmitNode *Scheduler::takeSubmitted() {
+  SubmitNode *node = m_submitted.exchange(nullptr, std::memory_order_acquire);
+  SubmitNode *prev = nullptr;
+  while (node) {
+    SubmitNode *next = node->next;
+    node->next = prev;
+    prev = node;
+    node = next;
+  }
+  return prev;
+}
+
+template <class Queue>
+std::size_t Scheduler::appendSubmitted(SubmitNode *batch, Queue &queue) {
+  std::size_t count = 0;
+  while (batch) {
+    SubmitNode *next = batch->next;
+    queue.push_back(std::move(batch->ft));
+    delete batch;
+    batch = next;
+    ++count;
+  }
+  return count;
+}
+
+bool Scheduler::hasPendingTasks() {
+  if (m_submitted.load()) {
+    return true;
+  }
+  if (t_scheduler == this && t_worker_index >= 0) {
+    WorkerQueue *self = m_workerQueues[t_worker_index];
+    WorkerQueue::MutexType::Lock lock(self->mutex);
+    if (!self->pinned.empty()) {
+      return true;
+    }
+  }
+  // work stealing模式下其他线程本地队列中的任务也可以窃取
+  if (m_workStealing) {
+    for (auto q : m_workerQueues) {
+      WorkerQueue::MutexType::Lock lock(q->mutex);
+      if (!q->tasks.empty()) {
+        return true;
+      }
+    }
+  }
+  MutexType::Lock lock(m_mutex);
+  return !m_fibers.empty();
+}
+
+bool Scheduler::hasPendingTasksNoLock() const {
+  if (m_submitted.load(std::memory_order_relaxed) ||
+      m_fibersSize.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  if (t_scheduler == this && t_worker_index >= 0 &&
+      m_workerQueues[t_worker_index]->pinnedSize.load(
+          std::memory_order_relaxed)) {
+    return true;
+  }
+  if (m_workStealing) {
+    for (auto q : m_workerQueues) {
+      if (q->tasksSize.load(std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool Scheduler::hasLocalTasks() {
+  for (auto q : m_workerQueues) {
+    WorkerQueue::MutexType::Lock lock(q->mutex);
+    if (!q->pinned.empty() || !q->tasks.empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
 Scheduler *Scheduler::GetThis() { return t_scheduler; }
 
 Fiber *Scheduler::GetMainFiber() { return t_scheduler_fiber; }
@@ -266,13 +601,19 @@ Fiber *Scheduler::GetMainFiber() { return t_scheduler_fiber; }
 void Scheduler::setThis() { t_scheduler = this; }
 
 void Scheduler::tickle() {
-  SYLAR_LOG_INFO(g_logger) << "tickle";
+  SYLAR_LOG_DEBUG(g_logger) << "tickle";
+}
+
+void Scheduler::tickleWorker(std::size_t index) {
+  tickle();
 }
 
 bool Scheduler::stopping() {
   MutexType::Lock lock(m_mutex);
-  return auto_stopping && m_stopping && m_activeThreadCount == 0 &&
-         m_fibers.empty();
+  // 先检查提交栈再检查本地队列，和run中取出任务的顺序一致；
+  // 最后才看活跃线程数：检查队列之后被取走的任务已经计入活跃线程
+  return auto_stopping && m_stopping && m_fibers.empty() &&
+         !m_submitted.load() && !hasLocalTasks() && m_activeThreadCount == 0;
 }
 
 /**
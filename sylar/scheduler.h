@@ -17,6 +17,7 @@
 #include <algorithm>
 #include <atomic>
 #include <cstddef>
+#include <deque>
 #include <functional>
 #include <list>
 #include <memory>
@@ -30,6 +31,13 @@ namespace sylar {
 // schedule：往任务队列中加入任务，若任务队列为空，则通知线程有任务来了
 // stop： 将所有的线程detach，并且保证idle协程结束，线程在idle协程结束后可以结束
 // 析构函数：释放内存
+// work stealing模式(scheduler.work_stealing)：每个工作线程拥有自己的任务队列，工作线程内schedule的任务放入本地队列，
+// 本地队列和全局队列都为空时从其他线程的队列中窃取任务，全局队列只作为外部线程提交任务的入口
+// 非工作线程(以及未开启work stealing时)提交的任务压入无锁栈m_submitted，不需要加锁，
+// 工作线程空闲时一次取走全部任务，放入全局队列或者自己的本地队列
+// 共享栈模式(scheduler.shared_stack)：回调任务的协程运行在线程的共享栈上，挂起后只能回到原线程运行，
+// schedule时自动放入所属线程的专属队列
+// 协程池：运行结束的协程放入所在线程的池中(scheduler.fiber_pool.max_cached)，回调任务优先从池中取协程并reset
 
 class Scheduler {
 public:
@@ -47,12 +55,49 @@ public:
   static Scheduler *GetThis();
   static Fiber* GetMainFiber();
 
+  bool isWorkStealing() const { return m_workStealing; }
+  bool isSharedStack() const { return m_sharedStack; }
+
+  // 所有工作线程协程池中的协程数量
+  uint64_t getFiberPoolSize() const { return m_fiberPoolSize; }
+  // 回调任务从协程池中取到协程的次数
+  uint64_t getFiberPoolHits() const { return m_fiberPoolHits; }
+  // 协程池为空需要新建协程的次数
+  uint64_t getFiberPoolMisses() const { return m_fiberPoolMisses; }
+
   // 调度器增加任务，若当前的任务队列为空则通知所有的线程
+  // 指定线程的任务放入该线程的专属队列，只唤醒该线程
+  // 开启work stealing时，工作线程提交的任务放入自己的本地队列
   template <class FiberOrCb> void schedule(FiberOrCb fc, int thr = -1) {
     bool need_tickle = false;
-    {
-      MutexType::Lock lock(m_mutex);
-      need_tickle = scheduNoLock(fc, thr);
+    if (thr == -1) {
+      thr = StackThread(fc);
+    }
+    WorkerQueue *pinned = thr != -1 ? getPinnedQueue(thr) : nullptr;
+    if (pinned) {
+      {
+        WorkerQueue::MutexType::Lock lock(pinned->mutex);
+        need_tickle = scheduNoLock(pinned->pinned, fc, thr);
+        pinned->updateSize();
+      }
+      if (need_tickle && pinned->index != getWorkerIndex()) {
+        tickleWorker(pinned->index);
+      }
+      return;
+    }
+
+    WorkerQueue *local = getLocalQueue();
+    if (local) {
+      WorkerQueue::MutexType::Lock lock(local->mutex);
+      need_tickle = scheduNoLock(local->tasks, fc, -1);
+      local->updateSize();
+    } else {
+      SubmitNode *node = new SubmitNode(fc);
+      if (!node->ft.m_fiber && !node->ft.m_cb) {
+        delete node;
+        return;
+      }
+      need_tickle = pushSubmitted(node, node);
     }
 
     if (need_tickle) {
@@ -64,11 +109,40 @@ public:
   template<class InputIterator>
   void schedule(InputIterator begin, InputIterator end) {
     bool need_tickle = false;
-    {
-      MutexType::Lock lock(m_mutex);
+    // 共享栈协程先单独放入所属线程的队列，移走后的空任务不会入队
+    for (auto it = begin; it != end; ++it) {
+      int thr = StackThread(&*it);
+      if (thr != -1) {
+        schedule(&*it, thr);
+      }
+    }
+    WorkerQueue *local = getLocalQueue();
+    if (local) {
+      WorkerQueue::MutexType::Lock lock(local->mutex);
+      while(begin != end) {
+        need_tickle = scheduNoLock(local->tasks, &*begin, -1) || need_tickle;
+        ++begin;
+      }
+      local->updateSize();
+    } else {
+      // 倒序串成链表后一次压入，取出时反转恢复顺序
+      SubmitNode *first = nullptr;
+      SubmitNode *last = nullptr;
       while(begin != end) {
-        need_tickle = scheduNoLock(&*begin, -1) || need_tickle;
+        SubmitNode *node = new SubmitNode(&*begin);
         ++begin;
+        if (!node->ft.m_fiber && !node->ft.m_cb) {
+          delete node;
+          continue;
+        }
+        node->next = first;
+        first = node;
+        if (!last) {
+          last = node;
+        }
+      }
+      if (first) {
+        need_tickle = pushSubmitted(first, last);
       }
     }
     if(need_tickle) {
@@ -84,6 +158,13 @@ protected:
    */  
   virtual void tickle();
 
+  /**
+   * @func: 
+   * @return {*}
+   * @description: 通知指定的工作线程有任务了，默认与tickle相同
+   */
+  virtual void tickleWorker(std::size_t index);
+
   /**
    * @func: 
    * @return {*}
@@ -105,16 +186,44 @@ protected:
    */
   virtual void idle();
 
+  /**
+   * @func: 
+   * @return {*}
+   * @description: 工作线程每次取任务之前调用，默认什么都不做
+   */
+  virtual void beforeTask() {}
+
   void setThis();
 
   bool hasIdleThreads() { return m_idleThreadCount > 0; }
+
+  // 工作线程数量(包括use_caller的调度线程)
+  std::size_t getWorkerCount() const { return m_workerQueues.size(); }
+  // 当前线程在调度器中的下标，不是工作线程时返回-1
+  int getWorkerIndex() const;
+  // 下标为index的工作线程的线程id，线程启动前为-1
+  int getWorkerThreadId(std::size_t index) const {
+    return m_workerQueues[index]->threadId;
+  }
+  // 当前线程是否有可以运行的任务，空闲线程睡眠前发布自己的状态后再检查一次
+  bool hasPendingTasks();
+  // 同上，只读原子变量不加锁，结果可能稍有滞后，用于忙轮询；睡眠前仍要调用hasPendingTasks
+  bool hasPendingTasksNoLock() const;
   
 private:
-  template <class FiberOrCb> bool scheduNoLock(FiberOrCb fc, int thr) {
-    bool need_tickle = m_fibers.empty();
+  // 共享栈协程只能在所属线程上恢复，其余任务返回-1
+  static int StackThread(const Fiber::ptr &f) {
+    return f ? f->getStackThread() : -1;
+  }
+  static int StackThread(Fiber::ptr *f) { return StackThread(*f); }
+  template <class T> static int StackThread(const T &) { return -1; }
+
+  template <class Queue, class FiberOrCb>
+  bool scheduNoLock(Queue &queue, FiberOrCb fc, int thr) {
+    bool need_tickle = queue.empty();
     FiberAndThread ft(fc, thr);
     if (ft.m_fiber || ft.m_cb) {
-      m_fibers.push_back(ft);
+      queue.push_back(ft);
     }
     return need_tickle;
   }
@@ -151,6 +260,133 @@ private:
 
   };
 
+  // 提交的任务节点，组成无锁栈
+  struct SubmitNode {
+    template <class FiberOrCb>
+    SubmitNode(FiberOrCb fc) : ft(fc, -1) {}
+
+    FiberAndThread ft;
+    SubmitNode *next = nullptr;
+  };
+
+  /**
+   * @func: 
+   * @return {*}
+   * @description: 把first到last的链表压入提交栈，返回之前是否为空；消费者只会整体取走，不存在ABA问题
+   */
+  bool pushSubmitted(SubmitNode *first, SubmitNode *last) {
+    SubmitNode *head = m_submitted.load(std::memory_order_relaxed);
+    do {
+      last->next = head;
+    } while (!m_submitted.compare_exchange_weak(head, first,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+    return head == nullptr;
+  }
+
+public:
+  // 一批任务，提交时只需要一次CAS和最多一次tickle
+  // 共享栈协程需要回到所属线程，提交时单独放入专属队列
+  class TaskBatch {
+  friend class Scheduler;
+  public:
+    explicit TaskBatch(Scheduler *scheduler) : m_scheduler(scheduler) {}
+    ~TaskBatch() { commit(); }
+
+    TaskBatch(const TaskBatch &) = delete;
+    TaskBatch &operator=(const TaskBatch &) = delete;
+
+    Scheduler *getScheduler() const { return m_scheduler; }
+    std::size_t size() const { return m_count + m_pinned.size(); }
+
+    // thr不为-1时放入指定线程的专属队列
+    template <class FiberOrCb> void add(FiberOrCb fc, int thr = -1) {
+      int bound = StackThread(fc);
+      if (bound != -1) {
+        thr = bound;
+      }
+      if (thr != -1) {
+        m_pinned.push_back(FiberAndThread(fc, thr));
+        return;
+      }
+      SubmitNode *node = new SubmitNode(fc);
+      if (!node->ft.m_fiber && !node->ft.m_cb) {
+        delete node;
+        return;
+      }
+      // 倒序串成链表，取出时反转恢复顺序
+      node->next = m_first;
+      m_first = node;
+      if (!m_last) {
+        m_last = node;
+      }
+      ++m_count;
+    }
+
+    // 把攒下的任务交给调度器
+    void commit() {
+      if (m_first || !m_pinned.empty()) {
+        m_scheduler->scheduleBatch(*this);
+      }
+    }
+
+  private:
+    Scheduler *m_scheduler;
+    SubmitNode *m_first = nullptr;
+    SubmitNode *m_last = nullptr;
+    std::size_t m_count = 0;
+    std::vector<FiberAndThread> m_pinned;
+  };
+
+private:
+  // 提交一批任务
+  void scheduleBatch(TaskBatch &batch);
+
+  // 取走提交栈中的所有任务，按提交顺序返回链表
+  SubmitNode *takeSubmitted();
+  // 把链表中的任务移动到队列尾部，释放节点，返回任务数量
+  template <class Queue> std::size_t appendSubmitted(SubmitNode *batch, Queue &queue);
+
+  // 每个工作线程的任务队列
+  // pinned存放指定由该线程运行的任务，只有该线程会读取
+  // tasks为本地队列，只在work stealing模式下使用，本线程从队头取任务，其他线程从队尾窃取任务
+  struct WorkerQueue {
+    typedef Spinlock MutexType;
+
+    MutexType mutex;
+    std::deque<FiberAndThread> pinned;
+    std::deque<FiberAndThread> tasks;
+    // 在m_workerQueues中的下标
+    int index = -1;
+    // 所属线程id
+    std::atomic<int> threadId = {-1};
+    // 运行结束可以复用的协程，只有所属线程访问，不需要加锁
+    std::vector<Fiber::ptr> fiberPool;
+    // pinned和tasks的长度，修改队列后在锁内更新，供hasPendingTasksNoLock不加锁读取
+    std::atomic<std::size_t> pinnedSize = {0};
+    std::atomic<std::size_t> tasksSize = {0};
+
+    void updateSize() {
+      pinnedSize.store(pinned.size(), std::memory_order_relaxed);
+      tasksSize.store(tasks.size(), std::memory_order_relaxed);
+    }
+  };
+
+  // 当前线程是本调度器的工作线程且开启了work stealing时返回本地队列
+  WorkerQueue *getLocalQueue();
+  // 返回线程thr的专属队列，thr不是工作线程时返回nullptr
+  WorkerQueue *getPinnedQueue(int thr);
+  // 从队列中取出一个可运行的任务，取到时在锁内增加活跃线程数
+  bool popLocal(WorkerQueue *worker, std::deque<FiberAndThread> &queue,
+                FiberAndThread &ft);
+  // 从其他工作线程的队列中窃取一半任务
+  bool steal(WorkerQueue *local, FiberAndThread &ft);
+  bool hasLocalTasks();
+  // 从协程池中取出协程执行cb，池为空时新建
+  Fiber::ptr acquireFiber(WorkerQueue *self, std::function<void()> &cb);
+  // 运行结束且没有其他引用的协程放回协程池
+  void recycleFiber(WorkerQueue *self, Fiber::ptr &fiber);
+
 private:
   // 调度器的互斥锁
   MutexType m_mutex;
@@ -158,6 +394,21 @@ private:
   std::vector<Thread::ptr> m_threads;
   // 任务消息队列
   std::list<FiberAndThread> m_fibers;
+  // m_fibers的长度，在m_mutex内更新
+  std::atomic<std::size_t> m_fibersSize = {0};
+  // 提交任务的无锁栈，栈顶为最后提交的任务
+  std::atomic<SubmitNode*> m_submitted = {nullptr};
+  // 每个工作线程的队列，use_caller时下标0为调度器所在线程
+  std::vector<WorkerQueue*> m_workerQueues;
+  // 是否开启work stealing
+  bool m_workStealing = false;
+  // 回调任务是否使用共享栈协程
+  bool m_sharedStack = false;
+  // 每个线程协程池的容量
+  std::size_t m_fiberPoolMax = 0;
+  std::atomic<uint64_t> m_fiberPoolSize = {0};
+  std::atomic<uint64_t> m_fiberPoolHits = {0};
+  std::atomic<uint64_t> m_fiberPoolMisses = {0};
   // 主协程，设置use_caller为true时创造
   Fiber::ptr m_rootFiber;
   // 调度器名称
@@ -89,7 +89,7 @@ Socket::~Socket() {
 }
 
 int64_t Socket::getSendTimeout() {
-  FdCtx::ptr ctx = FdMgr::getInstance()->get(m_sock);
+  FdCtxRef ctx = FdMgr::getInstance()->get(m_sock);
   if (ctx) {
     return ctx->getTimeout(SO_SNDTIMEO);
   }
@@ -102,7 +102,7 @@ void Socket::setSendTimeout(int64_t v) {
 }
 
 int64_t Socket::getRecvTimeout() {
-    FdCtx::ptr ctx = FdMgr::getInstance()->get(m_sock);
+    FdCtxRef ctx = FdMgr::getInstance()->get(m_sock);
   if (ctx) {
     return ctx->getTimeout(SO_RCVTIMEO);
   }
@@ -156,7 +156,7 @@ Socket::ptr Socket::accept() {
 }
 
 bool Socket::init(int sock) {
-  FdCtx::ptr ctx = FdMgr::getInstance()->get(sock);
+  FdCtxRef ctx = FdMgr::getInstance()->get(sock);
   if (ctx && ctx->isSocket() && !ctx->isClose()) {
     m_sock = sock;
     m_isConnected = true;
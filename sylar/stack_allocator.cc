@@ -0,0 +1,205 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-17 10:12:45
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-17 10:12:45
+ * @FilePath     : /sylar/stack_allocator.cc
+ * @Description  : 
+ * Copyright 2024 OBKoro1, All Rights Reserved. 
+ * 2026-10-17 10:12:45
+ */
+#include "stack_allocator.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/marco.h"
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<std::string>::ptr g_fiber_stack_allocator =
+    Config::Lookup<std::string>("fiber.stack_allocator", "pool",
+                                "fiber stack allocator, malloc or pool");
+
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_max_cached =
+    Config::Lookup<uint32_t>("fiber.stack_pool.max_cached", 64,
+                             "max fiber stacks cached per thread");
+
+static std::atomic<StackAllocator *> s_default_allocator = {nullptr};
+static std::atomic<uint32_t> s_max_cached = {64};
+
+static StackAllocator *GetAllocatorByName(const std::string &name) {
+  if (name == "malloc") {
+    return MallocStackAllocator::GetInstance();
+  }
+  if (name != "pool") {
+    SYLAR_LOG_ERROR(g_logger) << "unknown fiber.stack_allocator " << name
+                              << ", use pool";
+  }
+  return PooledStackAllocator::GetInstance();
+}
+
+struct _StackAllocatorIniter {
+  _StackAllocatorIniter() {
+    s_default_allocator = GetAllocatorByName(g_fiber_stack_allocator->getValue());
+    s_max_cached = g_fiber_stack_pool_max_cached->getValue();
+
+    g_fiber_stack_allocator->addListener(
+        [](const std::string &old_value, const std::string &new_value) {
+          SYLAR_LOG_INFO(g_logger) << "fiber stack allocator changed from "
+                                   << old_value << " to " << new_value;
+          s_default_allocator = GetAllocatorByName(new_value);
+        });
+    g_fiber_stack_pool_max_cached->addListener(
+        [](const uint32_t &old_value, const uint32_t &new_value) {
+          s_max_cached = new_value;
+        });
+  }
+};
+
+static _StackAllocatorIniter s_stack_allocator_init;
+
+StackAllocator *StackAllocator::GetDefault() {
+  StackAllocator *allocator = s_default_allocator;
+  return allocator ? allocator : PooledStackAllocator::GetInstance();
+}
+
+void *MallocStackAllocator::alloc(std::size_t size) {
+  return malloc(size);
+}
+
+void MallocStackAllocator::dealloc(void *vp, std::size_t size) {
+  free(vp);
+}
+
+MallocStackAllocator *MallocStackAllocator::GetInstance() {
+  static MallocStackAllocator s_instance;
+  return &s_instance;
+}
+
+static std::atomic<uint64_t> s_hits = {0};
+static std::atomic<uint64_t> s_misses = {0};
+static std::atomic<uint64_t> s_cached = {0};
+
+uint64_t PooledStackAllocator::GetHits() { return s_hits; }
+
+uint64_t PooledStackAllocator::GetMisses() { return s_misses; }
+
+uint64_t PooledStackAllocator::GetCached() { return s_cached; }
+
+namespace {
+
+// 线程缓存的空闲栈，线程退出时全部归还给系统
+struct StackCache {
+  std::vector<std::pair<void *, std::size_t>> stacks;
+
+  ~StackCache() {
+    for (auto &i : stacks) {
+      PooledStackAllocator::UnmapStack(i.first, i.second);
+    }
+    s_cached -= stacks.size();
+  }
+};
+
+// 线程退出时thread_local对象按顺序析构，之后仍可能有协程被释放，
+// 用普通指针记录缓存，析构后置空，此时直接munmap
+static thread_local StackCache *t_stack_cache = nullptr;
+static thread_local bool t_stack_cache_destroyed = false;
+
+struct StackCacheHolder {
+  ~StackCacheHolder() {
+    if (t_stack_cache) {
+      delete t_stack_cache;
+      t_stack_cache = nullptr;
+    }
+    t_stack_cache_destroyed = true;
+  }
+};
+
+static thread_local StackCacheHolder t_stack_cache_holder;
+
+StackCache *GetStackCache() {
+  if (t_stack_cache_destroyed) {
+    return nullptr;
+  }
+  if (!t_stack_cache) {
+    // 访问一次holder，保证线程退出时析构
+    (void)&t_stack_cache_holder;
+    t_stack_cache = new StackCache;
+  }
+  return t_stack_cache;
+}
+
+}
+
+std::size_t PooledStackAllocator::GetMapSize(std::size_t size) {
+  static const std::size_t s_page_size = sysconf(_SC_PAGESIZE);
+  return (size + s_page_size - 1) / s_page_size * s_page_size + s_page_size;
+}
+
+void *PooledStackAllocator::MapStack(std::size_t size) {
+  static const std::size_t s_page_size = sysconf(_SC_PAGESIZE);
+  std::size_t map_size = GetMapSize(size);
+  void *base = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (base == MAP_FAILED) {
+    SYLAR_LOG_ERROR(g_logger) << "mmap fiber stack size=" << map_size
+                              << " errno=" << errno;
+    return nullptr;
+  }
+  // 栈向低地址增长，最低的一页作为保护页
+  if (mprotect(base, s_page_size, PROT_NONE)) {
+    SYLAR_LOG_ERROR(g_logger) << "mprotect fiber stack guard page errno="
+                              << errno;
+  }
+  return (char *)base + s_page_size;
+}
+
+void PooledStackAllocator::UnmapStack(void *vp, std::size_t size) {
+  static const std::size_t s_page_size = sysconf(_SC_PAGESIZE);
+  munmap((char *)vp - s_page_size, GetMapSize(size));
+}
+
+void *PooledStackAllocator::alloc(std::size_t size) {
+  StackCache *cache = GetStackCache();
+  if (cache) {
+    // 从后往前找，一般所有协程的栈大小相同，第一个就能命中
+    for (auto it = cache->stacks.rbegin(); it != cache->stacks.rend(); ++it) {
+      if (it->second == size) {
+        void *vp = it->first;
+        cache->stacks.erase(std::next(it).base());
+        --s_cached;
+        ++s_hits;
+        return vp;
+      }
+    }
+  }
+  ++s_misses;
+  void *vp = MapStack(size);
+  SYLAR_ASSERT2(vp, "mmap fiber stack");
+  return vp;
+}
+
+void PooledStackAllocator::dealloc(void *vp, std::size_t size) {
+  StackCache *cache = GetStackCache();
+  if (cache && cache->stacks.size() < s_max_cached) {
+    cache->stacks.push_back(std::make_pair(vp, size));
+    ++s_cached;
+    return;
+  }
+  UnmapStack(vp, size);
+}
+
+PooledStackAllocator *PooledStackAllocator::GetInstance() {
+  static PooledStackAllocator s_instance;
+  return &s_instance;
+}
+
+}
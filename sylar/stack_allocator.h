@@ -0,0 +1,66 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-17 10:12:31
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-17 10:12:31
+ * @FilePath     : /sylar/stack_allocator.h
+ * @Description  : 协程栈分配器
+ * Copyright 2024 OBKoro1, All Rights Reserved. 
+ * 2026-10-17 10:12:31
+ */
+#ifndef __SYLAR_STACK_ALLOCATOR_H__
+#define __SYLAR_STACK_ALLOCATOR_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace sylar {
+
+// 协程栈分配器接口，Fiber记录分配时使用的分配器，释放时使用同一个分配器
+// fiber.stack_allocator 选择默认分配器：malloc 或 pool
+class StackAllocator {
+public:
+  virtual ~StackAllocator() {}
+
+  virtual void *alloc(std::size_t size) = 0;
+  virtual void dealloc(void *vp, std::size_t size) = 0;
+
+  // 返回配置指定的分配器
+  static StackAllocator *GetDefault();
+};
+
+// 直接使用malloc/free
+class MallocStackAllocator : public StackAllocator {
+public:
+  void *alloc(std::size_t size) override;
+  void dealloc(void *vp, std::size_t size) override;
+
+  static MallocStackAllocator *GetInstance();
+};
+
+// 使用mmap分配协程栈，栈底(低地址)有一页PROT_NONE的保护页，栈溢出时直接段错误
+// 释放的栈放入当前线程的空闲链表，下次分配直接取出，不再调用mmap/munmap
+// 每个线程缓存的数量由fiber.stack_pool.max_cached限制
+class PooledStackAllocator : public StackAllocator {
+public:
+  void *alloc(std::size_t size) override;
+  void dealloc(void *vp, std::size_t size) override;
+
+  static PooledStackAllocator *GetInstance();
+
+  // 从缓存中分配的次数
+  static uint64_t GetHits();
+  // 缓存为空需要mmap的次数
+  static uint64_t GetMisses();
+  // 所有线程当前缓存的栈数量
+  static uint64_t GetCached();
+
+  // 保护页和mmap区域的实际大小
+  static std::size_t GetMapSize(std::size_t size);
+  static void *MapStack(std::size_t size);
+  static void UnmapStack(void *vp, std::size_t size);
+};
+
+}
+
+#endif
@@ -12,64 +12,49 @@
 #include "timer.h"
 #include "sylar/log.h"
 #include "sylar/util.h"
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <vector>
 
 namespace sylar {
 static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
-// 定时器比较任务，通过m_next进行比较
-bool Timer::Comparator::operator()(const Timer::ptr &lhs,
-                                   const Timer::ptr &rhs) const {
-  if (!lhs && !rhs) {
-    return false;
-  }
-
-  if (!lhs) {
-    return true;
-  }
-
-  if (!rhs) {
-    return false;
-  }
-
-  if (lhs->m_next < rhs->m_next) {
-    return true;
-  }
-
-  if (rhs->m_next < lhs->m_next) {
-    return false;
-  }
-  return lhs.get() < rhs.get();
-
-}
-
 /**
  * @func: 
- * @param {uint64_t} ms
+ * @param {uint64_t} us
  * @return {*}
  * @description: 定时器创建
  */
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring,
+Timer::Timer(uint64_t us, std::function<void()> cb, bool recurring,
              TimerManager *manager)
-    : m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager){
-  m_next = GetCurrentMS() + ms;
+    : m_recurring(recurring), m_us(us), m_cb(cb), m_manager(manager){
+  m_next = GetMonotonicUS() + us;
 }
 
-Timer::Timer(uint64_t next) : m_next(next) {}
-
 /**
  * @func: 
  * @return {*}
  * @description: 取消定时器
  */
 bool Timer::cancel() {
+  // 其他线程的定时器只做标记，由所属线程移出时间轮
+  if (!m_manager->isOwnerThread()) {
+    return m_manager->postCancel(this);
+  }
   TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-  if (m_cb) {
+  if (m_cb && !m_done) {
+    m_done = true;
     m_cb = nullptr;
-    auto it = m_manager->m_timers.find(shared_from_this());
-    m_manager->m_timers.erase(it);
+    if (m_slot) {
+      m_manager->m_timers.remove(this);
+      if (m_manager->m_timers.empty()) {
+        m_manager->m_nextExpire = ~0ull;
+      }
+    }
+    // 调用者持有ptr，这里释放不会析构自己
+    m_self.reset();
     return true;
   }
   return false;
@@ -81,18 +66,22 @@ bool Timer::cancel() {
  * @description: 将定时器的next时间更新到从现在开始
  */
 bool Timer::refresh() {
-  TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-  if (!m_cb) {
-    return false;
+  if (!m_manager->isOwnerThread()) {
+    if (m_done) {
+      return false;
+    }
+    Timer::ptr self = shared_from_this();
+    m_manager->postToOwner([self]() { self->refresh(); });
+    return true;
   }
-  auto it = m_manager->m_timers.find(shared_from_this());
-  if (it == m_manager->m_timers.end()) {
+  TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+  if (!m_cb || !m_slot || m_done) {
     return false;
   }
 
-  m_manager->m_timers.erase(it);
-  m_next = GetCurrentMS() + m_ms;
-  m_manager->m_timers.insert(shared_from_this());
+  m_manager->m_timers.remove(this);
+  m_next = GetMonotonicUS() + m_us;
+  m_manager->m_timers.add(this);
   return true;
 }
 
@@ -104,38 +93,263 @@ bool Timer::refresh() {
  * @description: 重置定时器
  */
 bool Timer::reset(uint64_t ms, bool from_now) {
-  if (ms == m_ms && !from_now) {
+  return resetUS(ms * 1000, from_now);
+}
+
+/**
+ * @func: 
+ * @param {uint64_t} us
+ * @param {bool} from_now
+ * @return {*}
+ * @description: 以微秒为单位重置定时器
+ */
+bool Timer::resetUS(uint64_t us, bool from_now) {
+  if (us == m_us && !from_now) {
     return true;
   }
-  TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-  if (!m_cb) {
-    return false;
+  if (!m_manager->isOwnerThread()) {
+    if (m_done) {
+      return false;
+    }
+    Timer::ptr self = shared_from_this();
+    m_manager->postToOwner(
+        [self, us, from_now]() { self->resetUS(us, from_now); });
+    return true;
   }
-  auto it = m_manager->m_timers.find(shared_from_this());
-  if (it == m_manager->m_timers.end()) {
+  TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+  if (!m_cb || !m_slot || m_done) {
     return false;
   }
 
-  m_manager->m_timers.erase(it);
+  m_manager->m_timers.remove(this);
   uint64_t start = 0;
   if (from_now) {
-    start = GetCurrentMS();
+    start = GetMonotonicUS();
   } else {
-    start = m_next - m_ms;
+    start = m_next - m_us;
   }
 
-  m_ms = ms;
-  m_next = start + ms;
+  m_us = us;
+  m_next = start + us;
   m_manager->addTimer(shared_from_this(), lock);
   return true;
 }
 
-TimerManager::TimerManager() {
-  m_previousTime = GetCurrentMS();
+TimerWheel::TimerWheel(uint64_t now_us) : m_current(now_us / 1000) {
+  memset(m_root, 0, sizeof(m_root));
+  memset(m_levels, 0, sizeof(m_levels));
+}
+
+TimerNode **TimerWheel::slotFor(uint64_t expire_us) {
+  uint64_t expire = expire_us / 1000;
+  if (expire < m_current) {
+    expire = m_current;
+  }
+  uint64_t delta = expire - m_current;
+  if (delta < ROOT_SIZE) {
+    return &m_root[expire & (ROOT_SIZE - 1)];
+  }
+  // 超出时间轮范围的先放在最高层的最远处，级联时再重新分配
+  if (delta > 0xffffffffull) {
+    expire = m_current + 0xffffffffull;
+  }
+  for (int i = 0; i < LEVELS; ++i) {
+    int shift = ROOT_BITS + i * LEVEL_BITS;
+    if (i == LEVELS - 1 || delta < (1ull << (shift + LEVEL_BITS))) {
+      return &m_levels[i][(expire >> shift) & (LEVEL_SIZE - 1)];
+    }
+  }
+  return nullptr;
+}
+
+void TimerWheel::add(TimerNode *timer) {
+  TimerNode **slot = slotFor(timer->m_next);
+  timer->m_slot = slot;
+  timer->m_prev = nullptr;
+  timer->m_succ = *slot;
+  if (*slot) {
+    (*slot)->m_prev = timer;
+  }
+  *slot = timer;
+  ++m_count;
+}
+
+void TimerWheel::remove(TimerNode *timer) {
+  if (timer->m_prev) {
+    timer->m_prev->m_succ = timer->m_succ;
+  } else {
+    *timer->m_slot = timer->m_succ;
+  }
+  if (timer->m_succ) {
+    timer->m_succ->m_prev = timer->m_prev;
+  }
+  timer->m_prev = timer->m_succ = nullptr;
+  timer->m_slot = nullptr;
+  --m_count;
+}
+
+void TimerWheel::takeSlot(TimerNode **slot, std::vector<TimerNode *> &out) {
+  TimerNode *timer = *slot;
+  *slot = nullptr;
+  while (timer) {
+    TimerNode *succ = timer->m_succ;
+    timer->m_prev = timer->m_succ = nullptr;
+    timer->m_slot = nullptr;
+    --m_count;
+    out.push_back(timer);
+    timer = succ;
+  }
+}
+
+void TimerWheel::takeExpired(TimerNode **slot, uint64_t now_us,
+                             std::vector<TimerNode *> &out) {
+  TimerNode *timer = *slot;
+  while (timer) {
+    TimerNode *succ = timer->m_succ;
+    if (timer->m_next <= now_us) {
+      remove(timer);
+      out.push_back(timer);
+    }
+    timer = succ;
+  }
+}
+
+void TimerWheel::cascade(int level, std::size_t index) {
+  TimerNode *timer = m_levels[level - 1][index];
+  m_levels[level - 1][index] = nullptr;
+  while (timer) {
+    TimerNode *succ = timer->m_succ;
+    --m_count;
+    add(timer);
+    timer = succ;
+  }
+}
+
+void TimerWheel::advance(uint64_t now_us, std::vector<TimerNode *> &expired) {
+  // 同一个槽中的定时器按微秒排序
+  auto sort_from = [&expired](std::size_t begin) {
+    if (expired.size() - begin > 1) {
+      std::sort(expired.begin() + begin, expired.end(),
+                [](const TimerNode *a, const TimerNode *b) {
+                  return a->m_next < b->m_next;
+                });
+    }
+  };
+  uint64_t now_ms = now_us / 1000;
+  while (m_current < now_ms) {
+    if (m_count == 0) {
+      m_current = now_ms;
+      break;
+    }
+    std::size_t begin = expired.size();
+    takeSlot(&m_root[m_current & (ROOT_SIZE - 1)], expired);
+    sort_from(begin);
+    ++m_current;
+    // 第0层转完一圈，从上层取下一段时间的定时器
+    if ((m_current & (ROOT_SIZE - 1)) == 0) {
+      for (int i = 1; i <= LEVELS; ++i) {
+        int shift = ROOT_BITS + (i - 1) * LEVEL_BITS;
+        std::size_t idx = (m_current >> shift) & (LEVEL_SIZE - 1);
+        cascade(i, idx);
+        if (idx != 0) {
+          break;
+        }
+      }
+    }
+  }
+  // 当前这1ms还没有过完，只取已经到期的
+  if (m_count != 0) {
+    std::size_t begin = expired.size();
+    takeExpired(&m_root[m_current & (ROOT_SIZE - 1)], now_us, expired);
+    sort_from(begin);
+  }
+}
+
+void TimerWheel::takeAll(uint64_t now_us, std::vector<TimerNode *> &out) {
+  for (std::size_t i = 0; i < ROOT_SIZE; ++i) {
+    takeSlot(&m_root[i], out);
+  }
+  for (int i = 0; i < LEVELS; ++i) {
+    for (std::size_t j = 0; j < LEVEL_SIZE; ++j) {
+      takeSlot(&m_levels[i][j], out);
+    }
+  }
+  m_current = now_us / 1000;
+}
+
+uint64_t TimerWheel::nextExpire() const {
+  if (m_count == 0) {
+    return ~0ull;
+  }
+  uint64_t next = ~0ull;
+  // 第0层每个槽只对应1ms，第一个非空槽中取最早的
+  for (std::size_t i = 0; i < ROOT_SIZE; ++i) {
+    const TimerNode *timer = m_root[(m_current + i) & (ROOT_SIZE - 1)];
+    if (!timer) {
+      continue;
+    }
+    for (; timer; timer = timer->m_succ) {
+      if (timer->m_next < next) {
+        next = timer->m_next;
+      }
+    }
+    break;
+  }
+  // 上层的当前槽已经级联过，只可能有绕了一圈的定时器，放在最后看
+  for (int i = 0; i < LEVELS; ++i) {
+    int shift = ROOT_BITS + i * LEVEL_BITS;
+    for (std::size_t j = 1; j <= LEVEL_SIZE; ++j) {
+      const TimerNode *timer =
+          m_levels[i][((m_current >> shift) + j) & (LEVEL_SIZE - 1)];
+      if (!timer) {
+        continue;
+      }
+      for (; timer; timer = timer->m_succ) {
+        if (timer->m_next < next) {
+          next = timer->m_next;
+        }
+      }
+      break;
+    }
+  }
+  return next;
+}
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 在定时器的锁内取消，和ListExpiredCb中的回调互斥
+ */
+bool IntrusiveTimer::cancel() {
+  if (!m_manager) {
+    return false;
+  }
+  TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+  if (!m_slot) {
+    return false;
+  }
+  m_manager->m_timers.remove(this);
+  if (m_manager->m_timers.empty()) {
+    m_manager->m_nextExpire = ~0ull;
+  }
+  return true;
 }
 
+TimerManager::TimerManager() : m_timers(GetMonotonicUS()) {}
+
 TimerManager::~TimerManager() {
-  
+  drainCancelled();
+  // 时间轮中的定时器持有自己，这里打破引用
+  std::vector<TimerNode *> nodes;
+  m_timers.takeAll(0, nodes);
+  for (auto node : nodes) {
+    if (node->m_intrusive) {
+      continue;
+    }
+    Timer *timer = static_cast<Timer *>(node);
+    timer->m_cb = nullptr;
+    timer->m_self.reset();
+  }
 }
 /**
  * @func: 
@@ -145,7 +359,18 @@ TimerManager::~TimerManager() {
  */
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb,
                                   bool recurring) {
-  Timer::ptr timer(new Timer(ms, cb, recurring, this));
+  return addTimerUS(ms * 1000, cb, recurring);
+}
+
+/**
+ * @func: 
+ * @param {uint64_t} us
+ * @return {*}
+ * @description: 增加微秒精度的定时器
+ */
+Timer::ptr TimerManager::addTimerUS(uint64_t us, std::function<void()> cb,
+                                    bool recurring) {
+  Timer::ptr timer(new Timer(us, cb, recurring, this));
   RWMutexType::WriteLock lock(m_mutex);
   addTimer(timer, lock);
   return timer;
@@ -166,21 +391,33 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
 /**
  * @func: 
  * @return {*}
- * @description: 获得距离下一个定时器时间
+ * @description: 获得距离下一个定时器的毫秒数，向上取整，按它等待不会提前醒来
  */
 uint64_t TimerManager::getNextTimer() {
+  uint64_t us = getNextTimerUS();
+  if (us == ~0ull) {
+    return ~0ull;
+  }
+  return (us + 999) / 1000;
+}
+
+/**
+ * @func: 
+ * @return {*}
+ * @description: 获得距离下一个定时器的微秒数
+ */
+uint64_t TimerManager::getNextTimerUS() {
   RWMutexType::ReadLock lock(m_mutex);
   m_tickled = false;
   if (m_timers.empty()) {
     return ~0ull;
   }
 
-  const Timer::ptr &next = *(m_timers.begin());
-  uint64_t now_ms = GetCurrentMS();
-  if (now_ms >= next->m_next) {
+  uint64_t now_us = GetMonotonicUS();
+  if (now_us >= m_nextExpire) {
     return 0;
   } else {
-    return next->m_next - now_ms;
+    return m_nextExpire - now_us;
   }
 }
 /**
@@ -190,8 +427,12 @@ uint64_t TimerManager::getNextTimer() {
  * @description: 获得所有该触发的定时器任务列表
  */
 void TimerManager::ListExpiredCb(std::vector<std::function<void()>> &cbs) {
-    uint64_t now_ms = sylar::GetCurrentMS();
-    std::vector<Timer::ptr> expired;
+    uint64_t now_us = sylar::GetMonotonicUS();
+    std::vector<TimerNode *> expired;
+    if(m_cancelled.load(std::memory_order_acquire)) {
+        RWMutexType::WriteLock lock(m_mutex);
+        drainCancelled();
+    }
     {
         RWMutexType::ReadLock lock(m_mutex);
         if(m_timers.empty()) {
@@ -202,34 +443,58 @@ void TimerManager::ListExpiredCb(std::vector<std::function<void()>> &cbs) {
     if(m_timers.empty()) {
         return;
     }
-    bool rollover = detectClockRollover(now_ms);
-    if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+    if(m_nextExpire > now_us) {
         return;
     }
 
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while(it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
-
-    for(auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
-        if(timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
-        } else {
-            timer->m_cb = nullptr;
+    m_timers.advance(now_us, expired);
+    cbs.reserve(cbs.size() + expired.size());
+
+    for(auto node : expired) {
+        // 调用者持有的定时器直接在锁内回调，回调返回后cancel才能返回
+        if(node->m_intrusive) {
+            IntrusiveTimer *itimer = static_cast<IntrusiveTimer *>(node);
+            itimer->m_cb(itimer);
+            continue;
+        }
+        Timer *timer = static_cast<Timer *>(node);
+        if(timer->m_recurring && !timer->m_done) {
+            cbs.push_back(timer->m_cb);
+            timer->m_next = now_us + timer->m_us;
+            m_timers.add(timer);
+            continue;
         }
+        // 和其他线程的取消竞争，先标记完成的一方生效
+        if(!timer->m_recurring && !timer->m_done.exchange(true)) {
+            cbs.push_back(std::move(timer->m_cb));
+        }
+        timer->m_cb = nullptr;
+        timer->m_self.reset();
     }
+    m_nextExpire = m_timers.nextExpire();
 }
 
 void TimerManager::addTimer(Timer::ptr timer, RWMutexType::WriteLock &lock) {
-    auto it = m_timers.insert(timer).first;
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
+    timer->m_self = timer;
+    addNode(timer.get(), lock);
+}
+
+void TimerManager::addIntrusiveTimer(IntrusiveTimer *timer, uint64_t ms,
+                                     IntrusiveTimer::Callback cb) {
+    timer->m_cb = cb;
+    timer->m_manager = this;
+    timer->m_next = GetMonotonicUS() + ms * 1000;
+    RWMutexType::WriteLock lock(m_mutex);
+    addNode(timer, lock);
+}
+
+void TimerManager::addNode(TimerNode *node, RWMutexType::WriteLock &lock) {
+    m_timers.add(node);
+    bool at_front = false;
+    if (node->m_next < m_nextExpire) {
+        m_nextExpire = node->m_next;
+        at_front = !m_tickled;
+    }
     if (at_front) {
         m_tickled = true;
     }
@@ -239,23 +504,42 @@ void TimerManager::addTimer(Timer::ptr timer, RWMutexType::WriteLock &lock) {
     }
 }
 
+bool TimerManager::postCancel(Timer *timer) {
+  if (timer->m_done.exchange(true)) {
+    return false;
+  }
+  timer->m_postSelf = timer->shared_from_this();
+  Timer *head = m_cancelled.load(std::memory_order_relaxed);
+  do {
+    timer->m_postNext = head;
+  } while (!m_cancelled.compare_exchange_weak(head, timer,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+  return true;
+}
+
+void TimerManager::drainCancelled() {
+  Timer *timer = m_cancelled.exchange(nullptr, std::memory_order_acquire);
+  while (timer) {
+    Timer *next = timer->m_postNext;
+    timer->m_postNext = nullptr;
+    // 已经到期的在ListExpiredCb中移出过了
+    if (timer->m_slot) {
+      m_timers.remove(timer);
+    }
+    timer->m_cb = nullptr;
+    timer->m_self.reset();
+    Timer::ptr self = std::move(timer->m_postSelf);
+    timer = next;
+  }
+  if (m_timers.empty()) {
+    m_nextExpire = ~0ull;
+  }
+}
+
 bool TimerManager::hasTimer() {
   RWMutexType::ReadLock lock(m_mutex);
   return !m_timers.empty();
 }
-/**
- * @func: 
- * @param {uint64_t} now_ms
- * @return {*}
- * @description: 检查服务器时间是否被更改
- */
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-  bool rollover = false;
-  if (now_ms < m_previousTime && now_ms < (m_previousTime - -60 * 60 * 1000)) {
-    rollover = true;
-  }
-  m_previousTime = now_ms;
-  return rollover;
-}
 
 }
\ No newline at end of file
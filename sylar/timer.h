@@ -13,16 +13,35 @@
 #define __SYLAR_TIMER_H__
 
 #include "sylar/mutex.h"
+#include <atomic>
 #include <cstdint>
 #include <functional>
+#include <cstddef>
 #include <memory>
-#include <set>
 #include <vector>
 namespace sylar {
 
-// 定时器事件，规定在m_ms秒后发生m_cb事件
 class TimerManager;
-class Timer : public std::enable_shared_from_this<Timer> {
+class TimerWheel;
+
+// 时间轮中的节点，Timer和IntrusiveTimer共用
+class TimerNode {
+  friend class TimerManager;
+  friend class TimerWheel;
+
+protected:
+  // 到期时间，单调时钟的微秒数
+  uint64_t m_next = 0;
+  // 是否为IntrusiveTimer
+  bool m_intrusive = false;
+  // 时间轮槽位中的双向链表，不在时间轮中时m_slot为nullptr
+  TimerNode *m_prev = nullptr;
+  TimerNode *m_succ = nullptr;
+  TimerNode **m_slot = nullptr;
+};
+
+// 定时器事件，规定在m_us微秒后发生m_cb事件
+class Timer : public TimerNode, public std::enable_shared_from_this<Timer> {
   friend class TimerManager;
 
 public:
@@ -34,32 +53,129 @@ public:
   bool refresh();
   // 重置该定时任务
   bool reset(uint64_t ms, bool from_now);
+  // 以微秒为单位重置该定时任务
+  bool resetUS(uint64_t us, bool from_now);
 
 private:
-  Timer(uint64_t ms, std::function<void()> cb, bool recurring,
+  Timer(uint64_t us, std::function<void()> cb, bool recurring,
         TimerManager *manager);
-  Timer(uint64_t next);
 
 private:
   // 是否为循环事件
   bool m_recurring = false;
-  // 定时了多少微妙
-  uint64_t m_ms = 0;
-  // 多少小时后运行（将定时器定义的微秒转化到真实时间）
-  uint64_t m_next = 0;
+  // 定时了多少微秒
+  uint64_t m_us = 0;
   std::function<void()> m_cb;
   TimerManager *m_manager = nullptr;
 
 private:
-  // 确保可以比较
-  struct Comparator {
-    bool operator()(const Timer::ptr &lhs, const Timer::ptr &rhs) const;
-  };
+  // 在时间轮中时持有自己，取消或者触发后释放
+  Timer::ptr m_self;
+  // 非循环定时器已经触发或者已经取消；其他线程取消时只设置这个标记，回调不会再执行
+  std::atomic<bool> m_done = {false};
+  // 其他线程取消后等待所属线程移出时间轮的链表，移出前持有自己
+  Timer *m_postNext = nullptr;
+  Timer::ptr m_postSelf;
+};
+
+// 调用者持有的定时器，不分配内存，用于hook中io的超时
+// 到期时在ListExpiredCb中持有定时器的锁直接调用回调，回调要很短，并且不能再操作定时器；
+// cancel返回后回调要么已经执行完，要么不会再执行，所以可以放在协程栈上
+class IntrusiveTimer : public TimerNode {
+  friend class TimerManager;
+
+public:
+  typedef void (*Callback)(IntrusiveTimer *timer);
+
+  IntrusiveTimer() { m_intrusive = true; }
+  // 没有被cancel的定时器析构前必须已经触发
+  ~IntrusiveTimer() {}
 
+  /**
+   * @func:
+   * @return {*} 还没有触发时返回true；已经触发或者没有加入时返回false
+   * @description: 取消定时器，其他线程的定时器也直接加锁移除
+   */
+  bool cancel();
+
+private:
+  IntrusiveTimer(const IntrusiveTimer &) = delete;
+  IntrusiveTimer &operator=(const IntrusiveTimer &) = delete;
+
+private:
+  Callback m_cb = nullptr;
+  TimerManager *m_manager = nullptr;
+};
+
+// 分层时间轮，槽位按1ms划分，到期时间精确到微秒，插入和删除都是O(1)
+// 第0层256个槽，每槽1ms；第1~4层各64个槽，每槽覆盖下一层一圈的时间，共覆盖2^32ms
+// 推进到上层槽位的边界时，把该槽的定时器重新分配到下层
+// 当前这1ms的槽只取出已经到期的定时器，其余留到下次推进
+// 本身不加锁，由TimerManager的锁保护
+class TimerWheel {
+public:
+  TimerWheel(uint64_t now_us);
+
+  /**
+   * @func:
+   * @return {*}
+   * @description: 按timer->m_next放入对应的槽，已经过期的放到下一个要处理的槽
+   */
+  void add(TimerNode *timer);
+  void remove(TimerNode *timer);
+
+  /**
+   * @func:
+   * @param {uint64_t} now_us
+   * @param {vector<TimerNode *>} &expired
+   * @return {*}
+   * @description: 推进到now_us，到期的定时器按到期时间顺序追加到expired
+   */
+  void advance(uint64_t now_us, std::vector<TimerNode *> &expired);
+
+  /**
+   * @func:
+   * @return {*}
+   * @description: 取出所有定时器，并把当前时间设为now_us
+   */
+  void takeAll(uint64_t now_us, std::vector<TimerNode *> &out);
+
+  /**
+   * @func:
+   * @return {*} 没有定时器时返回~0ull
+   * @description: 最早的到期时间(微秒)，每层只看第一个非空槽
+   */
+  uint64_t nextExpire() const;
+
+  std::size_t size() const { return m_count; }
+  bool empty() const { return m_count == 0; }
+
+private:
+  static const int ROOT_BITS = 8;
+  static const int LEVEL_BITS = 6;
+  static const int LEVELS = 4;
+  static const std::size_t ROOT_SIZE = 1 << ROOT_BITS;
+  static const std::size_t LEVEL_SIZE = 1 << LEVEL_BITS;
+
+  TimerNode **slotFor(uint64_t expire_us);
+  // 把第level层(1~LEVELS)的index槽重新分配到下层
+  void cascade(int level, std::size_t index);
+  void takeSlot(TimerNode **slot, std::vector<TimerNode *> &out);
+  // 只取出槽中到期时间不晚于now_us的定时器
+  void takeExpired(TimerNode **slot, uint64_t now_us,
+                   std::vector<TimerNode *> &out);
+
+private:
+  // 下一个要处理的毫秒，比它早的都已经处理过
+  uint64_t m_current;
+  std::size_t m_count = 0;
+  TimerNode *m_root[ROOT_SIZE];
+  TimerNode *m_levels[LEVELS][LEVEL_SIZE];
 };
 
 class TimerManager {
   friend class Timer;
+  friend class IntrusiveTimer;
 
 public:
   typedef RWMutex RWMutexType;
@@ -70,28 +186,52 @@ public:
   // 增加定时器
   Timer::ptr addTimer(uint64_t ms, std::function<void()> cb,
                       bool recurring = false);
+  // 增加微秒精度的定时器
+  Timer::ptr addTimerUS(uint64_t us, std::function<void()> cb,
+                        bool recurring = false);
   // 增加条件定时器
   Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb,
                                std::weak_ptr<void> weak_cond,
                                bool recurring = false);
-  // 下一个任务还有多少时间触发
+  /**
+   * @func:
+   * @param {IntrusiveTimer} *timer 调用者持有，触发或者cancel之前要保持有效
+   * @return {*}
+   * @description: 加入调用者持有的定时器，ms后在持有锁时调用cb(timer)
+   */
+  void addIntrusiveTimer(IntrusiveTimer *timer, uint64_t ms,
+                         IntrusiveTimer::Callback cb);
+  // 下一个任务还有多少毫秒触发，不足1ms的向上取整
   uint64_t getNextTimer();
+  // 下一个任务还有多少微秒触发
+  uint64_t getNextTimerUS();
   // 获得所有该触发的定时器任务
   void ListExpiredCb(std::vector<std::function<void()>> &cbs);
 
 protected:
   // 增加的定时器是第一个定时器，需要通知一下
   virtual void onTimerInsertedAtFront() = 0;
+  // 定时器属于某个线程时，只有所属线程直接操作时间轮，默认任何线程都可以
+  virtual bool isOwnerThread() const { return true; }
+  // 把刷新、重置交给所属线程执行
+  virtual void postToOwner(std::function<void()> cb) { cb(); }
   void addTimer(Timer::ptr val, RWMutexType::WriteLock &lock);
   bool hasTimer();
 private:
-  bool detectClockRollover(uint64_t now_ms);
+  // 非所属线程取消定时器：标记后放入m_cancelled，不加锁
+  bool postCancel(Timer *timer);
+  // 把节点放入时间轮，是最早到期的节点时通知，会释放锁
+  void addNode(TimerNode *node, RWMutexType::WriteLock &lock);
+  // 把其他线程取消的定时器移出时间轮，需要持有写锁
+  void drainCancelled();
 private:
   RWMutexType m_mutex;
-  // set比较器
-  std::set<Timer::ptr, Timer::Comparator> m_timers;
+  // 其他线程取消的定时器，无锁栈
+  std::atomic<Timer *> m_cancelled = {nullptr};
+  TimerWheel m_timers;
+  // 最早到期时间的下界，取消定时器时不更新，到期处理后重新计算
+  uint64_t m_nextExpire = ~0ull;
   bool m_tickled = false;
-  uint64_t m_previousTime = 0;
 };
 
 }
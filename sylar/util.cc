@@ -13,6 +13,7 @@
 #include "sylar/log.h"
 #include <bits/types/struct_timeval.h>
 #include <sys/time.h>
+#include <time.h>
 #include <cstddef>
 #include <cstdlib>
 #include <pthread.h>
@@ -76,4 +77,22 @@ uint64_t GetCurrentUS() {
   gettimeofday(&tv, NULL);
   return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
 }
+
+uint64_t GetMonotonicMS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
+uint64_t GetMonotonicUS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
+uint64_t GetCoarseMonotonicMS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
 }
\ No newline at end of file
@@ -24,7 +24,15 @@ uint32_t getFiberId();
 void BackTrace(std::vector<std::string> &bt, int size = 64, int skip = 1);
 std::string BackTraceToString(int size = 64, int skip = 2, const std::string& prefix = "");
 
+// 系统时间，会随着修改系统时间跳变，只用于显示和统计
 uint64_t GetCurrentMS();
 uint64_t GetCurrentUS();
+
+// 单调时钟(CLOCK_MONOTONIC)，不受修改系统时间影响，定时器使用
+uint64_t GetMonotonicMS();
+uint64_t GetMonotonicUS();
+// 粗粒度单调时钟(CLOCK_MONOTONIC_COARSE)，精度为内核tick(一般为几毫秒)，
+// 读取比GetMonotonicMS快数倍，用于连接池存活时间这类不需要精确的场合
+uint64_t GetCoarseMonotonicMS();
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,239 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 01:48:37
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 01:48:37
+ * @FilePath     : /tests/test_async_log.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 01:48:37
+ */
+
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/log_async.h"
+#include "sylar/marco.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int THREADS = 4;
+static const int PER_THREAD = 20000;
+static const int BENCH = 100000;
+
+static std::vector<std::string> ReadLines(const std::string &path) {
+  std::vector<std::string> lines;
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+static sylar::Logger::ptr MakeLogger(const std::string &name,
+                                     sylar::LogAppender::ptr appender) {
+  sylar::Logger::ptr logger(new sylar::Logger(name));
+  appender->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  logger->addAppender(appender);
+  return logger;
+}
+
+// 多个线程同时写，BLOCK模式一条不丢，每个线程自己的日志保持顺序
+void test_order() {
+  std::string path = "/tmp/test_async_log_order.txt";
+  unlink(path.c_str());
+  sylar::Logger::ptr logger = MakeLogger(
+      "async_order", sylar::LogAppender::ptr(new sylar::AsyncLogAppender(path)));
+
+  std::vector<sylar::Thread::ptr> thrs;
+  for (int t = 0; t < THREADS; ++t) {
+    thrs.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger, t]() {
+          for (int i = 0; i < PER_THREAD; ++i) {
+            SYLAR_LOG_INFO(logger) << t << " " << i;
+          }
+        },
+        "async_" + std::to_string(t))));
+  }
+  for (auto &thr : thrs) {
+    thr->join();
+  }
+  sylar::AsyncLogWriterMgr::getInstance()->flush();
+
+  std::vector<std::string> lines = ReadLines(path);
+  std::vector<int> next(THREADS, 0);
+  int bad = 0;
+  for (auto &line : lines) {
+    int t = -1;
+    int i = -1;
+    if (sscanf(line.c_str(), "%d %d", &t, &i) != 2 || t < 0 || t >= THREADS ||
+        i != next[t]) {
+      ++bad;
+      continue;
+    }
+    ++next[t];
+  }
+  SYLAR_LOG_INFO(g_logger) << "order lines=" << lines.size() << " bad=" << bad;
+  SYLAR_ASSERT(lines.size() == (size_t)THREADS * PER_THREAD && bad == 0);
+}
+
+// 缓冲区满时丢弃，写出的条数加上报告的丢弃条数等于总数
+void test_drop_count() {
+  std::string path = "/tmp/test_async_log_drop.txt";
+  unlink(path.c_str());
+  sylar::AsyncLogAppender::ptr appender(
+      new sylar::AsyncLogAppender(path, sylar::AsyncLogWriter::DROP_COUNT));
+  sylar::Logger::ptr logger = MakeLogger("async_drop", appender);
+
+  const int total = 200000;
+  std::string padding(80, 'x');
+  for (int i = 0; i < total; ++i) {
+    SYLAR_LOG_INFO(logger) << i << " " << padding;
+  }
+  sylar::AsyncLogWriterMgr::getInstance()->flush();
+
+  uint64_t written = 0;
+  uint64_t reported = 0;
+  for (auto &line : ReadLines(path)) {
+    unsigned long long n = 0;
+    if (sscanf(line.c_str(), "async log dropped %llu messages", &n) == 1) {
+      reported += n;
+    } else {
+      ++written;
+    }
+  }
+  SYLAR_LOG_INFO(g_logger) << "drop written=" << written
+                           << " dropped=" << appender->getDropped()
+                           << " reported=" << reported;
+  SYLAR_ASSERT(reported == appender->getDropped());
+  SYLAR_ASSERT(written + reported == (uint64_t)total);
+}
+
+// 线程退出时析构的线程局部变量还在写日志，比如Fiber::~Fiber
+struct ExitLogger {
+  sylar::Logger::ptr logger;
+  ~ExitLogger() {
+    if (logger) {
+      // 等后台线程释放已经交出的缓冲区，之后还往里写就是访问已释放的内存
+      usleep(50 * 1000);
+      SYLAR_LOG_INFO(logger) << "exit " << sylar::getThreadId();
+    }
+  }
+};
+
+static thread_local ExitLogger t_exit_logger;
+
+// 线程局部变量按构造的逆序析构，先构造的ExitLogger在缓冲区交出之后才析构，
+// 这时的日志改为同步写，不能丢也不能访问已经交出的缓冲区
+void test_thread_exit() {
+  std::string path = "/tmp/test_async_log_exit.txt";
+  unlink(path.c_str());
+  sylar::Logger::ptr logger = MakeLogger(
+      "async_exit", sylar::LogAppender::ptr(new sylar::AsyncLogAppender(path)));
+
+  std::vector<sylar::Thread::ptr> thrs;
+  for (int t = 0; t < THREADS; ++t) {
+    thrs.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger]() {
+          t_exit_logger.logger = logger;
+          for (int i = 0; i < 100; ++i) {
+            SYLAR_LOG_INFO(logger) << "run " << i;
+          }
+        },
+        "async_exit_" + std::to_string(t))));
+  }
+  for (auto &thr : thrs) {
+    thr->join();
+  }
+  sylar::AsyncLogWriterMgr::getInstance()->flush();
+
+  std::vector<std::string> lines = ReadLines(path);
+  int exits = 0;
+  for (auto &line : lines) {
+    if (line.compare(0, 5, "exit ") == 0) {
+      ++exits;
+    }
+  }
+  SYLAR_LOG_INFO(g_logger) << "thread exit lines=" << lines.size()
+                           << " exits=" << exits;
+  SYLAR_ASSERT(lines.size() == (size_t)THREADS * 101 && exits == THREADS);
+}
+
+// 通过配置创建异步appender
+void test_yaml() {
+  std::string path = "/tmp/test_async_log_yaml.txt";
+  unlink(path.c_str());
+  YAML::Node root = YAML::Load("logs:\n"
+                               "  - name: async_yaml\n"
+                               "    level: info\n"
+                               "    formatter: \"%m%n\"\n"
+                               "    appenders:\n"
+                               "      - type: FileLogAppender\n"
+                               "        path: " + path + "\n"
+                               "        async: true\n"
+                               "        overflow: drop_count\n");
+  sylar::Config::LoadFromYaml(root);
+  sylar::Logger::ptr logger = SYLAR_LOG_NAME("async_yaml");
+  std::string yaml = logger->toYamlString();
+  SYLAR_ASSERT(yaml.find("async: true") != std::string::npos);
+  SYLAR_ASSERT(yaml.find("overflow: drop_count") != std::string::npos);
+
+  SYLAR_LOG_INFO(logger) << "from yaml";
+  sylar::AsyncLogWriterMgr::getInstance()->flush();
+  std::vector<std::string> lines = ReadLines(path);
+  SYLAR_ASSERT(lines.size() == 1 && lines[0] == "from yaml");
+  SYLAR_LOG_INFO(g_logger) << "yaml ok";
+}
+
+// 调用方看到的每次写日志的耗时
+static void bench(const std::string &name, sylar::Logger::ptr logger) {
+  std::vector<uint64_t> cost;
+  cost.reserve(BENCH);
+  for (int i = 0; i < BENCH; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    SYLAR_LOG_INFO(logger) << "bench message " << i;
+    auto end = std::chrono::steady_clock::now();
+    cost.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count());
+  }
+  std::sort(cost.begin(), cost.end());
+  SYLAR_LOG_INFO(g_logger) << name << " p50=" << cost[BENCH / 2]
+                           << "ns p99=" << cost[BENCH * 99 / 100]
+                           << "ns max=" << cost.back() << "ns";
+}
+
+void test_bench() {
+  std::string sync_path = "/tmp/test_async_log_bench_sync.txt";
+  std::string async_path = "/tmp/test_async_log_bench_async.txt";
+  unlink(sync_path.c_str());
+  unlink(async_path.c_str());
+  bench("sync ", MakeLogger("bench_sync", sylar::LogAppender::ptr(
+                                              new sylar::FileAppender(sync_path))));
+  bench("async", MakeLogger("bench_async",
+                            sylar::LogAppender::ptr(
+                                new sylar::AsyncLogAppender(async_path))));
+  sylar::AsyncLogWriterMgr::getInstance()->flush();
+  SYLAR_ASSERT(ReadLines(async_path).size() == (size_t)BENCH);
+}
+
+int main() {
+  // 小缓冲区更容易测到丢弃
+  sylar::Config::Lookup<uint32_t>("log.async.buffer_size")->setValue(64 * 1024);
+  test_order();
+  test_drop_count();
+  test_thread_exit();
+  test_yaml();
+  test_bench();
+  return 0;
+}
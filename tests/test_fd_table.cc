@@ -0,0 +1,103 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 00:12:40
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 00:12:40
+ * @FilePath     : /tests/test_fd_table.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 00:12:40
+ */
+
+#include "sylar/fd_table.h"
+#include "sylar/log.h"
+#include "sylar/marco.h"
+#include "sylar/mutex.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+struct Item {
+  int fd;
+};
+
+static const int N = 5000;
+static const int LOOKUPS = 2000000;
+
+// 多个线程同时创建和读取，同一个fd只能创建出一个对象
+void test_concurrent() {
+  sylar::FdTable<Item> table;
+  std::atomic<int> created = {0};
+  std::atomic<int> bad = {0};
+  std::vector<sylar::Thread::ptr> thrs;
+  for (int t = 0; t < 4; ++t) {
+    thrs.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [&table, &created, &bad, t]() {
+          for (int i = 0; i < N; ++i) {
+            int fd = (i * 7 + t * 13) % N;
+            Item *item = table.getOrCreate(fd, [fd, &created]() {
+              ++created;
+              return new Item{fd};
+            });
+            if (!item || item->fd != fd || table.get(fd) != item) {
+              ++bad;
+            }
+          }
+        },
+        "fd_table_" + std::to_string(t))));
+  }
+  for (auto &thr : thrs) {
+    thr->join();
+  }
+
+  int count = 0;
+  table.foreach([&count](int fd, Item *item) {
+    SYLAR_ASSERT(item->fd == fd);
+    ++count;
+    delete item;
+  });
+  SYLAR_LOG_INFO(g_logger) << "concurrent created=" << created
+                           << " stored=" << count << " bad=" << bad;
+  SYLAR_ASSERT(count == N && bad == 0);
+  SYLAR_ASSERT(table.get(-1) == nullptr);
+  SYLAR_ASSERT(table.get(sylar::FdTable<Item>::Capacity) == nullptr);
+}
+
+// 和原来的读写锁+vector查找对比
+void test_lookup() {
+  sylar::FdTable<Item> table;
+  std::vector<Item *> vec(1024);
+  sylar::RWMutex mutex;
+  for (int i = 0; i < 1024; ++i) {
+    vec[i] = table.getOrCreate(i, [i]() { return new Item{i}; });
+  }
+
+  uint64_t sum = 0;
+  uint64_t start = sylar::GetCurrentUS();
+  for (int i = 0; i < LOOKUPS; ++i) {
+    sum += table.get(i & 1023)->fd;
+  }
+  uint64_t table_us = sylar::GetCurrentUS() - start;
+
+  start = sylar::GetCurrentUS();
+  for (int i = 0; i < LOOKUPS; ++i) {
+    sylar::RWMutex::ReadLock lock(mutex);
+    sum += vec[i & 1023]->fd;
+  }
+  uint64_t locked_us = sylar::GetCurrentUS() - start;
+
+  SYLAR_LOG_INFO(g_logger) << "lookup table=" << table_us * 1000 / LOOKUPS
+                           << "ns rwmutex=" << locked_us * 1000 / LOOKUPS
+                           << "ns sum=" << sum;
+  table.foreach([](int fd, Item *item) { delete item; });
+}
+
+int main() {
+  test_concurrent();
+  test_lookup();
+  return 0;
+}
@@ -11,7 +11,9 @@
 #include "sylar/fiber.h"
 #include "sylar/log.h"
 #include "sylar/config.h"
+#include "sylar/stack_allocator.h"
 #include "sylar/thread.h"
+#include "sylar/util.h"
 #include <cstddef>
 #include <iostream>
 #include <string>
@@ -39,8 +41,46 @@ sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 //   SYLAR_LOG_INFO(g_logger) << "main fiber finish";
 // }
 
+// 反复创建销毁协程，栈应当从线程缓存中分配
+void test_stack_pool() {
+  sylar::Fiber::GetThis();
+  for (int i = 0; i < 1000; ++i) {
+    sylar::Fiber::ptr fiber(new sylar::Fiber([]() {}, 0, true));
+    fiber->call();
+  }
+  SYLAR_LOG_INFO(g_logger) << "stack pool hits="
+                           << sylar::PooledStackAllocator::GetHits()
+                           << " misses="
+                           << sylar::PooledStackAllocator::GetMisses()
+                           << " cached="
+                           << sylar::PooledStackAllocator::GetCached();
+}
+
+// 测量一次协程切换的耗时，对比汇编切换和ucontext
+void test_switch() {
+  const int n = 1000000;
+  sylar::Fiber::GetThis();
+  sylar::Fiber::ptr fiber(new sylar::Fiber([]() {
+    for (int i = 0; i < n; ++i) {
+      sylar::Fiber::GetThis()->back();
+    }
+  }, 0, true));
+  uint64_t start = sylar::GetCurrentUS();
+  for (int i = 0; i < n; ++i) {
+    fiber->call();
+  }
+  uint64_t used = sylar::GetCurrentUS() - start;
+  fiber->call();
+  SYLAR_LOG_INFO(g_logger) << "switch asm=" << SYLAR_ASM_CONTEXT
+                           << " round trips=" << n << " used=" << used
+                           << "us per switch=" << used * 1000.0 / n / 2
+                           << "ns";
+}
+
 int main() {
   sylar::Thread::SetName("main");
+  test_stack_pool();
+  test_switch();
   std::vector<sylar::Thread::ptr> thrs;
 
   // for (int i = 0; i < 3; i++) {
@@ -11,12 +11,17 @@
 #include "sylar/util.h"
 #include "sylar/iomanager.h"
 #include "sylar/log.h"
+#include "sylar/marco.h"
 #include "sylar/hook.h"
+#include "sylar/fdmanager.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <string.h>
+#include <atomic>
+#include <fcntl.h>
+#include <string>
 
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
@@ -74,7 +79,152 @@ void test_sock() {
     buff.resize(rt);
     SYLAR_LOG_INFO(g_logger) << buff;
 }
-int main() {
+// hook的fcntl比原始调用多一次FdManager查找
+void bench_lookup() {
+  const int n = 1000000;
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  sylar::FdMgr::getInstance()->get(sock, true);
+
+  uint64_t start = sylar::GetCurrentUS();
+  uint64_t sum = 0;
+  for (int i = 0; i < n; ++i) {
+    sum += (uint64_t)sylar::FdMgr::getInstance()->get(sock).get();
+  }
+  uint64_t get_us = sylar::GetCurrentUS() - start;
+
+  start = sylar::GetCurrentUS();
+  for (int i = 0; i < n; ++i) {
+    sum += fcntl_f(sock, F_GETFL);
+  }
+  uint64_t raw_us = sylar::GetCurrentUS() - start;
+
+  start = sylar::GetCurrentUS();
+  for (int i = 0; i < n; ++i) {
+    sum += fcntl(sock, F_GETFL);
+  }
+  uint64_t hook_us = sylar::GetCurrentUS() - start;
+
+  SYLAR_LOG_ERROR(g_logger) << "FdManager::get=" << get_us * 1000 / n
+                            << "ns fcntl raw=" << raw_us * 1000 / n
+                            << "ns hooked=" << hook_us * 1000 / n
+                            << "ns sum=" << sum;
+  close(sock);
+}
+
+// 协程等待时fd被close，同一个fd马上被新的socket复用并且带超时等待
+void test_close_wait() {
+  sylar::IOManager iom(1, false, "close_wait");
+  iom.schedule([&iom]() {
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    sylar::FdMgr::getInstance()->get(sv[0], true);
+    sylar::FdMgr::getInstance()->get(sv[1], true);
+    int fd = sv[0];
+    int first_errno = 0;
+    iom.schedule([fd, &first_errno]() {
+      char c;
+      int rt = recv(fd, &c, 1, 0);
+      first_errno = rt == -1 ? errno : 0;
+    });
+    // 等第一个协程进入等待
+    usleep(1000);
+    close(fd);
+    close(sv[1]);
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    sylar::FdMgr::getInstance()->get(sv[0], true);
+    sylar::FdMgr::getInstance()->get(sv[1], true);
+    timeval tv = {0, 20000};
+    setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char c;
+    uint64_t start = sylar::GetMonotonicMS();
+    int rt = recv(sv[0], &c, 1, 0);
+    int second_errno = errno;
+    uint64_t used = sylar::GetMonotonicMS() - start;
+    SYLAR_LOG_ERROR(g_logger) << "close_wait reused=" << (sv[0] == fd)
+                              << " first errno=" << first_errno
+                              << " second rt=" << rt << " errno=" << second_errno
+                              << " used=" << used << "ms";
+    SYLAR_ASSERT(rt == -1 && second_errno == ETIMEDOUT && used >= 20);
+    close(sv[0]);
+    close(sv[1]);
+  });
+}
+
+// 协程在fd上等待时另一个线程不停get和fcntl，同时close；用asan检查FdCtx不会在使用中被释放
+void test_close_race() {
+  const int n = 2000;
+  std::atomic<int> cur_fd = {-1};
+  std::atomic<bool> stop = {false};
+  std::atomic<uint64_t> lookups = {0};
+  sylar::Thread hammer(
+      [&cur_fd, &stop, &lookups]() {
+        while (!stop) {
+          int fd = cur_fd;
+          if (fd < 0) {
+            continue;
+          }
+          sylar::FdCtxRef ctx = sylar::FdMgr::getInstance()->get(fd);
+          if (ctx) {
+            ctx->isClose();
+            ctx->getTimeout(SO_RCVTIMEO);
+          }
+          fcntl(fd, F_GETFL);
+          ++lookups;
+        }
+      },
+      "hammer");
+
+  std::atomic<int> done = {0};
+  std::atomic<int> bad = {0};
+  {
+    sylar::IOManager iom(2, false, "close_race");
+    iom.schedule([&]() {
+      for (int i = 0; i < n; ++i) {
+        int sv[2];
+        SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        sylar::FdMgr::getInstance()->get(sv[0], true);
+        sylar::FdMgr::getInstance()->get(sv[1], true);
+        int fd = sv[0];
+        cur_fd = fd;
+        sylar::IOManager::GetThis()->schedule([fd, &done, &bad]() {
+          char c;
+          int rt = recv(fd, &c, 1, 0);
+          if (rt != -1 || errno != EBADF) {
+            ++bad;
+          }
+          ++done;
+        });
+        // 让等待的协程先挂起
+        usleep(50);
+        close(fd);
+        close(sv[1]);
+        while (done < i + 1) {
+          usleep(50);
+        }
+      }
+    });
+  }
+  stop = true;
+  hammer.join();
+  SYLAR_LOG_ERROR(g_logger) << "close_race rounds=" << done
+                            << " bad=" << bad << " lookups=" << lookups;
+  SYLAR_ASSERT(done == n && bad == 0);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "close") {
+    test_close_wait();
+    return 0;
+  }
+  if (argc > 1 && std::string(argv[1]) == "race") {
+    test_close_race();
+    return 0;
+  }
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    bench_lookup();
+    return 0;
+  }
   // test_sleep();
   sylar::IOManager iom;
   iom.schedule(test_sock);
@@ -9,8 +9,11 @@
  * 2024-04-02 15:32:48
  */
 
+#include "sylar/config.h"
+#include "sylar/fdmanager.h"
 #include "sylar/iomanager.h"
 #include "sylar/log.h"
+#include "sylar/marco.h"
 #include "sylar/timer.h"
 #include "sylar/util.h"
 #include <sys/types.h>
@@ -19,6 +22,10 @@
 #include <fcntl.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
@@ -77,7 +84,222 @@ void test_timer() {
     }, true);
 }
 
-int main() {
+// 同时触发64个fd的读事件，idle一轮epoll_wait把回调攒成一批调度
+void test_burst() {
+  const int n = 64;
+  const int rounds = 1000;
+  std::atomic<int> done = {0};
+  std::vector<int> fds(n * 2);
+  for (int i = 0; i < n; ++i) {
+    socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i * 2]);
+    sylar::FdMgr::getInstance()->get(fds[i * 2], true);
+  }
+
+  sylar::IOManager iom(2, false, "burst");
+  uint64_t start = sylar::GetCurrentUS();
+  std::atomic<int> armed = {0};
+  for (int r = 0; r < rounds; ++r) {
+    // addEvent要在调度器的线程中调用
+    iom.schedule([&fds, &done, &armed]() {
+      for (int i = 0; i < n; ++i) {
+        int fd = fds[i * 2];
+        sylar::IOManager::GetThis()->addEvent(
+            fd, sylar::IOManager::READ, [fd, &done]() {
+              char c;
+              read(fd, &c, 1);
+              ++done;
+            });
+      }
+      ++armed;
+    });
+    while (armed <= r) {
+      usleep(10);
+    }
+    for (int i = 0; i < n; ++i) {
+      write(fds[i * 2 + 1], "x", 1);
+    }
+    while (done < (r + 1) * n) {
+      usleep(10);
+    }
+  }
+  uint64_t used = sylar::GetCurrentUS() - start;
+  SYLAR_LOG_ERROR(g_logger) << "burst fds=" << n << " rounds=" << rounds
+                            << " events=" << done << " used=" << used
+                            << "us per event=" << used * 1000 / done << "ns";
+  iom.stop();
+  for (auto fd : fds) {
+    close(fd);
+  }
+}
+
+// 本机tcp连接上的请求应答，hook的accept/connect/recv/send在epoll或io_uring上完成
+void test_pingpong(sylar::IOManager::Backend backend) {
+  const int conns = 8;
+  const int rounds = 5000;
+  std::atomic<int> done = {0};
+  std::atomic<int> timeouts = {0};
+
+  sylar::IOManager iom(2, false, "pingpong", backend);
+  SYLAR_LOG_ERROR(g_logger) << "io_uring=" << iom.isIoUring();
+  int lsock = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  bind(lsock, (sockaddr *)&addr, sizeof(addr));
+  listen(lsock, conns);
+  getsockname(lsock, (sockaddr *)&addr, &len);
+  sylar::FdMgr::getInstance()->get(lsock, true);
+
+  uint64_t start = sylar::GetCurrentUS();
+  iom.schedule([lsock, &iom]() {
+    for (int i = 0; i < conns; ++i) {
+      int fd = accept(lsock, nullptr, nullptr);
+      iom.schedule([fd]() {
+        char buf[64];
+        while (true) {
+          int n = recv(fd, buf, sizeof(buf), 0);
+          if (n <= 0 || send(fd, buf, n, 0) != n) {
+            break;
+          }
+        }
+        close(fd);
+      });
+    }
+  });
+  for (int i = 0; i < conns; ++i) {
+    iom.schedule([addr, &done, &timeouts]() {
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (connect(fd, (const sockaddr *)&addr, sizeof(addr))) {
+        SYLAR_LOG_ERROR(g_logger) << "connect errno=" << errno;
+        return;
+      }
+      char buf[64] = "ping";
+      for (int r = 0; r < rounds; ++r) {
+        if (send(fd, buf, 4, 0) != 4 || recv(fd, buf, sizeof(buf), 0) != 4) {
+          SYLAR_LOG_ERROR(g_logger) << "pingpong errno=" << errno;
+          break;
+        }
+        ++done;
+      }
+      // 对端不会再发数据，读超时
+      timeval tv = {0, 20000};
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      if (recv(fd, buf, sizeof(buf), 0) == -1 && errno == ETIMEDOUT) {
+        ++timeouts;
+      }
+      close(fd);
+    });
+  }
+  iom.stop();
+  uint64_t used = sylar::GetCurrentUS() - start;
+  SYLAR_LOG_ERROR(g_logger) << "pingpong conns=" << conns << " rounds=" << done
+                            << " timeouts=" << timeouts << " used=" << used
+                            << "us per round=" << used * 1000 / std::max(done.load(), 1)
+                            << "ns";
+  close(lsock);
+}
+
+// hook的usleep/nanosleep按微秒睡眠，统计实际睡眠时间
+void test_sleep() {
+  const int fibers = 4;
+  const int rounds = 200;
+  const uint64_t sleep_us = 100;
+  std::atomic<uint64_t> slept = {0};
+  std::atomic<int> too_short = {0};
+
+  sylar::IOManager iom(1, false, "sleep");
+  for (int i = 0; i < fibers; ++i) {
+    iom.schedule([i, &slept, &too_short]() {
+      for (int r = 0; r < rounds; ++r) {
+        uint64_t start = sylar::GetMonotonicUS();
+        if (i % 2) {
+          usleep(sleep_us);
+        } else {
+          timespec ts = {0, (long)sleep_us * 1000};
+          nanosleep(&ts, nullptr);
+        }
+        uint64_t used = sylar::GetMonotonicUS() - start;
+        if (used < sleep_us) {
+          ++too_short;
+        }
+        slept += used;
+      }
+    });
+  }
+  iom.stop();
+  SYLAR_LOG_ERROR(g_logger) << "sleep " << sleep_us << "us x" << fibers * rounds
+                            << " avg=" << slept / (fibers * rounds)
+                            << "us too_short=" << too_short;
+}
+
+// 任务一直不断时线程不进入idle，工作线程自己的定时器也要按时触发
+void test_busy_timer() {
+  const uint64_t timer_ms = 5;
+  const uint64_t busy_ms = 100;
+  std::atomic<uint64_t> fired_us = {0};
+  std::atomic<uint64_t> spins = {0};
+
+  sylar::IOManager iom(1, false, "busy_timer");
+  uint64_t start = sylar::GetMonotonicUS();
+  iom.schedule([&iom, &fired_us, start]() {
+    iom.addTimer(timer_ms, [&fired_us, start]() {
+      fired_us = sylar::GetMonotonicUS() - start;
+    });
+  });
+  // 每个任务结束前再投递一个，队列始终不为空
+  std::function<void()> spin;
+  spin = [&iom, &spin, &spins, start]() {
+    ++spins;
+    if (sylar::GetMonotonicUS() - start < busy_ms * 1000) {
+      iom.schedule(spin);
+    }
+  };
+  iom.schedule(spin);
+  iom.stop();
+  SYLAR_LOG_ERROR(g_logger) << "busy timer " << timer_ms << "ms fired at "
+                            << fired_us << "us spins=" << spins;
+  SYLAR_ASSERT(fired_us > 0 && fired_us < (timer_ms + 20) * 1000);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "pingpong") {
+    g_logger->setLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    std::string mode = argc > 2 ? argv[2] : "epoll";
+    if (mode == "persistent") {
+      sylar::Config::Lookup<bool>("iomanager.epoll_persistent")->setValue(true);
+    } else if (mode == "busypoll") {
+      // 睡眠前先忙轮询，对比唤醒延迟
+      sylar::Config::Lookup<uint32_t>("iomanager.busy_poll_us")->setValue(200);
+    }
+    test_pingpong(mode == "uring" ? sylar::IOManager::IO_URING
+                                  : sylar::IOManager::EPOLL);
+    return 0;
+  }
+  if (argc > 1 && std::string(argv[1]) == "sleep") {
+    g_logger->setLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    if (argc > 2 && std::string(argv[2]) == "slack") {
+      sylar::Config::Lookup<uint32_t>("iomanager.timer_slack_ns")->setValue(1000);
+    }
+    test_sleep();
+    return 0;
+  }
+  if (argc > 1 && std::string(argv[1]) == "burst") {
+    g_logger->setLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    test_burst();
+    return 0;
+  }
+  if (argc > 1 && std::string(argv[1]) == "busy_timer") {
+    g_logger->setLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::Config::Lookup<bool>("iomanager.thread_timers")->setValue(true);
+    test_busy_timer();
+    return 0;
+  }
   // test1();
   test_timer();
   return 0;
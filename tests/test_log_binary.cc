@@ -0,0 +1,252 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 03:18:27
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 03:18:27
+ * @FilePath     : /tests/test_log_binary.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 03:18:27
+ */
+
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/log_binary.h"
+#include "sylar/log_rotate.h"
+#include "sylar/marco.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int N = 100000;
+
+static std::string ReadFile(const std::string &path) {
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+static std::string Decode(const std::string &path,
+                          sylar::LogFormatter::ptr fmt = nullptr) {
+  sylar::BinaryLogReader reader;
+  SYLAR_ASSERT(reader.open(path));
+  std::string out;
+  while (reader.next(out, fmt)) {
+  }
+  return out;
+}
+
+// 轮转出来的path.YYYYMMDD-HHMMSS[.NNN][.gz]，去掉.gz后按文件名排序就是从旧到新
+static std::vector<std::string> ListRotated(const std::string &path) {
+  std::size_t pos = path.rfind('/');
+  std::string dir = path.substr(0, pos);
+  std::string prefix = path.substr(pos + 1) + ".";
+  std::vector<std::string> files;
+  DIR *d = opendir(dir.c_str());
+  SYLAR_ASSERT(d);
+  struct dirent *ent;
+  while ((ent = readdir(d)) != nullptr) {
+    std::string name = ent->d_name;
+    if (name.compare(0, prefix.size(), prefix) == 0) {
+      files.push_back(dir + "/" + name);
+    }
+  }
+  closedir(d);
+  std::sort(files.begin(), files.end(),
+            [](const std::string &a, const std::string &b) {
+              return a.substr(0, a.find(".gz")) < b.substr(0, b.find(".gz"));
+            });
+  return files;
+}
+
+static void RemoveFiles(const std::string &path) {
+  unlink(path.c_str());
+  for (auto &file : ListRotated(path)) {
+    unlink(file.c_str());
+  }
+}
+
+// 同一个logger同时写文本和二进制，解码结果和文本完全一致
+void test_round_trip() {
+  std::string text_path = "/tmp/test_log_binary.txt";
+  std::string bin_path = "/tmp/test_log_binary.bin";
+  unlink(text_path.c_str());
+  RemoveFiles(bin_path);
+
+  sylar::Logger::ptr logger(new sylar::Logger("binary"));
+  sylar::LogAppender::ptr text(new sylar::FileAppender(text_path));
+  sylar::BinaryLogAppender::ptr bin(new sylar::BinaryLogAppender(bin_path));
+  logger->addAppender(text);
+  logger->addAppender(bin);
+
+  std::vector<sylar::Thread::ptr> thrs;
+  for (int t = 0; t < 3; ++t) {
+    thrs.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger, t]() {
+          for (int i = 0; i < 1000; ++i) {
+            SYLAR_LOG_DEBUG(logger) << "thread " << t << " line " << i;
+            SYLAR_LOG_FORMAT_WARN(logger, "%s %d", "formatted", i);
+          }
+        },
+        "binary_" + std::to_string(t))));
+  }
+  for (auto &thr : thrs) {
+    thr->join();
+  }
+  // 写的过程中解析：未写的部分是0，读到已写的最后一条为止
+  std::string live = Decode(bin_path);
+
+  // 中途修改格式，之后的记录用新的格式还原
+  logger->setFormatter(
+      sylar::LogFormatter::ptr(new sylar::LogFormatter("[%p] %m%n")));
+  SYLAR_LOG_ERROR(logger) << "after pattern change";
+  logger->clearAppenders();
+  text.reset();
+  bin.reset();
+
+  std::string expect = ReadFile(text_path);
+  std::string decoded = Decode(bin_path);
+  SYLAR_ASSERT(decoded == expect);
+  SYLAR_ASSERT(expect.compare(0, live.size(), live) == 0);
+  SYLAR_ASSERT(decoded.size() > live.size());
+
+  sylar::LogFormatter::ptr msg(new sylar::LogFormatter("%m%n"));
+  std::string messages = Decode(bin_path, msg);
+  SYLAR_ASSERT(messages.find("formatted 999\n") != std::string::npos);
+  SYLAR_LOG_INFO(g_logger) << "round trip ok bytes=" << expect.size();
+}
+
+// 写满后和文本日志一样改名轮转，后台压缩并只保留max_files个旧文件，每个文件单独可以解析
+void test_rotate() {
+  std::string path = "/tmp/test_log_binary_rotate.bin";
+  RemoveFiles(path);
+  sylar::LogRotatePolicy policy;
+  policy.max_size = 16 * 1024;
+  policy.max_files = 3;
+  policy.compress = true;
+  sylar::Logger::ptr logger(new sylar::Logger("binary_rotate"));
+  logger->addAppender(
+      sylar::LogAppender::ptr(new sylar::BinaryLogAppender(path, policy)));
+  for (int i = 0; i < 5000; ++i) {
+    SYLAR_LOG_INFO(logger) << i;
+  }
+  logger->clearAppenders();
+  sylar::LogCompressorMgr::getInstance()->flush();
+  std::vector<std::string> files = ListRotated(path);
+  SYLAR_ASSERT(files.size() == 3);
+
+  // 从最旧到最新，内容是连续的
+  sylar::LogFormatter::ptr msg(new sylar::LogFormatter("%m%n"));
+  std::string all;
+  for (auto &file : files) {
+    SYLAR_ASSERT(file.compare(file.size() - 3, 3, ".gz") == 0);
+    all += Decode(file, msg);
+  }
+  all += Decode(path, msg);
+  std::stringstream ss(all);
+  int first = -1;
+  int prev = -1;
+  int value;
+  while (ss >> value) {
+    if (first < 0) {
+      first = value;
+    } else {
+      SYLAR_ASSERT(value == prev + 1);
+    }
+    prev = value;
+  }
+  SYLAR_LOG_INFO(g_logger) << "rotate kept " << first << ".." << prev;
+  SYLAR_ASSERT(first > 0 && prev == 4999);
+}
+
+// 重新打开时已有的文件只改名一次，不会把旧文件依次后移
+void test_reopen() {
+  std::string path = "/tmp/test_log_binary_reopen.bin";
+  RemoveFiles(path);
+  sylar::LogFormatter::ptr msg(new sylar::LogFormatter("%m%n"));
+  sylar::Logger::ptr logger(new sylar::Logger("binary_reopen"));
+  logger->addAppender(
+      sylar::LogAppender::ptr(new sylar::BinaryLogAppender(path)));
+  SYLAR_LOG_INFO(logger) << "first";
+  logger->clearAppenders();
+  logger->addAppender(
+      sylar::LogAppender::ptr(new sylar::BinaryLogAppender(path)));
+  SYLAR_LOG_INFO(logger) << "second";
+  logger->clearAppenders();
+  sylar::LogCompressorMgr::getInstance()->flush();
+
+  std::vector<std::string> files = ListRotated(path);
+  SYLAR_ASSERT(files.size() == 1);
+  SYLAR_ASSERT(Decode(files[0], msg) == "first\n");
+  SYLAR_ASSERT(Decode(path, msg) == "second\n");
+  SYLAR_LOG_INFO(g_logger) << "reopen ok " << files[0];
+}
+
+void test_yaml() {
+  std::string path = "/tmp/test_log_binary_yaml.bin";
+  RemoveFiles(path);
+  YAML::Node root = YAML::Load("logs:\n"
+                               "  - name: binary_yaml\n"
+                               "    level: debug\n"
+                               "    appenders:\n"
+                               "      - type: BinaryLogAppender\n"
+                               "        path: " + path + "\n"
+                               "        max_size: 1048576\n"
+                               "        max_files: 2\n");
+  sylar::Config::LoadFromYaml(root);
+  sylar::Logger::ptr logger = SYLAR_LOG_NAME("binary_yaml");
+  std::string yaml = logger->toYamlString();
+  SYLAR_ASSERT(yaml.find("BinaryLogAppender") != std::string::npos);
+  SYLAR_ASSERT(yaml.find("max_files: 2") != std::string::npos);
+  SYLAR_LOG_DEBUG(logger) << "from yaml";
+  sylar::LogFormatter::ptr msg(new sylar::LogFormatter("%m%n"));
+  SYLAR_ASSERT(Decode(path, msg) == "from yaml\n");
+  // 打开时就分配好全部磁盘块，不是稀疏文件
+  struct stat st;
+  SYLAR_ASSERT(stat(path.c_str(), &st) == 0);
+  SYLAR_ASSERT((uint64_t)st.st_blocks * 512 >= 1048576);
+  SYLAR_LOG_INFO(g_logger) << "yaml ok";
+}
+
+static void bench(const std::string &name, sylar::LogAppender::ptr appender) {
+  sylar::Logger::ptr logger(new sylar::Logger("bench"));
+  logger->addAppender(appender);
+  uint64_t start = sylar::GetCurrentUS();
+  for (int i = 0; i < N; ++i) {
+    SYLAR_LOG_DEBUG(logger) << "request path=/index.html status=" << 200
+                            << " bytes=" << i;
+  }
+  uint64_t cost = sylar::GetCurrentUS() - start;
+  SYLAR_LOG_INFO(g_logger) << name << " lines/s=" << N * 1000000ull / cost;
+}
+
+void test_bench() {
+  std::string text_path = "/tmp/test_log_binary_bench.txt";
+  std::string bin_path = "/tmp/test_log_binary_bench.bin";
+  unlink(text_path.c_str());
+  RemoveFiles(bin_path);
+  bench("text  ", sylar::LogAppender::ptr(new sylar::FileAppender(text_path)));
+  bench("binary", sylar::LogAppender::ptr(new sylar::BinaryLogAppender(bin_path)));
+  SYLAR_LOG_INFO(g_logger) << "sizes text=" << ReadFile(text_path).size()
+                           << " binary=" << ReadFile(bin_path).size();
+}
+
+int main() {
+  test_round_trip();
+  test_rotate();
+  test_reopen();
+  test_yaml();
+  test_bench();
+  return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 02:05:26
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 02:05:26
+ * @FilePath     : /tests/test_log_event.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 02:05:26
+ */
+
+// 这个文件里DEBUG级别的日志在编译期去掉
+#undef SYLAR_LOG_MIN_LEVEL
+#define SYLAR_LOG_MIN_LEVEL 2
+
+#include "sylar/log.h"
+#include "sylar/marco.h"
+#include "sylar/util.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int N = 200000;
+
+// 统计全局的内存分配次数
+static std::atomic<uint64_t> s_allocs = {0};
+
+void *operator new(std::size_t size) {
+  ++s_allocs;
+  void *p = malloc(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+// 只记录内容，不分配内存
+class RecordAppender : public sylar::LogAppender {
+public:
+  typedef std::shared_ptr<RecordAppender> ptr;
+  RecordAppender() { m_last.reserve(256); }
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+           sylar::LogEvent::ptr event) override {
+    ++m_count;
+    m_last.clear();
+    std::stringbuf *buf = event->getSS().rdbuf();
+    std::streamsize size = buf->pubseekoff(0, std::ios_base::cur,
+                                           std::ios_base::out);
+    buf->pubseekoff(0, std::ios_base::beg, std::ios_base::in);
+    m_last.resize(size);
+    buf->sgetn(&m_last[0], size);
+  }
+  std::string toYamlString() override { return ""; }
+
+  int m_count = 0;
+  std::string m_last;
+};
+
+static int s_evaluated = 0;
+
+static int side_effect() { return ++s_evaluated; }
+
+static sylar::Logger::ptr MakeLogger(RecordAppender::ptr &appender) {
+  sylar::Logger::ptr logger(new sylar::Logger("log_event"));
+  appender.reset(new RecordAppender);
+  logger->addAppender(appender);
+  return logger;
+}
+
+// 编译期去掉的语句不求值，运行期关闭的语句只有一次判断
+void test_disabled() {
+  RecordAppender::ptr appender;
+  sylar::Logger::ptr logger = MakeLogger(appender);
+  logger->setLevel(sylar::LogLevel::DEBUG);
+  SYLAR_LOG_DEBUG(logger) << side_effect();
+  SYLAR_LOG_FORMAT_DEBUG(logger, "%d", side_effect());
+  SYLAR_ASSERT(s_evaluated == 0 && appender->m_count == 0);
+
+  logger->setLevel(sylar::LogLevel::ERROR);
+  uint64_t allocs = s_allocs;
+  uint64_t start = sylar::GetCurrentUS();
+  for (int i = 0; i < N; ++i) {
+    SYLAR_LOG_INFO(logger) << side_effect();
+  }
+  uint64_t cost = sylar::GetCurrentUS() - start;
+  SYLAR_ASSERT(s_evaluated == 0 && appender->m_count == 0);
+  SYLAR_ASSERT(s_allocs == allocs);
+  SYLAR_LOG_INFO(g_logger) << "disabled " << cost * 1000 / N << "ns";
+}
+
+// 复用的事件不能带上一条日志的内容和流格式
+void test_reuse() {
+  RecordAppender::ptr appender;
+  sylar::Logger::ptr logger = MakeLogger(appender);
+  SYLAR_LOG_INFO(logger) << std::hex << 255 << " " << std::string(300, 'x');
+  SYLAR_ASSERT(appender->m_last == "ff " + std::string(300, 'x'));
+  SYLAR_LOG_INFO(logger) << 255;
+  SYLAR_ASSERT(appender->m_last == "255");
+  SYLAR_LOG_FORMAT_INFO(logger, "%s-%d", "fmt", 7);
+  SYLAR_ASSERT(appender->m_last == "fmt-7");
+  std::string big(2000, 'y');
+  SYLAR_LOG_FORMAT_INFO(logger, "%s", big.c_str());
+  SYLAR_ASSERT(appender->m_last == big);
+
+  // 写日志的表达式中又写日志，两条都正确
+  auto nested = [&logger]() {
+    SYLAR_LOG_INFO(logger) << "inner";
+    return "outer";
+  };
+  SYLAR_LOG_INFO(logger) << nested();
+  SYLAR_ASSERT(appender->m_last == "outer" && appender->m_count == 6);
+  SYLAR_LOG_INFO(g_logger) << "reuse ok";
+}
+
+// 预热之后打开的日志不再分配内存
+void test_no_alloc() {
+  RecordAppender::ptr appender;
+  sylar::Logger::ptr logger = MakeLogger(appender);
+  for (int i = 0; i < 10; ++i) {
+    SYLAR_LOG_INFO(logger) << "warm up " << i << " " << 3.14;
+  }
+  uint64_t allocs = s_allocs;
+  uint64_t start = sylar::GetCurrentUS();
+  for (int i = 0; i < N; ++i) {
+    SYLAR_LOG_INFO(logger) << "hot path " << i << " " << 3.14;
+  }
+  uint64_t pooled = sylar::GetCurrentUS() - start;
+  uint64_t pooled_allocs = s_allocs - allocs;
+
+  // 原来的写法：每条日志new一个事件
+  allocs = s_allocs;
+  start = sylar::GetCurrentUS();
+  for (int i = 0; i < N; ++i) {
+    sylar::LogEventWrap(
+        sylar::LogEvent::ptr(new sylar::LogEvent(
+            logger, sylar::LogLevel::INFO, __FILE__, __LINE__, 0,
+            sylar::getThreadId(), sylar::getFiberId(), time(0),
+            sylar::Thread::GetName())))
+            .getSS()
+        << "hot path " << i << " " << 3.14;
+  }
+  uint64_t fresh = sylar::GetCurrentUS() - start;
+  uint64_t fresh_allocs = s_allocs - allocs;
+
+  SYLAR_LOG_INFO(g_logger) << "pooled " << pooled * 1000 / N
+                           << "ns allocs=" << pooled_allocs << " new "
+                           << fresh * 1000 / N
+                           << "ns allocs=" << fresh_allocs;
+  SYLAR_ASSERT(appender->m_count == 2 * N + 10);
+  SYLAR_ASSERT(pooled_allocs == 0);
+}
+
+int main() {
+  test_disabled();
+  test_reuse();
+  test_no_alloc();
+  return 0;
+}
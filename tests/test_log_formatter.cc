@@ -0,0 +1,192 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 02:31:52
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 02:31:52
+ * @FilePath     : /tests/test_log_formatter.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 02:31:52
+ */
+
+#include "sylar/log.h"
+#include "sylar/marco.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const char *PATTERN =
+    "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%F%T[%p]%T[%c]%T[%f:%l]%T%m%n";
+static const int N = 200000;
+
+// 原来的实现：每一项一次间接调用，写入stringstream，每行都调用localtime_r和strftime
+class OldFormatter {
+public:
+  typedef std::function<void(std::ostream &, sylar::LogLevel::Level,
+                             const sylar::LogEvent::ptr &)>
+      Item;
+
+  OldFormatter() {
+    m_items.push_back([](std::ostream &os, sylar::LogLevel::Level,
+                         const sylar::LogEvent::ptr &e) {
+      struct tm tm;
+      time_t time = e->getTime();
+      localtime_r(&time, &tm);
+      char buf[64];
+      strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+      os << buf;
+    });
+    addTab();
+    m_items.push_back([](std::ostream &os, sylar::LogLevel::Level,
+                         const sylar::LogEvent::ptr &e) {
+      os << e->getThreadId();
+    });
+    addTab();
+    m_items.push_back([](std::ostream &os, sylar::LogLevel::Level,
+                         const sylar::LogEvent::ptr &e) {
+      os << e->getThreadName() << "    ";
+    });
+    m_items.push_back([](std::ostream &os, sylar::LogLevel::Level,
+                         const sylar::LogEvent::ptr &e) {
+      os << e->getFiberId();
+    });
+    addTab();
+    m_items.push_back([](std::ostream &os, sylar::LogLevel::Level level,
+                         const sylar::LogEvent::ptr &) {
+      os << "[" << sylar::LogLevel::ToString(level) << "]";
+    });
+    addTab();
+    m_items.push_back([](std::ostream &os, sylar::LogLevel::Level,
+                         const sylar::LogEvent::ptr &e) {
+      os << "[" << e->getLogger()->getName() << "]";
+    });
+    addTab();
+    m_items.push_back([](std::ostream &os, sylar::LogLevel::Level,
+                         const sylar::LogEvent::ptr &e) {
+      os << "[" << e->getFile() << ":" << e->getLine() << "]";
+    });
+    addTab();
+    m_items.push_back([](std::ostream &os, sylar::LogLevel::Level,
+                         const sylar::LogEvent::ptr &e) {
+      os << e->getContent() << std::endl;
+    });
+  }
+
+  std::string format(sylar::LogLevel::Level level,
+                     const sylar::LogEvent::ptr &event) {
+    std::stringstream ss;
+    for (auto &i : m_items) {
+      i(ss, level, event);
+    }
+    return ss.str();
+  }
+
+private:
+  void addTab() {
+    m_items.push_back([](std::ostream &os, sylar::LogLevel::Level,
+                         const sylar::LogEvent::ptr &) { os << "\t"; });
+  }
+
+  std::vector<Item> m_items;
+};
+
+static sylar::LogEvent::ptr MakeEvent(sylar::Logger::ptr logger,
+                                      uint64_t time) {
+  sylar::LogEvent::ptr event(new sylar::LogEvent(
+      logger, sylar::LogLevel::INFO, __FILE__, __LINE__, 0,
+      sylar::getThreadId(), sylar::getFiberId(), time,
+      sylar::Thread::GetName()));
+  event->getSS() << "formatter bench message " << 42;
+  return event;
+}
+
+// 编译后的结果和原来逐项格式化的结果一致，跨秒时日期缓存会更新
+void test_same_output() {
+  sylar::Logger::ptr logger(new sylar::Logger("formatter"));
+  sylar::LogFormatter fmt(PATTERN);
+  OldFormatter old;
+  uint64_t now = time(0);
+  for (uint64_t t = now; t < now + 3; ++t) {
+    sylar::LogEvent::ptr event = MakeEvent(logger, t);
+    for (int i = 0; i < 2; ++i) {
+      std::string line = fmt.format(logger, sylar::LogLevel::INFO, event);
+      SYLAR_ASSERT(line == old.format(sylar::LogLevel::INFO, event));
+    }
+  }
+
+  sylar::LogEvent::ptr event = MakeEvent(logger, now);
+  sylar::LogFormatter other("100%% %d{%H:%M}|%c%T%m%n");
+  std::string hm = other.format(logger, sylar::LogLevel::INFO, event);
+  SYLAR_ASSERT(!other.isError());
+  SYLAR_ASSERT(hm.find("100% ") == 0 && hm.size() == 5 + 5 + 1 + 9 + 1 + 26 + 1);
+  SYLAR_ASSERT(hm.substr(10) == "|formatter\tformatter bench message 42\n");
+
+  sylar::LogFormatter tail("[%p] end");
+  SYLAR_ASSERT(tail.format(logger, sylar::LogLevel::WARN, event) == "[WARN] end");
+
+  sylar::LogFormatter bad("%m %Q");
+  SYLAR_ASSERT(bad.isError());
+
+  // 追加到已有内容之后
+  std::string out = "prefix:";
+  sylar::LogFormatter msg("%m");
+  msg.format(out, logger, sylar::LogLevel::INFO, event);
+  msg.format(out, logger, sylar::LogLevel::INFO, event);
+  SYLAR_ASSERT(out == "prefix:formatter bench message 42formatter bench message 42");
+  SYLAR_LOG_INFO(g_logger) << "same output ok";
+}
+
+static void bench(int threads) {
+  sylar::Logger::ptr logger(new sylar::Logger("formatter"));
+  sylar::LogFormatter::ptr fmt(new sylar::LogFormatter(PATTERN));
+  std::vector<uint64_t> old_us(threads);
+  std::vector<uint64_t> new_us(threads);
+  std::vector<sylar::Thread::ptr> thrs;
+  for (int t = 0; t < threads; ++t) {
+    thrs.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger, fmt, t, &old_us, &new_us]() {
+          OldFormatter old;
+          sylar::LogEvent::ptr event = MakeEvent(logger, time(0));
+          std::size_t total = 0;
+          uint64_t start = sylar::GetCurrentUS();
+          for (int i = 0; i < N; ++i) {
+            total += old.format(sylar::LogLevel::INFO, event).size();
+          }
+          old_us[t] = sylar::GetCurrentUS() - start;
+
+          start = sylar::GetCurrentUS();
+          for (int i = 0; i < N; ++i) {
+            std::string *buf = sylar::LogFormatter::GetThreadBuffer();
+            fmt->format(*buf, logger, sylar::LogLevel::INFO, event);
+            total -= buf->size();
+          }
+          new_us[t] = sylar::GetCurrentUS() - start;
+          SYLAR_ASSERT(total == 0);
+        },
+        "fmt_" + std::to_string(t))));
+  }
+  for (auto &thr : thrs) {
+    thr->join();
+  }
+  uint64_t old_rate = 0;
+  uint64_t new_rate = 0;
+  for (int t = 0; t < threads; ++t) {
+    old_rate += N * 1000000ull / old_us[t];
+    new_rate += N * 1000000ull / new_us[t];
+  }
+  SYLAR_LOG_INFO(g_logger) << "threads=" << threads
+                           << " lines/s per thread old=" << old_rate / threads
+                           << " new=" << new_rate / threads;
+}
+
+int main() {
+  test_same_output();
+  bench(1);
+  bench(4);
+  return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 04:31:05
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 04:31:05
+ * @FilePath     : /tests/test_log_rotate.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 04:31:05
+ */
+
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/log_async.h"
+#include "sylar/log_rotate.h"
+#include "sylar/marco.h"
+#include "sylar/util.h"
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+#include <zlib.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const std::string TEST_DIR = "/tmp/test_log_rotate";
+
+// 去掉.gz后按文件名排序就是从旧到新
+static bool RotatedLess(const std::string &a, const std::string &b) {
+  std::string x = a.substr(0, a.find(".gz"));
+  std::string y = b.substr(0, b.find(".gz"));
+  return x < y;
+}
+
+// 目录下以name.开头的文件，从旧到新
+static std::vector<std::string> ListRotated(const std::string &name) {
+  std::vector<std::string> files;
+  DIR *d = opendir(TEST_DIR.c_str());
+  SYLAR_ASSERT(d);
+  struct dirent *ent;
+  while ((ent = readdir(d)) != nullptr) {
+    std::string file = ent->d_name;
+    if (file.compare(0, name.size() + 1, name + ".") == 0) {
+      files.push_back(file);
+    }
+  }
+  closedir(d);
+  std::sort(files.begin(), files.end(), RotatedLess);
+  return files;
+}
+
+static void CleanDir() {
+  mkdir(TEST_DIR.c_str(), 0755);
+  DIR *d = opendir(TEST_DIR.c_str());
+  SYLAR_ASSERT(d);
+  struct dirent *ent;
+  while ((ent = readdir(d)) != nullptr) {
+    unlink((TEST_DIR + "/" + ent->d_name).c_str());
+  }
+  closedir(d);
+}
+
+// 读文件内容，.gz结尾的先解压
+static std::string ReadFile(const std::string &path) {
+  std::string out;
+  gzFile gz = gzopen(path.c_str(), "rb");
+  SYLAR_ASSERT(gz);
+  char buf[4096];
+  int n;
+  while ((n = gzread(gz, buf, sizeof(buf))) > 0) {
+    out.append(buf, n);
+  }
+  gzclose(gz);
+  return out;
+}
+
+static uint64_t FileSize(const std::string &path) {
+  struct stat st;
+  SYLAR_ASSERT(stat(path.c_str(), &st) == 0);
+  return st.st_size;
+}
+
+// 按大小轮转并压缩，只保留max_files个旧文件，剩下的内容是连续的
+void test_size() {
+  CleanDir();
+  std::string path = TEST_DIR + "/size.log";
+  sylar::LogRotatePolicy policy;
+  policy.max_size = 16 * 1024;
+  policy.max_files = 3;
+  policy.compress = true;
+  sylar::Logger::ptr logger(new sylar::Logger("rotate_size"));
+  logger->setFormatter("%m%n");
+  logger->addAppender(
+      sylar::LogAppender::ptr(new sylar::FileAppender(path, policy)));
+  for (int i = 0; i < 20000; ++i) {
+    SYLAR_LOG_INFO(logger) << i;
+  }
+  logger->clearAppenders();
+  sylar::LogCompressorMgr::getInstance()->flush();
+
+  std::vector<std::string> files = ListRotated("size.log");
+  SYLAR_ASSERT(files.size() == 3);
+  std::string all;
+  for (auto &i : files) {
+    SYLAR_ASSERT(i.size() > 3 && i.compare(i.size() - 3, 3, ".gz") == 0);
+    std::string content = ReadFile(TEST_DIR + "/" + i);
+    SYLAR_ASSERT(content.size() <= policy.max_size);
+    all += content;
+  }
+  SYLAR_ASSERT(FileSize(path) <= policy.max_size);
+  all += ReadFile(path);
+
+  std::stringstream ss(all);
+  int first = -1;
+  int prev = -1;
+  int value;
+  while (ss >> value) {
+    if (first < 0) {
+      first = value;
+    } else {
+      SYLAR_ASSERT(value == prev + 1);
+    }
+    prev = value;
+  }
+  SYLAR_ASSERT(first > 0 && prev == 19999);
+  SYLAR_LOG_INFO(g_logger) << "size rotate kept " << first << ".." << prev;
+}
+
+// 按时间轮转，跨过轮转点后的第一次写入时改名
+void test_interval() {
+  CleanDir();
+  std::string path = TEST_DIR + "/interval.log";
+  sylar::LogRotatePolicy policy;
+  policy.interval = 1;
+  sylar::Logger::ptr logger(new sylar::Logger("rotate_interval"));
+  logger->setFormatter("%m%n");
+  logger->addAppender(
+      sylar::LogAppender::ptr(new sylar::FileAppender(path, policy)));
+  SYLAR_LOG_INFO(logger) << "first";
+  usleep(1100 * 1000);
+  SYLAR_LOG_INFO(logger) << "second";
+  logger->clearAppenders();
+
+  std::vector<std::string> files = ListRotated("interval.log");
+  SYLAR_ASSERT(files.size() == 1);
+  SYLAR_ASSERT(ReadFile(TEST_DIR + "/" + files[0]) == "first\n");
+  SYLAR_ASSERT(ReadFile(path) == "second\n");
+  SYLAR_LOG_INFO(g_logger) << "interval rotate " << files[0];
+}
+
+// 重启时已有的文件：不截断；上一个周期留下的文件第一次写入时轮转
+void test_existing() {
+  CleanDir();
+  std::string path = TEST_DIR + "/existing.log";
+  {
+    std::ofstream ofs(path);
+    ofs << "old\n";
+  }
+  sylar::Logger::ptr logger(new sylar::Logger("rotate_existing"));
+  logger->setFormatter("%m%n");
+  logger->addAppender(sylar::LogAppender::ptr(new sylar::FileAppender(path)));
+  SYLAR_LOG_INFO(logger) << "new";
+  logger->clearAppenders();
+  SYLAR_ASSERT(ReadFile(path) == "old\nnew\n");
+
+  // 修改时间改成两天前
+  struct timeval tv[2];
+  gettimeofday(&tv[0], nullptr);
+  tv[0].tv_sec -= 2 * 86400;
+  tv[1] = tv[0];
+  SYLAR_ASSERT(utimes(path.c_str(), tv) == 0);
+  sylar::LogRotatePolicy policy;
+  policy.interval = 86400;
+  logger->addAppender(
+      sylar::LogAppender::ptr(new sylar::FileAppender(path, policy)));
+  SYLAR_LOG_INFO(logger) << "today";
+  logger->clearAppenders();
+  std::vector<std::string> files = ListRotated("existing.log");
+  SYLAR_ASSERT(files.size() == 1);
+  SYLAR_ASSERT(ReadFile(TEST_DIR + "/" + files[0]) == "old\nnew\n");
+  SYLAR_ASSERT(ReadFile(path) == "today\n");
+  SYLAR_LOG_INFO(g_logger) << "existing ok";
+}
+
+// 改名失败后3秒内needRotate返回false，不会每写一行都重新尝试
+void test_retry() {
+  CleanDir();
+  std::string path = TEST_DIR + "/retry.log";
+  {
+    std::ofstream ofs(path);
+    ofs << "old\n";
+  }
+  sylar::LogRotatePolicy policy;
+  policy.max_size = 16;
+  sylar::LogRotator rotator(path, policy);
+  uint64_t now = time(0);
+  rotator.opened(now);
+  rotator.written(16);
+  SYLAR_ASSERT(rotator.needRotate(now, 1));
+  // 文件被删掉，rename失败
+  unlink(path.c_str());
+  SYLAR_ASSERT(!rotator.rotate(now));
+  SYLAR_ASSERT(!rotator.needRotate(now, 1));
+  SYLAR_ASSERT(!rotator.needRotate(now + 2, 1));
+  SYLAR_ASSERT(rotator.needRotate(now + 3, 1));
+  {
+    std::ofstream ofs(path);
+    ofs << "old\n";
+  }
+  SYLAR_ASSERT(rotator.rotate(now + 3));
+  SYLAR_ASSERT(ListRotated("retry.log").size() == 1);
+  SYLAR_LOG_INFO(g_logger) << "retry ok";
+}
+
+// yaml配置，异步appender在后台线程轮转
+void test_yaml() {
+  CleanDir();
+  std::string path = TEST_DIR + "/yaml.log";
+  YAML::Node root = YAML::Load("logs:\n"
+                               "  - name: rotate_yaml\n"
+                               "    level: info\n"
+                               "    formatter: \"%m%n\"\n"
+                               "    appenders:\n"
+                               "      - type: FileLogAppender\n"
+                               "        path: " + path + "\n"
+                               "        async: true\n"
+                               "        max_size: 8192\n"
+                               "        rotate_interval: daily\n"
+                               "        max_files: 2\n"
+                               "        compress: true\n");
+  sylar::Config::LoadFromYaml(root);
+  sylar::Logger::ptr logger = SYLAR_LOG_NAME("rotate_yaml");
+  std::string yaml = logger->toYamlString();
+  SYLAR_ASSERT(yaml.find("rotate_interval: 86400") != std::string::npos);
+  SYLAR_ASSERT(yaml.find("max_size: 8192") != std::string::npos);
+  SYLAR_ASSERT(yaml.find("compress: true") != std::string::npos);
+  for (int i = 0; i < 5000; ++i) {
+    SYLAR_LOG_INFO(logger) << i;
+  }
+  sylar::AsyncLogWriterMgr::getInstance()->flush();
+  sylar::LogCompressorMgr::getInstance()->flush();
+  std::vector<std::string> files = ListRotated("yaml.log");
+  SYLAR_ASSERT(files.size() == 2);
+  SYLAR_ASSERT(ReadFile(path).find("4999\n") != std::string::npos);
+  SYLAR_LOG_INFO(g_logger) << "yaml ok " << files[0] << " " << files[1];
+}
+
+// 调用线程的开销：轮转只是改名和重新打开，压缩在后台
+static void bench(const std::string &name, const sylar::LogRotatePolicy &policy) {
+  CleanDir();
+  sylar::Logger::ptr logger(new sylar::Logger("rotate_bench"));
+  logger->addAppender(sylar::LogAppender::ptr(
+      new sylar::FileAppender(TEST_DIR + "/bench.log", policy)));
+  const int n = 100000;
+  uint64_t max_us = 0;
+  uint64_t start = sylar::GetCurrentUS();
+  for (int i = 0; i < n; ++i) {
+    uint64_t s = sylar::GetCurrentUS();
+    SYLAR_LOG_INFO(logger) << "request path=/index.html status=" << 200
+                           << " bytes=" << i;
+    max_us = std::max(max_us, sylar::GetCurrentUS() - s);
+  }
+  uint64_t cost = sylar::GetCurrentUS() - start;
+  logger->clearAppenders();
+  sylar::LogCompressorMgr::getInstance()->flush();
+  SYLAR_LOG_INFO(g_logger) << name << " lines/s=" << n * 1000000ull / cost
+                           << " max_us=" << max_us << " files="
+                           << ListRotated("bench.log").size();
+}
+
+void test_bench() {
+  bench("no rotate      ", sylar::LogRotatePolicy());
+  sylar::LogRotatePolicy policy;
+  policy.max_size = 1024 * 1024;
+  policy.max_files = 5;
+  policy.compress = true;
+  bench("rotate+compress", policy);
+}
+
+int main() {
+  test_size();
+  test_interval();
+  test_existing();
+  test_retry();
+  test_yaml();
+  test_bench();
+  return 0;
+}
@@ -8,9 +8,14 @@
  * Copyright 2024 OBKoro1, All Rights Reserved. 
  * 2024-03-22 15:33:29
  */
+#include "sylar/config.h"
 #include "sylar/log.h"
+#include "sylar/marco.h"
 #include "sylar/scheduler.h"
 #include "sylar/util.h"
+#include <atomic>
+#include <set>
+#include <string>
 #include <unistd.h>
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
@@ -38,12 +43,158 @@ void test1() {
     SYLAR_LOG_INFO(g_logger) << "over";
 }
 
+// 每个任务再派生出若干子任务，比较全局队列和work stealing两种模式的吞吐
+static std::atomic<uint64_t> s_done = {0};
+
+void fan_out_leaf() { ++s_done; }
+
+void fan_out_root() {
+  for (int i = 0; i < 100; ++i) {
+    sylar::Scheduler::GetThis()->schedule(&fan_out_leaf);
+  }
+  ++s_done;
+}
+
+void test_fan_out(bool work_stealing) {
+  sylar::Config::Lookup<bool>("scheduler.work_stealing")->setValue(work_stealing);
+  for (std::size_t threads = 1; threads <= 16; threads *= 2) {
+    s_done = 0;
+    uint64_t start = sylar::GetCurrentUS();
+    {
+      sylar::Scheduler sc(threads, false, "fan_out");
+      sc.start();
+      for (int i = 0; i < 2000; ++i) {
+        sc.schedule(&fan_out_root);
+      }
+      sc.stop();
+    }
+    uint64_t used = sylar::GetCurrentUS() - start;
+    SYLAR_LOG_ERROR(g_logger) << "work_stealing=" << work_stealing
+                              << " threads=" << threads << " tasks=" << s_done
+                              << " used=" << used << "us tasks/s="
+                              << s_done * 1000000 / (used ? used : 1);
+  }
+}
+
+// 每个任务中途让出一次，结束后协程回到协程池，后续任务不再新建协程
+void yield_once() {
+  sylar::Fiber::YieldToReady();
+  ++s_done;
+}
+
+static std::atomic<uint64_t> s_bad_stack = {0};
+
+// 回调任务从协程池取到的协程必须是默认大小的栈
+void check_stack() {
+  if (sylar::Fiber::GetThis()->getStackSize() !=
+      sylar::Fiber::GetDefaultStackSize()) {
+    ++s_bad_stack;
+  }
+  yield_once();
+}
+
+void test_fiber_pool() {
+  s_done = 0;
+  sylar::Scheduler sc(2, false, "fiber_pool");
+  sc.start();
+  for (int i = 0; i < 10000; ++i) {
+    sc.schedule(&yield_once);
+    if (i % 100 == 0) {
+      usleep(1000);
+    }
+  }
+  // 用户指定小栈的协程结束后不能放进协程池
+  for (int i = 0; i < 1000; ++i) {
+    sc.schedule(sylar::Fiber::ptr(new sylar::Fiber(&yield_once, 16 * 1024)));
+    sc.schedule(&check_stack);
+    if (i % 100 == 0) {
+      usleep(1000);
+    }
+  }
+  sc.stop();
+  SYLAR_ASSERT(s_done == 12000 && s_bad_stack == 0);
+  uint64_t hits = sc.getFiberPoolHits();
+  uint64_t misses = sc.getFiberPoolMisses();
+  SYLAR_LOG_ERROR(g_logger) << "tasks=" << s_done << " pool size="
+                            << sc.getFiberPoolSize() << " hits=" << hits
+                            << " misses=" << misses << " reuse rate="
+                            << hits * 100 / (hits + misses ? hits + misses : 1)
+                            << "%";
+}
+
+// 正在运行的任务再指定其他线程运行子任务，同时调用stop：
+// 任务刚从队列取出或者窃取到手时别的线程不能退出，否则指定给它的子任务永远不会运行
+static std::atomic<uint64_t> s_pinned_done = {0};
+static std::atomic<uint64_t> s_pinned = {0};
+// 本轮见过的工作线程id
+static sylar::Mutex s_threads_mutex;
+static std::set<int> s_threads;
+
+void stop_race_root() {
+  // 让出几次，任务回到本地队列，可以被其他线程窃取
+  for (int i = 0; i < 3; ++i) {
+    sylar::Fiber::YieldToReady();
+  }
+  std::set<int> threads;
+  {
+    sylar::Mutex::Lock lock(s_threads_mutex);
+    s_threads.insert(sylar::getThreadId());
+    threads = s_threads;
+  }
+  for (int thr : threads) {
+    ++s_pinned;
+    sylar::Scheduler::GetThis()->schedule([]() { ++s_pinned_done; }, thr);
+  }
+  ++s_done;
+}
+
+void test_stop_race() {
+  sylar::Config::Lookup<bool>("scheduler.work_stealing")->setValue(true);
+  const int rounds = 300;
+  const int roots = 20;
+  s_done = 0;
+  s_pinned_done = 0;
+  s_pinned = 0;
+  for (int r = 0; r < rounds; ++r) {
+    s_threads.clear();
+    sylar::Scheduler sc(8, false, "stop_race");
+    sc.start();
+    for (int i = 0; i < roots; ++i) {
+      sc.schedule(&stop_race_root);
+    }
+    sc.stop();
+  }
+  SYLAR_LOG_ERROR(g_logger) << "stop race rounds=" << rounds
+                            << " roots=" << s_done
+                            << " pinned=" << s_pinned_done << "/" << s_pinned;
+  SYLAR_ASSERT(s_done == (uint64_t)rounds * roots &&
+               s_pinned_done == s_pinned);
+}
 
 int main(int argc, char **argv) {
   //   sylar::Scheduler sc;
   //   sc.start();
   //   sc.schedule(&test_fiber1);
   //   sc.stop();
+  if (argc > 1 && std::string(argv[1]) == "fan_out") {
+    g_logger->setLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    test_fan_out(false);
+    test_fan_out(true);
+    return 0;
+  }
+  if (argc > 1 && std::string(argv[1]) == "stop_race") {
+    g_logger->setLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    test_stop_race();
+    return 0;
+  }
+  if (argc > 1 && std::string(argv[1]) == "fiber_pool") {
+    g_logger->setLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    test_fiber_pool();
+    return 0;
+  }
   test1();
 
   return 0;
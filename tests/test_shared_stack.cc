@@ -0,0 +1,122 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-17 14:20:31
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-17 14:20:31
+ * @FilePath     : /tests/test_shared_stack.cc
+ * @Description  : 对比独立栈和共享栈模式下每个空闲连接占用的内存
+ * Copyright 2024 OBKoro1, All Rights Reserved. 
+ * 2026-10-17 14:20:31
+ */
+#include "sylar/config.h"
+#include "sylar/fdmanager.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+std::atomic<int> g_waiting = {0};
+std::atomic<int> g_finished = {0};
+
+// 返回进程的虚拟内存和常驻内存，单位KB
+void get_memory(long &vsz, long &rss) {
+  vsz = rss = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (!fp) {
+    return;
+  }
+  if (fscanf(fp, "%ld %ld", &vsz, &rss) != 2) {
+    vsz = rss = 0;
+  }
+  fclose(fp);
+  long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+  vsz *= page_kb;
+  rss *= page_kb;
+}
+
+// 模拟keep-alive连接：处理函数用掉一些栈后阻塞在read上
+void handle_client(int fd) {
+  char buf[2048];
+  memset(buf, 0, sizeof(buf));
+  ++g_waiting;
+  int rt = read(fd, buf, sizeof(buf));
+  if (rt != 1) {
+    SYLAR_LOG_ERROR(g_logger) << "read fd=" << fd << " rt=" << rt;
+  }
+  ++g_finished;
+}
+
+// 用法: test_shared_stack [private|shared] [连接数]
+int main(int argc, char **argv) {
+  bool shared = argc > 1 && std::string(argv[1]) == "shared";
+  int n = argc > 2 ? atoi(argv[2]) : 10000;
+
+  SYLAR_LOG_ROOT()->setLevel(sylar::LogLevel::WARN);
+  SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+  sylar::Config::Lookup<bool>("scheduler.shared_stack")->setValue(shared);
+
+  // 每个连接一对fd
+  rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  if ((rlim_t)n * 2 + 64 > rl.rlim_cur) {
+    n = (rl.rlim_cur - 64) / 2;
+  }
+
+  std::vector<int> fds(n * 2);
+  for (int i = 0; i < n; ++i) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i * 2])) {
+      SYLAR_LOG_ERROR(g_logger) << "socketpair errno=" << errno;
+      return 1;
+    }
+    sylar::FdMgr::getInstance()->get(fds[i * 2], true);
+  }
+
+  {
+    sylar::IOManager iom(1, false, "bench");
+    long vsz_before, rss_before;
+    get_memory(vsz_before, rss_before);
+
+    for (int i = 0; i < n; ++i) {
+      int fd = fds[i * 2];
+      iom.schedule([fd]() { handle_client(fd); });
+    }
+    while (g_waiting < n) {
+      usleep(10 * 1000);
+    }
+    usleep(100 * 1000);
+
+    long vsz_after, rss_after;
+    get_memory(vsz_after, rss_after);
+    SYLAR_LOG_WARN(g_logger)
+        << (shared ? "shared" : "private") << " stack connections=" << n
+        << " vsz=" << (vsz_after - vsz_before) << "KB rss="
+        << (rss_after - rss_before) << "KB per connection vsz="
+        << (vsz_after - vsz_before) * 1024 / n << "B rss="
+        << (rss_after - rss_before) * 1024 / n << "B";
+
+    for (int i = 0; i < n; ++i) {
+      if (write(fds[i * 2 + 1], "x", 1) != 1) {
+        SYLAR_LOG_ERROR(g_logger) << "write errno=" << errno;
+      }
+    }
+    while (g_finished < n) {
+      usleep(10 * 1000);
+    }
+  }
+
+  for (auto fd : fds) {
+    close(fd);
+  }
+  return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * @Author       : wenwneyuyu
+ * @Date         : 2026-10-18 00:31:05
+ * @LastEditors  : wenwenyuyu
+ * @LastEditTime : 2026-10-18 00:31:05
+ * @FilePath     : /tests/test_timer_wheel.cc
+ * @Description  :
+ * Copyright 2024 OBKoro1, All Rights Reserved.
+ * 2026-10-18 00:31:05
+ */
+
+#include "sylar/log.h"
+#include "sylar/marco.h"
+#include "sylar/mutex.h"
+#include "sylar/thread.h"
+#include "sylar/timer.h"
+#include "sylar/util.h"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <set>
+#include <unistd.h>
+#include <vector>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int N = 100000;
+
+class TestTimerManager : public sylar::TimerManager {
+protected:
+  void onTimerInsertedAtFront() override {}
+};
+
+// 只有创建它的线程是所属线程
+class OwnedTimerManager : public sylar::TimerManager {
+public:
+  OwnedTimerManager() : m_owner(sylar::getThreadId()) {}
+
+protected:
+  void onTimerInsertedAtFront() override {}
+  bool isOwnerThread() const override {
+    return sylar::getThreadId() == m_owner;
+  }
+
+private:
+  pid_t m_owner;
+};
+
+// 原来的实现：读写锁 + std::set
+struct SetTimer {
+  typedef std::shared_ptr<SetTimer> ptr;
+  uint64_t next;
+  std::function<void()> cb;
+  struct Comparator {
+    bool operator()(const ptr &lhs, const ptr &rhs) const {
+      if (lhs->next != rhs->next) {
+        return lhs->next < rhs->next;
+      }
+      return lhs.get() < rhs.get();
+    }
+  };
+};
+
+// 不同到期时间的定时器都要按顺序触发，不能提前
+void test_expire() {
+  TestTimerManager mgr;
+  std::vector<uint64_t> fired;
+  uint64_t start = sylar::GetMonotonicMS();
+  std::vector<uint64_t> delays = {0, 1, 5, 255, 256, 300, 1000, 1500};
+  for (auto d : delays) {
+    mgr.addTimer(d, [&fired, d, start]() {
+      fired.push_back(d);
+      uint64_t now = sylar::GetMonotonicMS();
+      SYLAR_ASSERT(now >= start + d);
+      SYLAR_ASSERT(now <= start + d + 20);
+    });
+  }
+  sylar::Timer::ptr cancelled = mgr.addTimer(700, []() { SYLAR_ASSERT(false); });
+  int recurring = 0;
+  sylar::Timer::ptr rec =
+      mgr.addTimer(100, [&recurring]() { ++recurring; }, true);
+  cancelled->cancel();
+
+  while (fired.size() < delays.size()) {
+    uint64_t next = mgr.getNextTimer();
+    SYLAR_ASSERT(next != ~0ull);
+    usleep(next > 10 ? 10000 : next * 1000);
+    std::vector<std::function<void()>> cbs;
+    mgr.ListExpiredCb(cbs);
+    for (auto &cb : cbs) {
+      cb();
+    }
+  }
+  rec->cancel();
+  SYLAR_ASSERT(fired == delays);
+  SYLAR_ASSERT(recurring >= 13 && recurring <= 15);
+  SYLAR_ASSERT(mgr.getNextTimer() == ~0ull);
+  SYLAR_LOG_INFO(g_logger) << "expire ok recurring=" << recurring;
+}
+
+// 放在上层的定时器，也要能算出准确的下次到期时间
+void test_next() {
+  TestTimerManager mgr;
+  std::vector<uint64_t> delays = {70000, 20000, 3000000, 300};
+  std::vector<sylar::Timer::ptr> timers;
+  uint64_t min = ~0ull;
+  for (auto d : delays) {
+    timers.push_back(mgr.addTimer(d, []() {}));
+    min = std::min(min, d);
+    uint64_t next = mgr.getNextTimer();
+    SYLAR_ASSERT(next <= min && next + 5 >= min);
+  }
+  // 取消最早的之后，下次到期时间在处理时重新计算
+  timers.back()->cancel();
+  usleep(350 * 1000);
+  std::vector<std::function<void()>> cbs;
+  mgr.ListExpiredCb(cbs);
+  SYLAR_ASSERT(cbs.empty());
+  uint64_t next = mgr.getNextTimer();
+  SYLAR_ASSERT(next <= 20000 - 350 && next + 20 >= 20000 - 350);
+  for (auto &t : timers) {
+    t->cancel();
+  }
+  SYLAR_ASSERT(mgr.getNextTimer() == ~0ull);
+  SYLAR_LOG_INFO(g_logger) << "next ok";
+}
+
+// 同一毫秒内的定时器按微秒触发，不提前也不取整到毫秒
+void test_us() {
+  TestTimerManager mgr;
+  std::vector<uint64_t> fired;
+  uint64_t start = sylar::GetMonotonicUS();
+  std::vector<uint64_t> delays = {100, 250, 400, 700, 1300, 2050};
+  for (auto it = delays.rbegin(); it != delays.rend(); ++it) {
+    uint64_t d = *it;
+    mgr.addTimerUS(d, [&fired, d, start]() {
+      SYLAR_ASSERT(sylar::GetMonotonicUS() >= start + d);
+      fired.push_back(d);
+    });
+  }
+  uint64_t next = mgr.getNextTimerUS();
+  SYLAR_ASSERT(next <= 100 && next + 50 >= 100);
+  SYLAR_ASSERT(mgr.getNextTimer() == 1);
+
+  uint64_t late = 0;
+  while (fired.size() < delays.size()) {
+    uint64_t wait = mgr.getNextTimerUS();
+    if (wait) {
+      usleep(wait);
+    }
+    std::size_t before = fired.size();
+    std::vector<std::function<void()>> cbs;
+    mgr.ListExpiredCb(cbs);
+    for (auto &cb : cbs) {
+      cb();
+    }
+    if (fired.size() > before) {
+      late = std::max(late, sylar::GetMonotonicUS() - start - fired.back());
+    }
+  }
+  SYLAR_ASSERT(fired == delays);
+  SYLAR_LOG_INFO(g_logger) << "us ok max late=" << late << "us";
+}
+
+// 其他线程取消的定时器不再触发，由所属线程移出
+void test_post_cancel() {
+  OwnedTimerManager mgr;
+  std::vector<sylar::Timer::ptr> timers;
+  int fired = 0;
+  for (int i = 0; i < 1000; ++i) {
+    timers.push_back(mgr.addTimer(i % 20, [&fired]() { ++fired; }));
+  }
+  int cancelled = 0;
+  sylar::Thread thr(
+      [&timers, &cancelled]() {
+        for (size_t i = 0; i < timers.size(); i += 2) {
+          cancelled += timers[i]->cancel();
+          // 重复取消返回false
+          SYLAR_ASSERT(!timers[i]->cancel());
+        }
+      },
+      "canceller");
+  thr.join();
+  timers.clear();
+
+  while (mgr.getNextTimer() != ~0ull) {
+    usleep(5000);
+    std::vector<std::function<void()>> cbs;
+    mgr.ListExpiredCb(cbs);
+    for (auto &cb : cbs) {
+      cb();
+    }
+  }
+  SYLAR_LOG_INFO(g_logger) << "post cancel fired=" << fired
+                           << " cancelled=" << cancelled;
+  SYLAR_ASSERT(cancelled == 500 && fired == 500);
+}
+
+void bench_wheel() {
+  TestTimerManager mgr;
+  std::vector<sylar::Timer::ptr> timers;
+  timers.reserve(N);
+  uint64_t start = sylar::GetCurrentUS();
+  for (int i = 0; i < N; ++i) {
+    timers.push_back(mgr.addTimer(1000 + i % 5000, []() {}));
+  }
+  uint64_t add_us = sylar::GetCurrentUS() - start;
+  start = sylar::GetCurrentUS();
+  for (auto &t : timers) {
+    t->cancel();
+  }
+  uint64_t cancel_us = sylar::GetCurrentUS() - start;
+  SYLAR_LOG_INFO(g_logger) << "wheel add=" << add_us * 1000 / N
+                           << "ns cancel=" << cancel_us * 1000 / N << "ns";
+}
+
+void bench_set() {
+  sylar::RWMutex mutex;
+  std::set<SetTimer::ptr, SetTimer::Comparator> timers;
+  std::vector<SetTimer::ptr> handles;
+  handles.reserve(N);
+  uint64_t start = sylar::GetCurrentUS();
+  for (int i = 0; i < N; ++i) {
+    SetTimer::ptr t(new SetTimer);
+    t->next = sylar::GetMonotonicMS() + 1000 + i % 5000;
+    sylar::RWMutex::WriteLock lock(mutex);
+    timers.insert(t);
+    handles.push_back(t);
+  }
+  uint64_t add_us = sylar::GetCurrentUS() - start;
+  start = sylar::GetCurrentUS();
+  for (auto &t : handles) {
+    sylar::RWMutex::WriteLock lock(mutex);
+    timers.erase(timers.find(t));
+  }
+  uint64_t cancel_us = sylar::GetCurrentUS() - start;
+  SYLAR_LOG_INFO(g_logger) << "set   add=" << add_us * 1000 / N
+                           << "ns cancel=" << cancel_us * 1000 / N << "ns";
+}
+
+int main() {
+  test_expire();
+  test_next();
+  test_us();
+  test_post_cancel();
+  bench_wheel();
+  bench_set();
+  return 0;
+}